@@ -1,17 +1,27 @@
 /*
  * Universal File Content Search Tool
- * Search any text-based file for specific content
+ * Search any text-based file for specific content, interactively or from the command line
  * Code hints and optimizations by artlest
- * Compatible with all standard C++ compilers and online IDEs
+ * Needs C++17; memory mapping, sidecars and the daemon need POSIX, and SIMD kernels are used on x86 when present
+ * See README.md for the batch options, pattern syntax, index commands and exit codes
  */
 
 #include <iostream>
-#include <fstream>
-#include <string>
-#include <vector>
 #include <sstream>
 #include <iomanip>
-#include <algorithm>
+
+#include "textsearch.h"
+
+// Unix domain sockets for the persistent search daemon, available wherever POSIX mapping is
+#if TEXT_SEARCH_HAS_MMAP
+#include <csignal>
+#include <cstdint>
+#include <sys/socket.h>
+#include <sys/un.h>
+#define TEXT_SEARCH_HAS_UNIX_SOCKETS 1
+#else
+#define TEXT_SEARCH_HAS_UNIX_SOCKETS 0
+#endif
 
 // Function to display professional application header
 void display_application_header() {
@@ -25,11 +35,9 @@ void display_application_header() {
 }
 
 // Function to check if file exists and is accessible
-bool validate_file_accessibility(const std::string& file_path) {
-    // You verify the file exists and can be opened for reading
-    std::ifstream test_file(file_path);
-    
-    if (!test_file.is_open()) {
+bool validate_file_accessibility(const std::string& file_path, bool file_opened) {
+    // You report the outcome of the single open performed by the caller
+    if (!file_opened) {
         std::cout << "Error: Cannot access file '" << file_path << "'\n";
         std::cout << "Please check:\n";
         std::cout << "  - File path is correct\n";
@@ -37,154 +45,175 @@ bool validate_file_accessibility(const std::string& file_path) {
         std::cout << "  - You have read permissions\n\n";
         return false;
     }
-    
-    test_file.close();
+
     return true; // You confirm successful file validation
 }
 
 // Function to determine if file is a supported text format
 bool verify_text_file_format(const std::string& file_path) {
-    // You extract the file extension for format validation
-    size_t extension_position = file_path.find_last_of(".");
-    
-    if (extension_position == std::string::npos) {
-        // You handle files without extensions as potential text files
+    if (is_supported_text_format(file_path)) {
         return true;
     }
     
-    // You convert extension to lowercase for comparison
-    std::string file_extension = file_path.substr(extension_position);
-    std::transform(file_extension.begin(), file_extension.end(), 
-                  file_extension.begin(), ::tolower);
-    
-    // You define supported text file extensions
-    std::vector<std::string> supported_extensions = {
-        ".txt", ".cpp", ".c", ".h", ".hpp", ".py", ".js", ".html", 
-        ".htm", ".css", ".xml", ".json", ".md", ".log", ".cfg", 
-        ".ini", ".yaml", ".yml", ".sql", ".sh", ".bat", ".cs", 
-        ".java", ".php", ".rb", ".go", ".rs", ".swift"
-    };
-    
-    // You check if the file extension is in the supported list
-    for (const std::string& supported_ext : supported_extensions) {
-        if (file_extension == supported_ext) {
-            return true; // You confirm supported file format
-        }
-    }
-    
-    std::cout << "Warning: '" << file_extension << "' may not be a text file format.\n";
+    std::cout << "Warning: '" << lowercase_file_extension(file_path) << "' may not be a text file format.\n";
     std::cout << "Attempting to search anyway...\n\n";
     return true; // You allow searching of unknown formats
 }
 
-// Function to search for text within a specific file with enhanced results
-std::vector<std::string> search_file_content(const std::string& file_path, 
-                                           const std::string& search_term,
-                                           bool show_context = false) {
-    // You initialize the results container for matching lines
-    std::vector<std::string> matching_results;
-    std::ifstream input_file(file_path);
-    
-    // You verify file accessibility before processing
-    if (!input_file.is_open()) {
-        return matching_results;
+// Size of the reusable buffer that collects result text before it is written out
+const size_t OUTPUT_SINK_CAPACITY = 1 << 20;
+
+#if TEXT_SEARCH_HAS_MMAP
+// Function to write a whole byte range to a descriptor, retrying after interrupts and partial writes
+// Returns false once the descriptor stops accepting output
+bool write_all_bytes(int output_descriptor, const char* output_data, size_t output_size) {
+    while (output_size > 0) {
+        ssize_t bytes_written = ::write(output_descriptor, output_data, output_size);
+        if (bytes_written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        output_data += bytes_written;
+        output_size -= static_cast<size_t>(bytes_written);
     }
-    
-    std::string current_line;
-    std::string previous_line = "";
-    std::string next_line = "";
-    int line_number = 1;
-    int match_counter = 0;
-    
-    // You read all lines into memory for context search capability
-    std::vector<std::string> all_file_lines;
-    while (std::getline(input_file, current_line)) {
-        all_file_lines.push_back(current_line);
+    return true;
+}
+#endif
+
+// Buffered writer for search results that bypasses iostream formatting
+// By default it writes to standard output, flushing std::cout first so the two never interleave out of order
+class result_output_sink {
+public:
+    typedef std::function<void(const char*, size_t)> output_writer;
+
+    explicit result_output_sink(output_writer writer = write_to_standard_output) : write_through(std::move(writer)) {
+        sink_buffer.reserve(OUTPUT_SINK_CAPACITY);
     }
-    input_file.close();
-    
-    // You process each line for search term matching with context
-    for (int line_index = 0; line_index < all_file_lines.size(); line_index++) {
-        current_line = all_file_lines[line_index];
-        
-        // You convert both search term and line to lowercase for case-insensitive search
-        std::string lowercase_line = current_line;
-        std::string lowercase_search = search_term;
-        
-        std::transform(lowercase_line.begin(), lowercase_line.end(), 
-                      lowercase_line.begin(), ::tolower);
-        std::transform(lowercase_search.begin(), lowercase_search.end(), 
-                      lowercase_search.begin(), ::tolower);
-        
-        // You check if the current line contains the search term
-        if (lowercase_line.find(lowercase_search) != std::string::npos) {
-            match_counter++;
-            
-            // You format the basic result with line number and content
-            std::stringstream result_formatter;
-            result_formatter << "Match " << match_counter << " - Line " << (line_index + 1) 
-                           << ": " << current_line;
-            
-            // You add context lines if requested and available
-            if (show_context) {
-                if (line_index > 0) {
-                    result_formatter << "\n    Context Before: " << all_file_lines[line_index - 1];
-                }
-                if (line_index < all_file_lines.size() - 1) {
-                    result_formatter << "\n    Context After:  " << all_file_lines[line_index + 1];
-                }
-                result_formatter << "\n";
+    result_output_sink(const result_output_sink&) = delete;
+    result_output_sink& operator=(const result_output_sink&) = delete;
+    ~result_output_sink() { flush(); }
+
+    // You copy text into the buffer and write straight through anything larger than the buffer
+    void write(std::string_view output_text) {
+        if (sink_buffer.size() + output_text.size() > OUTPUT_SINK_CAPACITY) {
+            flush();
+            if (output_text.size() >= OUTPUT_SINK_CAPACITY) {
+                write_through(output_text.data(), output_text.size());
+                return;
             }
-            
-            matching_results.push_back(result_formatter.str());
         }
+        sink_buffer.append(output_text.data(), output_text.size());
     }
-    
-    return matching_results; // You return all matching results with context
-}
 
-// Function to get file information and statistics
-void display_file_information(const std::string& file_path) {
-    // You gather and display comprehensive file statistics
-    std::ifstream file_stream(file_path);
-    
-    if (!file_stream.is_open()) {
-        return; // You exit if file cannot be accessed
+    void write_decimal(size_t value) {
+        char digit_buffer[20];
+        write(std::string_view(digit_buffer, format_decimal(value, digit_buffer)));
     }
-    
-    std::string current_line;
-    int total_line_count = 0;
-    int total_character_count = 0;
-    int total_word_count = 0;
-    
-    // You calculate file statistics while reading
-    while (std::getline(file_stream, current_line)) {
-        total_line_count++;
-        total_character_count += current_line.length();
-        
-        // You count words by splitting on whitespace
-        std::stringstream word_counter(current_line);
-        std::string individual_word;
-        while (word_counter >> individual_word) {
-            total_word_count++;
+
+    // You hand the buffered bytes to the operating system and keep the storage for reuse
+    void flush() {
+        if (sink_buffer.empty()) {
+            return;
         }
+        write_through(sink_buffer.data(), sink_buffer.size());
+        sink_buffer.clear();
     }
-    
-    file_stream.close();
-    
-    // You display comprehensive file information
+
+private:
+    static void write_to_standard_output(const char* output_data, size_t output_size) {
+        std::cout.flush();
+#if TEXT_SEARCH_HAS_MMAP
+        write_all_bytes(STDOUT_FILENO, output_data, output_size); // You drop output the pipe no longer accepts
+#else
+        std::fwrite(output_data, 1, output_size, stdout);
+        std::fflush(stdout);
+#endif
+    }
+
+    output_writer write_through;
+    std::string sink_buffer;
+};
+
+// Sink shared by every search that prints results to standard output
+result_output_sink& standard_output_sink() {
+    static result_output_sink output_sink;
+    return output_sink;
+}
+
+// Function to format the records of one search at display time, one separated block per match
+// Each block reads "Match k - Line n [labels]: text" followed by any requested context lines
+void write_match_set(result_output_sink& output_sink, const search_match_set& match_set,
+                     const search_engine& engine) {
+    const context_window_options& context_window = engine.context_window();
+    std::vector<std::string_view> lines_before;
+    std::vector<std::string_view> lines_after;
+    size_t match_counter = 0;
+
+    for (const match_record& record : match_set.match_records) {
+        std::string_view line_text = match_set.line_text(record);
+        output_sink.write("Match ");
+        output_sink.write_decimal(++match_counter);
+        output_sink.write(" - Line ");
+        output_sink.write_decimal(record.line_number);
+
+        // You name the terms that matched this line
+        std::string match_labels = engine.match_labels(line_text);
+        if (!match_labels.empty()) {
+            output_sink.write(" [");
+            output_sink.write(match_labels);
+            output_sink.write("]");
+        }
+        output_sink.write(": ");
+        output_sink.write(line_text);
+
+        if (context_window.enabled()) {
+            match_set.context_lines(record, context_window, lines_before, lines_after);
+            for (std::string_view preceding_line : lines_before) {
+                output_sink.write("\n    Context Before: ");
+                output_sink.write(preceding_line);
+            }
+            for (std::string_view following_line : lines_after) {
+                output_sink.write("\n    Context After:  ");
+                output_sink.write(following_line);
+            }
+            output_sink.write("\n");
+        }
+        output_sink.write("\n------------------------------------------\n");
+    }
+}
+
+// Function to get file information and statistics
+void display_file_information(const std::string& file_path, const file_content_statistics& file_statistics) {
+    // You display comprehensive file information gathered during the search pass
     std::cout << "File Information:\n";
     std::cout << "  Path: " << file_path << "\n";
-    std::cout << "  Lines: " << total_line_count << "\n";
-    std::cout << "  Words: " << total_word_count << "\n";
-    std::cout << "  Characters: " << total_character_count << "\n\n";
+    std::cout << "  Lines: " << file_statistics.line_count << "\n";
+    std::cout << "  Words: " << file_statistics.word_count << "\n";
+    std::cout << "  Characters: " << file_statistics.character_count << "\n\n";
+}
+
+// Function to show the order in which the words of an all-words query are checked
+void display_term_order(const compiled_query& query) {
+    if (query.kind != compiled_query::all_terms) {
+        return;
+    }
+    std::cout << "All words must appear; checked rarest first:";
+    for (size_t term_index = 0; term_index < query.terms_matcher.term_count(); term_index++) {
+        std::cout << (term_index == 0 ? " \"" : ", \"") << query.terms_matcher.folded_term(term_index) << "\"";
+    }
+    std::cout << "\n";
 }
 
 // Function to execute search operation on specified file
-void execute_file_search(const std::string& file_path, const std::string& search_query, 
-                        bool include_context = false) {
-    // You validate file accessibility before searching
-    if (!validate_file_accessibility(file_path)) {
+// Mapped files go through the result cache when one is given, so repeated searches skip the rescan
+void execute_file_search(const std::string& file_path, const std::string& search_query,
+                        const context_window_options& context_window = context_window_options(),
+                        search_result_cache* result_cache = nullptr) {
+    // You open the file exactly once for validation, statistics and searching
+    input_file_handle input_file;
+    if (!validate_file_accessibility(file_path, input_file.open(file_path))) {
         return; // You exit if file validation fails
     }
     
@@ -193,31 +222,131 @@ void execute_file_search(const std::string& file_path, const std::string& search
         return; // You exit if format validation fails
     }
     
+    // You compile the query once before reading any content
+    search_engine engine;
+    std::string error_message;
+    if (!engine.compile(search_query, error_message)) {
+        std::cout << "Error: " << error_message << ".\n\n";
+        return;
+    }
+    engine.set_context_window(context_window);
+
+    // You execute the search and gather file statistics in one fused pass, unless the cache already knows them
+    // A block filter sidecar beside the file narrows the search to the blocks that may match
+    file_content_statistics file_statistics;
+    result_cache_lookup cache_lookup;
+    block_filter_summary filter_summary;
+    search_match_set search_results;
+    std::shared_ptr<mapped_file_region> mapped_file = std::make_shared<mapped_file_region>();
+    if (!search_filtered_file(file_path, input_file, engine.query(), search_results, &file_statistics,
+                              &filter_summary)) {
+        if (result_cache != nullptr && mapped_file->map(input_file)) {
+            search_results = result_cache->search(std::move(mapped_file), input_file.identity(), engine.query(),
+                                                  &file_statistics, &cache_lookup);
+        } else {
+            search_results = engine.search_opened_file(input_file, &file_statistics);
+        }
+    }
+
     // You display file information for user reference
-    display_file_information(file_path);
+    display_file_information(file_path, file_statistics);
     
     std::cout << "Searching for: \"" << search_query << "\"\n";
+    if (engine.query().kind == compiled_query::regular_expression) {
+        std::cout << "Regex prefilter: " << engine.query().regex_matcher.prefilter_description() << "\n";
+    }
+    display_term_order(engine.query());
+    if (cache_lookup.kind == result_cache_lookup::cached_result) {
+        std::cout << "Result cache: file unchanged, earlier results reused without rescanning\n";
+    } else if (cache_lookup.kind == result_cache_lookup::appended_tail) {
+        std::cout << "Result cache: file grew, only the last " << cache_lookup.rescanned_bytes << " byte(s) rescanned\n";
+    }
+    if (filter_summary.filtered_blocks > 0) {
+        std::cout << "Block filters: " << filter_summary.candidate_blocks << " of " << filter_summary.filtered_blocks
+                  << " block(s) may match, " << filter_summary.scanned_bytes << " byte(s) scanned\n";
+    }
     std::cout << "==========================================\n";
     
-    // You execute the search operation with optional context
-    std::vector<std::string> search_results = search_file_content(file_path, search_query, include_context);
-    
     // You process and display search results
-    if (search_results.empty()) {
+    if (search_results.match_records.empty()) {
         std::cout << "No matches found for \"" << search_query << "\" in the specified file.\n";
     } else {
-        std::cout << "Found " << search_results.size() << " match(es):\n\n";
+        std::cout << "Found " << search_results.match_records.size() << " match(es):\n\n";
         
-        // You display each search result with proper formatting
-        for (const std::string& result : search_results) {
-            std::cout << result << "\n";
-            std::cout << "------------------------------------------\n";
-        }
+        // You format each match record only now, straight into the buffered sink
+        result_output_sink& output_sink = standard_output_sink();
+        write_match_set(output_sink, search_results, engine);
+        output_sink.flush();
     }
     
     std::cout << "==========================================\n\n";
 }
 
+// Function to search every text file below a directory and report the matches file by file
+// Returns how many files were searched
+size_t execute_directory_search(const std::string& directory_path, const std::string& search_query,
+                                const context_window_options& context_window = context_window_options()) {
+    // You compile the query once; the engine shares copies of it with every worker
+    search_engine engine;
+    std::string error_message;
+    if (!engine.compile(search_query, error_message)) {
+        std::cout << "Error: " << error_message << ".\n\n";
+        return 0;
+    }
+    engine.set_context_window(context_window);
+
+    std::cout << "Searching directory: " << directory_path << "\n";
+    std::cout << "Searching for: \"" << search_query << "\"\n";
+    if (engine.query().kind == compiled_query::regular_expression) {
+        std::cout << "Regex prefilter: " << engine.query().regex_matcher.prefilter_description() << "\n";
+    }
+    display_term_order(engine.query());
+    std::cout << "==========================================\n";
+
+    // You display each file's matches under its own heading as soon as the reorder buffer releases it
+    result_output_sink& output_sink = standard_output_sink();
+    size_t files_with_matches = 0;
+    size_t total_matches = 0;
+    directory_search_summary search_summary = engine.search_directory(
+        directory_path, [&](directory_file_result& file_result) {
+            const std::vector<match_record>& match_records = file_result.file_matches.match_records;
+            if (match_records.empty()) {
+                return;
+            }
+            output_sink.write("File: ");
+            output_sink.write(file_result.file_path);
+            output_sink.write(" - ");
+            output_sink.write_decimal(match_records.size());
+            output_sink.write(" match(es)\n");
+
+            // You format with the caller's engine, which no worker touches, because results arrive one at a time
+            write_match_set(output_sink, file_result.file_matches, engine);
+            files_with_matches++;
+            total_matches += match_records.size();
+        });
+    output_sink.flush();
+
+    const reorder_buffer_statistics& ordering_statistics = search_summary.ordering_statistics;
+    std::cout << "==========================================\n";
+    std::cout << "Directory Summary:\n";
+    std::cout << "  Files searched: " << search_summary.files_searched << "\n";
+    std::cout << "  Files skipped: " << search_summary.files_skipped << " (unsupported format or binary content)\n";
+    if (search_summary.unreadable_entries > 0) {
+        std::cout << "  Unreadable entries: " << search_summary.unreadable_entries << "\n";
+    }
+    std::cout << "  Files with matches: " << files_with_matches << "\n";
+    std::cout << "  Total matches: " << total_matches << "\n";
+
+    // You report head-of-line blocking so slow files holding up the ordered output are visible
+    std::cout << "  Ordered output: " << ordering_statistics.delayed_results
+              << " file(s) waited behind an earlier file for " << std::fixed << std::setprecision(3)
+              << ordering_statistics.blocked_seconds << " s (peak " << ordering_statistics.peak_held_results
+              << " held, " << ordering_statistics.peak_held_bytes << " bytes); window full "
+              << search_summary.admission_throttles << " time(s)\n\n";
+    std::cout.unsetf(std::ios::floatfield);
+    return search_summary.files_searched;
+}
+
 // Function to validate user input parameters
 bool validate_search_input(const std::string& user_input) {
     // You check if the input string is empty
@@ -235,14 +364,188 @@ bool validate_search_input(const std::string& user_input) {
     return true; // You confirm successful input validation
 }
 
+// Function to translate the context answer into before/after line counts
+context_window_options parse_context_option(const std::string& context_option) {
+    context_window_options context_window;
+
+    // You keep the original yes/no answers meaning one line on each side
+    if (context_option == "y" || context_option == "Y" ||
+        context_option == "yes" || context_option == "YES") {
+        context_window.lines_before = 1;
+        context_window.lines_after = 1;
+        return context_window;
+    }
+
+    // You accept "N" for N lines on both sides or "B A" for separate counts
+    std::string normalized_option = context_option;
+    std::replace(normalized_option.begin(), normalized_option.end(), ',', ' ');
+    std::replace(normalized_option.begin(), normalized_option.end(), '/', ' ');
+    std::stringstream option_reader(normalized_option);
+    long long lines_before = 0;
+    long long lines_after = 0;
+    if (!(option_reader >> lines_before) || lines_before < 0) {
+        return context_window; // You treat any other answer as no context
+    }
+    if (!(option_reader >> lines_after)) {
+        lines_after = lines_before;
+    }
+    if (lines_after < 0) {
+        return context_window;
+    }
+
+    context_window.lines_before = std::min(static_cast<size_t>(lines_before), MAX_CONTEXT_LINES);
+    context_window.lines_after = std::min(static_cast<size_t>(lines_after), MAX_CONTEXT_LINES);
+    return context_window;
+}
+
+// Function to build a deterministic log-like buffer for the matcher benchmark
+std::string build_benchmark_content(size_t target_size) {
+    static const char* const benchmark_words[] = {
+        "INFO", "request", "served", "user", "session", "Timeout", "cache", "Disk", "latency",
+        "txn", "commit", "rollback", "queue", "Worker", "thread", "socket", "closed", "retry"
+    };
+    const size_t word_count = sizeof(benchmark_words) / sizeof(benchmark_words[0]);
+
+    std::string benchmark_content;
+    benchmark_content.reserve(target_size + 128);
+    unsigned long long generator_state = 88172645463325252ULL;
+    while (benchmark_content.size() < target_size) {
+        // You vary each line with a cheap xorshift generator so results are reproducible
+        size_t words_on_line = 6 + (generator_state % 10);
+        for (size_t word_index = 0; word_index < words_on_line; word_index++) {
+            generator_state ^= generator_state << 13;
+            generator_state ^= generator_state >> 7;
+            generator_state ^= generator_state << 17;
+            benchmark_content += benchmark_words[generator_state % word_count];
+            benchmark_content += word_index + 1 < words_on_line ? ' ' : '\n';
+        }
+    }
+    return benchmark_content;
+}
+
+// Function to time one matcher over the benchmark content and print its throughput
+template <typename LineCounter>
+void report_benchmark_result(const char* matcher_name, const std::string& benchmark_content,
+                             LineCounter&& count_matching_lines) {
+    auto start_time = std::chrono::steady_clock::now();
+    size_t matching_lines = count_matching_lines();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+
+    double gigabytes_per_second = static_cast<double>(benchmark_content.size()) / 1e9 /
+                                  std::max(elapsed.count(), 1e-9);
+    std::cout << "  " << std::left << std::setw(30) << matcher_name << std::right
+              << std::fixed << std::setprecision(2) << std::setw(8) << gigabytes_per_second << " GB/s  ("
+              << matching_lines << " matching lines)\n";
+    std::cout.unsetf(std::ios::floatfield);
+}
+
+// Function to compare the per-line lowercase copy path against the in-place matching kernels
+void run_matcher_benchmark() {
+    const size_t benchmark_size = 64 << 20;
+    const std::string benchmark_term = "Rollback queue";
+    const std::string folded_term = fold_search_term(benchmark_term);
+    const std::string benchmark_content = build_benchmark_content(benchmark_size);
+    const char* content_begin = benchmark_content.data();
+    const char* content_end = content_begin + benchmark_content.size();
+
+    std::cout << "Matcher Benchmark (" << (benchmark_content.size() >> 20) << " MiB, term \""
+              << benchmark_term << "\"):\n";
+
+    // You reproduce the original path: a lowercase copy of every line and of the term
+    report_benchmark_result("per-line tolower copy", benchmark_content, [&]() {
+        std::stringstream line_reader(benchmark_content);
+        std::string current_line;
+        size_t matching_lines = 0;
+        while (std::getline(line_reader, current_line)) {
+            std::string lowercase_line = current_line;
+            std::string lowercase_search = benchmark_term;
+            std::transform(lowercase_line.begin(), lowercase_line.end(), lowercase_line.begin(), ::tolower);
+            std::transform(lowercase_search.begin(), lowercase_search.end(), lowercase_search.begin(), ::tolower);
+            if (lowercase_line.find(lowercase_search) != std::string::npos) {
+                matching_lines++;
+            }
+        }
+        return matching_lines;
+    });
+
+    // You time every kernel this processor can run so forced and automatic choices can be compared
+    for (const matching_kernel_entry& kernel_entry : available_matching_kernels()) {
+        if (!kernel_entry.kernel_supported) {
+            continue;
+        }
+        std::string matcher_name = std::string("in-place ") + kernel_entry.kernel_name + " kernel";
+        report_benchmark_result(matcher_name.c_str(), benchmark_content, [&]() {
+            size_t matching_lines = 0;
+            for (const char* cursor = content_begin;
+                 (cursor = kernel_entry.kernel_finder(cursor, content_end, folded_term)) != nullptr;
+                 cursor = find_line_end(cursor, content_end)) {
+                matching_lines++;
+            }
+            return matching_lines;
+        });
+    }
+
+    // You time the lazy DFA regex engine on an equivalent typical log pattern
+    lazy_dfa_regex benchmark_regex;
+    std::string regex_error;
+    if (benchmark_regex.compile("rollback\\s+queue", regex_error)) {
+        report_benchmark_result("lazy DFA regex", benchmark_content, [&]() {
+            size_t matching_lines = 0;
+            scan_lines_for_matches(content_begin, content_end, 1, benchmark_regex,
+                                   [&](size_t, const char*, const char*) { matching_lines++; });
+            return matching_lines;
+        });
+    }
+
+    // You time the same expression with its required literal used as a prefilter
+    prefiltered_regex_matcher prefiltered_benchmark_regex;
+    if (prefiltered_benchmark_regex.compile("rollback\\s+queue", regex_error)) {
+        report_benchmark_result("regex + literal prefilter", benchmark_content, [&]() {
+            size_t matching_lines = 0;
+            scan_lines_for_matches(content_begin, content_end, 1, prefiltered_benchmark_regex,
+                                   [&](size_t, const char*, const char*) { matching_lines++; });
+            return matching_lines;
+        });
+    }
+
+    // You time fuzzy matching within one edit, with and without its pigeonhole prefilter
+    fuzzy_term_matcher fuzzy_benchmark_matcher;
+    if (fuzzy_benchmark_matcher.compile("Rolback queue", 1, regex_error)) {
+        report_benchmark_result("fuzzy ~1 (piece prefilter)", benchmark_content, [&]() {
+            size_t matching_lines = 0;
+            scan_lines_for_matches(content_begin, content_end, 1, fuzzy_benchmark_matcher,
+                                   [&](size_t, const char*, const char*) { matching_lines++; });
+            return matching_lines;
+        });
+    }
+    if (fuzzy_benchmark_matcher.compile("Rolback queue", 6, regex_error)) {
+        report_benchmark_result("fuzzy ~6 (bit-parallel scan)", benchmark_content, [&]() {
+            size_t matching_lines = 0;
+            scan_lines_for_matches(content_begin, content_end, 1, fuzzy_benchmark_matcher,
+                                   [&](size_t, const char*, const char*) { matching_lines++; });
+            return matching_lines;
+        });
+    }
+
+    std::cout << "\n";
+}
+
 // Function to display comprehensive usage instructions
 void display_usage_instructions() {
     // You provide detailed instructions for universal file searching
     std::cout << "Universal File Search Instructions:\n";
     std::cout << "==========================================\n";
     std::cout << "1. Enter the complete file path (e.g., 'document.txt' or 'C:\\\\folder\\\\file.txt')\n";
-    std::cout << "2. Enter your search term when prompted\n";
-    std::cout << "3. Choose whether to include context lines (y/n)\n\n";
+    std::cout << "   or a directory to search every text file below it on all cores\n";
+    std::cout << "2. Enter your search term when prompted; several words separated by spaces\n";
+    std::cout << "   find lines holding all of them in any order (earlier versions searched\n";
+    std::cout << "   them as one phrase); put them in quotes, e.g. \"hello world\", to match\n";
+    std::cout << "   the exact phrase as typed. Enter '@terms.txt' to search\n";
+    std::cout << "   for every term listed in that file (one per line) in a single pass,\n";
+    std::cout << "   or 're:' followed by a regular expression (e.g. 're:^error.*txn=\\d+'),\n";
+    std::cout << "   or '~k:term' to allow up to k typos (e.g. '~1:identifer')\n";
+    std::cout << "3. Choose context lines: y/n, a count for both sides (e.g. '2'),\n";
+    std::cout << "   or separate before/after counts (e.g. '2 5')\n\n";
     
     std::cout << "Supported File Types:\n";
     std::cout << "  Text: .txt, .log, .md, .cfg, .ini\n";
@@ -253,11 +556,18 @@ void display_usage_instructions() {
     std::cout << "Search Features:\n";
     std::cout << "  - Case-insensitive matching\n";
     std::cout << "  - Partial word matching\n";
+    std::cout << "  - Fuzzy matching within an edit distance (patterns up to 64 characters)\n";
+    std::cout << "  - Regular expressions: . [] [^] * + ? {m,n} | () ^ $ \\d \\w \\s\n";
     std::cout << "  - Line context display option\n";
-    std::cout << "  - Match counting and statistics\n\n";
+    std::cout << "  - Match counting and statistics\n";
+    std::cout << "  - Matching kernel: " << active_matching_kernel()->kernel_name
+              << " (override with --kernel=scalar|sse2|avx2|avx512|auto)\n";
+    std::cout << "  - Large files scanned on " << search_thread_count() << " thread(s) (override with --threads=N)\n";
+    std::cout << "  - Batch mode without prompts: pass PATTERN PATH... on the command line (see --help)\n\n";
     
     std::cout << "Commands:\n";
     std::cout << "  'help' - Show these instructions\n";
+    std::cout << "  'benchmark' - Measure matching throughput in GB/s\n";
     std::cout << "  'exit' - Quit the application\n\n";
 }
 
@@ -268,12 +578,13 @@ void run_universal_search_session() {
     std::string search_term;
     std::string context_option;
     int search_session_counter = 0;
+    search_result_cache result_cache; // You remember results so repeated searches of unchanged files are instant
     
     display_usage_instructions();
     
     // You continue the search loop until user chooses to exit
     while (true) {
-        std::cout << "Enter file path (or 'help'/'exit'): ";
+        std::cout << "Enter file or directory path (or 'help'/'exit'): ";
         std::getline(std::cin, target_file_path);
         
         // You check for exit command
@@ -289,6 +600,12 @@ void run_universal_search_session() {
             continue;
         }
         
+        // You check for benchmark command
+        if (target_file_path == "benchmark" || target_file_path == "BENCHMARK") {
+            run_matcher_benchmark();
+            continue;
+        }
+        
         // You validate the file path input
         if (target_file_path.empty()) {
             std::cout << "Error: File path cannot be empty.\n\n";
@@ -305,22 +622,1205 @@ void run_universal_search_session() {
         }
         
         // You prompt for context display option
-        std::cout << "Include context lines? (y/n): ";
+        std::cout << "Include context lines? (y/n or before/after counts): ";
         std::getline(std::cin, context_option);
         
-        bool show_context = (context_option == "y" || context_option == "Y" || 
-                           context_option == "yes" || context_option == "YES");
+        context_window_options context_window = parse_context_option(context_option);
         
-        // You execute the universal file search
-        execute_file_search(target_file_path, search_term, show_context);
-        search_session_counter++;
+        // You search a whole directory tree or a single file
+        std::error_code status_error;
+        if (std::filesystem::is_directory(target_file_path, status_error)) {
+            search_session_counter += execute_directory_search(target_file_path, search_term, context_window);
+        } else {
+            execute_file_search(target_file_path, search_term, context_window, &result_cache);
+            search_session_counter++;
+        }
         
         std::cout << "Search another file or type 'exit' to quit.\n\n";
     }
 }
 
+// Options gathered from the command line for a non-interactive search
+struct batch_search_options {
+    enum output_format { grep_lines, json_lines, match_report };
+
+    std::string search_query;
+    std::vector<std::string> search_paths;
+    context_window_options context_window;
+    bool count_only = false;
+    output_format result_format = grep_lines;
+    std::string daemon_socket_path; // You send the search to a running daemon when this is set
+    std::string build_index_path;   // You write a trigram index of the one given directory when this is set
+    std::string index_path;         // You search the files of this trigram index instead of given paths
+    size_t rank_limit = 0;          // You list only this many of the most relevant files when it is set
+    size_t ranked_lines = 0;        // Best matching lines shown under each ranked file
+    bool build_filters = false;     // You write a block filter sidecar beside each given file when this is set
+    bool build_line_tables = false; // You write a line table sidecar beside each given file when this is set
+    size_t line_number = 0;         // You print this line of each given file instead of searching when it is set
+};
+
+// Function to display the command-line synopsis used by batch mode
+void display_batch_usage(std::ostream& usage_stream) {
+    usage_stream << "Usage: text_search [options] PATTERN PATH...\n";
+    usage_stream << "PATTERN uses the interactive syntax: term, several words (all must appear), \"exact phrase\",\n";
+    usage_stream << "@terms.txt, re:regex or ~k:term\n";
+    usage_stream << "Unquoted words no longer form a phrase: 'hello world' also matches \"world hello\" and\n";
+    usage_stream << "\"helloworld\"; pass '\"hello world\"' (quotes included) to search the phrase\n";
+    usage_stream << "Options:\n";
+    usage_stream << "  -C N, --context=N   Show N lines of context around each match\n";
+    usage_stream << "  -B N, -A N          Show N lines before or after each match\n";
+    usage_stream << "  -c, --count         Print only the number of matching lines per file\n";
+    usage_stream << "  --format=FORMAT     grep (path:line:text), json (one object per line) or report\n";
+    usage_stream << "  --threads=N         Search with N threads\n";
+    usage_stream << "  --kernel=NAME       Force a matching kernel (scalar|sse2|avx2|avx512|auto)\n";
+    usage_stream << "  --rank=K            List the K most relevant files by BM25 score instead of every match\n";
+    usage_stream << "  --rank-lines=M      With --rank, show the M most relevant matching lines of each file\n";
+    usage_stream << "  --server=SOCKET     Send the search to a daemon started with --daemon=SOCKET\n";
+    usage_stream << "  --build-index=FILE  Index the text files below one directory: text_search --build-index=FILE DIR\n";
+    usage_stream << "  --index=FILE        Search the files of an index built earlier: text_search --index=FILE PATTERN\n";
+    usage_stream << "  --line=N            Print line N of each file, with -C context: text_search --line=N FILE...\n";
+    usage_stream << "                      A line table saved with --build-lines makes later lookups instant\n";
+    usage_stream << "  --build-filter      Write block filters beside large files: text_search --build-filter FILE...\n";
+    usage_stream << "                      Later searches of those files read only the blocks that may match\n";
+    usage_stream << "  --build-lines       Write line tables beside files: text_search --build-lines FILE...\n";
+    usage_stream << "                      Later searches and --line lookups number lines without splitting them\n";
+    usage_stream << "  --                  End the options, so the pattern may start with '-'\n";
+    usage_stream << "Daemon: text_search --daemon=SOCKET keeps queries and file mappings warm between searches\n";
+    usage_stream << "Exit status: 0 if a line matched, 1 if none did, 2 on error\n";
+}
+
+// Function to read a context line count from a command-line value
+bool parse_context_count(const std::string& count_text, size_t& line_count) {
+    char* count_end = nullptr;
+    unsigned long long parsed_count = std::strtoull(count_text.c_str(), &count_end, 10);
+    if (count_text.empty() || count_text[0] == '-' || *count_end != '\0') {
+        return false;
+    }
+    line_count = std::min(static_cast<size_t>(parsed_count), MAX_CONTEXT_LINES);
+    return true;
+}
+
+// Function to collect the pattern, paths and flags of a batch search
+// Returns false with a description in error_message when the command line is unusable
+bool parse_batch_arguments(const std::vector<std::string>& arguments, batch_search_options& batch_options,
+                           std::string& error_message) {
+    std::vector<std::string> positional_arguments;
+    bool options_ended = false;
+
+    for (size_t argument_index = 0; argument_index < arguments.size(); argument_index++) {
+        const std::string& argument = arguments[argument_index];
+        if (options_ended || argument.empty() || argument[0] != '-' || argument == "-") {
+            positional_arguments.push_back(argument);
+            continue;
+        }
+
+        // You accept the short context flags with their count as the next argument
+        if (argument == "-C" || argument == "-B" || argument == "-A") {
+            size_t line_count = 0;
+            if (argument_index + 1 >= arguments.size() || !parse_context_count(arguments[++argument_index], line_count)) {
+                error_message = "Option " + argument + " needs a line count";
+                return false;
+            }
+            if (argument != "-A") {
+                batch_options.context_window.lines_before = line_count;
+            }
+            if (argument != "-B") {
+                batch_options.context_window.lines_after = line_count;
+            }
+        } else if (argument.compare(0, 10, "--context=") == 0) {
+            size_t line_count = 0;
+            if (!parse_context_count(argument.substr(10), line_count)) {
+                error_message = "Option --context needs a line count";
+                return false;
+            }
+            batch_options.context_window.lines_before = line_count;
+            batch_options.context_window.lines_after = line_count;
+        } else if (argument == "-c" || argument == "--count") {
+            batch_options.count_only = true;
+        } else if (argument == "--format=grep") {
+            batch_options.result_format = batch_search_options::grep_lines;
+        } else if (argument == "--format=json") {
+            batch_options.result_format = batch_search_options::json_lines;
+        } else if (argument == "--format=report") {
+            batch_options.result_format = batch_search_options::match_report;
+        } else if (argument.compare(0, 9, "--server=") == 0 && argument.size() > 9) {
+            batch_options.daemon_socket_path = argument.substr(9);
+        } else if (argument.compare(0, 7, "--rank=") == 0 || argument.compare(0, 13, "--rank-lines=") == 0) {
+            bool line_option = argument.compare(0, 13, "--rank-lines=") == 0;
+            size_t& ranked_count = line_option ? batch_options.ranked_lines : batch_options.rank_limit;
+            char* count_end = nullptr;
+            std::string count_text = argument.substr(line_option ? 13 : 7);
+            ranked_count = std::strtoul(count_text.c_str(), &count_end, 10);
+            if (count_text.empty() || count_text[0] == '-' || *count_end != '\0' || ranked_count == 0) {
+                error_message = std::string("Option ") + (line_option ? "--rank-lines" : "--rank") +
+                                " needs a positive count";
+                return false;
+            }
+        } else if (argument.compare(0, 14, "--build-index=") == 0 && argument.size() > 14) {
+            batch_options.build_index_path = argument.substr(14);
+        } else if (argument.compare(0, 8, "--index=") == 0 && argument.size() > 8) {
+            batch_options.index_path = argument.substr(8);
+        } else if (argument == "--build-filter") {
+            batch_options.build_filters = true;
+        } else if (argument == "--build-lines") {
+            batch_options.build_line_tables = true;
+        } else if (argument.compare(0, 7, "--line=") == 0) {
+            char* number_end = nullptr;
+            std::string number_text = argument.substr(7);
+            batch_options.line_number = std::strtoul(number_text.c_str(), &number_end, 10);
+            if (number_text.empty() || number_text[0] == '-' || *number_end != '\0' ||
+                batch_options.line_number == 0) {
+                error_message = "Option --line needs a positive line number";
+                return false;
+            }
+        } else if (argument == "--") {
+            options_ended = true;
+        } else {
+            error_message = "Unknown option '" + argument + "'";
+            return false;
+        }
+    }
+
+    // You rank from a local scan, which needs every file's match lines and word counts
+    if (batch_options.ranked_lines > 0 && batch_options.rank_limit == 0) {
+        error_message = "Option --rank-lines needs --rank";
+        return false;
+    }
+    if (batch_options.rank_limit > 0 && (batch_options.count_only || !batch_options.index_path.empty() ||
+                                         !batch_options.build_index_path.empty() ||
+                                         !batch_options.daemon_socket_path.empty())) {
+        error_message = "Option --rank cannot be combined with --count, index options or --server";
+        return false;
+    }
+
+    // You take only the files to filter, to number or to read a line from, all of which happen locally
+    if (batch_options.build_filters || batch_options.build_line_tables || batch_options.line_number > 0) {
+        std::string option_name = batch_options.build_filters       ? "--build-filter"
+                                  : batch_options.build_line_tables ? "--build-lines"
+                                                                    : "--line";
+        int local_actions = (batch_options.build_filters ? 1 : 0) + (batch_options.build_line_tables ? 1 : 0) +
+                            (batch_options.line_number > 0 ? 1 : 0);
+        if (batch_options.count_only || batch_options.rank_limit > 0 || !batch_options.build_index_path.empty() ||
+            !batch_options.index_path.empty() || !batch_options.daemon_socket_path.empty() || local_actions > 1) {
+            error_message = "Option " + option_name + " cannot be combined with other search options";
+            return false;
+        }
+        if (positional_arguments.empty()) {
+            error_message = "Option " + option_name + " needs at least one file";
+            return false;
+        }
+        batch_options.search_paths = positional_arguments;
+        return true;
+    }
+
+    // You take a single directory to index, or a single pattern to look up in an index
+    if (!batch_options.build_index_path.empty() || !batch_options.index_path.empty()) {
+        if (!batch_options.build_index_path.empty() && !batch_options.index_path.empty()) {
+            error_message = "Options --build-index and --index cannot be combined";
+            return false;
+        }
+        if (!batch_options.build_index_path.empty() && !batch_options.daemon_socket_path.empty()) {
+            error_message = "Option --build-index cannot be sent to a daemon";
+            return false;
+        }
+        if (positional_arguments.size() != 1) {
+            error_message = batch_options.index_path.empty() ? "Option --build-index needs exactly one directory"
+                                                             : "Option --index needs exactly one pattern";
+            return false;
+        }
+        if (batch_options.index_path.empty()) {
+            batch_options.search_paths = positional_arguments;
+        } else {
+            batch_options.search_query = positional_arguments[0];
+        }
+        return true;
+    }
+
+    if (positional_arguments.size() < 2) {
+        error_message = "A pattern and at least one path are required";
+        return false;
+    }
+    batch_options.search_query = positional_arguments[0];
+    batch_options.search_paths.assign(positional_arguments.begin() + 1, positional_arguments.end());
+    return true;
+}
+
+// Function to write one grep-style line: "path:line:text" for matches and "path-line-text" for context
+void write_grep_line(result_output_sink& output_sink, std::string_view path_prefix, size_t line_number,
+                     std::string_view separator, std::string_view line_text) {
+    if (!path_prefix.empty()) {
+        output_sink.write(path_prefix);
+        output_sink.write(separator);
+    }
+    output_sink.write_decimal(line_number);
+    output_sink.write(separator);
+    output_sink.write(line_text);
+    output_sink.write("\n");
+}
+
+// Function to write one file's matches as grep-style lines
+// Context shared by neighbouring matches is written once, and separate groups are divided by "--"
+void write_grep_match_set(result_output_sink& output_sink, std::string_view path_prefix,
+                          const search_match_set& match_set, const context_window_options& context_window,
+                          bool& groups_written) {
+    std::vector<std::string_view> lines_before;
+    std::vector<std::string_view> lines_after;
+    const std::vector<match_record>& match_records = match_set.match_records;
+    size_t next_unwritten_line = 0; // You use zero to mark that nothing of this file was written yet
+
+    for (size_t record_index = 0; record_index < match_records.size(); record_index++) {
+        const match_record& record = match_records[record_index];
+        if (!context_window.enabled()) {
+            write_grep_line(output_sink, path_prefix, record.line_number, ":", match_set.line_text(record));
+            continue;
+        }
+
+        match_set.context_lines(record, context_window, lines_before, lines_after);
+        size_t first_group_line = record.line_number - lines_before.size();
+        if (groups_written && (next_unwritten_line == 0 || first_group_line > next_unwritten_line)) {
+            output_sink.write("--\n");
+        }
+        groups_written = true;
+
+        for (size_t before_index = 0; before_index < lines_before.size(); before_index++) {
+            size_t line_number = first_group_line + before_index;
+            if (line_number >= next_unwritten_line) {
+                write_grep_line(output_sink, path_prefix, line_number, "-", lines_before[before_index]);
+            }
+        }
+        write_grep_line(output_sink, path_prefix, record.line_number, ":", match_set.line_text(record));
+
+        // You stop the trailing context before the next match so that line is written as a match
+        size_t next_match_line = record_index + 1 < match_records.size() ? match_records[record_index + 1].line_number
+                                                                         : static_cast<size_t>(-1);
+        next_unwritten_line = record.line_number + 1;
+        for (std::string_view following_line : lines_after) {
+            if (next_unwritten_line >= next_match_line) {
+                break;
+            }
+            write_grep_line(output_sink, path_prefix, next_unwritten_line++, "-", following_line);
+        }
+    }
+}
+
+// Function to write a string as a quoted JSON value, escaping quotes, backslashes and control bytes
+void write_json_string(result_output_sink& output_sink, std::string_view text) {
+    static const char hex_digits[] = "0123456789abcdef";
+    output_sink.write("\"");
+    size_t plain_begin = 0;
+    for (size_t byte_index = 0; byte_index < text.size(); byte_index++) {
+        unsigned char byte_value = static_cast<unsigned char>(text[byte_index]);
+        if (byte_value >= 0x20 && byte_value != '"' && byte_value != '\\') {
+            continue;
+        }
+        output_sink.write(text.substr(plain_begin, byte_index - plain_begin));
+        if (byte_value == '"' || byte_value == '\\') {
+            char escaped_byte[2] = {'\\', static_cast<char>(byte_value)};
+            output_sink.write(std::string_view(escaped_byte, 2));
+        } else {
+            char escaped_byte[6] = {'\\', 'u', '0', '0', hex_digits[byte_value >> 4], hex_digits[byte_value & 0x0F]};
+            output_sink.write(std::string_view(escaped_byte, 6));
+        }
+        plain_begin = byte_index + 1;
+    }
+    output_sink.write(text.substr(plain_begin));
+    output_sink.write("\"");
+}
+
+// Function to write an array of context lines as a JSON value
+void write_json_line_array(result_output_sink& output_sink, const std::vector<std::string_view>& context_lines) {
+    output_sink.write("[");
+    for (size_t line_index = 0; line_index < context_lines.size(); line_index++) {
+        if (line_index > 0) {
+            output_sink.write(",");
+        }
+        write_json_string(output_sink, context_lines[line_index]);
+    }
+    output_sink.write("]");
+}
+
+// Function to write one file's matches as JSON lines, one object per matching line
+// Each object holds path, line, column (1-based byte), length, labels, text and any context arrays
+void write_json_match_set(result_output_sink& output_sink, std::string_view file_path,
+                          const search_match_set& match_set, const search_engine& engine) {
+    const context_window_options& context_window = engine.context_window();
+    std::vector<std::string_view> lines_before;
+    std::vector<std::string_view> lines_after;
+
+    for (const match_record& record : match_set.match_records) {
+        std::string_view line_text = match_set.line_text(record);
+        output_sink.write("{\"path\":");
+        write_json_string(output_sink, file_path);
+        output_sink.write(",\"line\":");
+        output_sink.write_decimal(record.line_number);
+        output_sink.write(",\"column\":");
+        output_sink.write_decimal(record.match_column + 1);
+        output_sink.write(",\"length\":");
+        output_sink.write_decimal(record.match_length);
+        output_sink.write(",\"labels\":");
+        write_json_string(output_sink, engine.match_labels(line_text));
+        output_sink.write(",\"text\":");
+        write_json_string(output_sink, line_text);
+        if (context_window.enabled()) {
+            match_set.context_lines(record, context_window, lines_before, lines_after);
+            output_sink.write(",\"before\":");
+            write_json_line_array(output_sink, lines_before);
+            output_sink.write(",\"after\":");
+            write_json_line_array(output_sink, lines_after);
+        }
+        output_sink.write("}\n");
+    }
+}
+
+// Function to write the results of one searched file in the requested batch format
+// Returns whether the file had any matching line
+bool write_batch_file_result(result_output_sink& output_sink, const batch_search_options& batch_options,
+                             bool show_file_names, const std::string& file_path,
+                             const search_match_set& match_set, const search_engine& engine, bool& groups_written) {
+    const std::vector<match_record>& match_records = match_set.match_records;
+    if (batch_options.count_only) {
+        if (show_file_names) {
+            output_sink.write(file_path);
+            output_sink.write(":");
+        }
+        output_sink.write_decimal(match_records.size());
+        output_sink.write("\n");
+        return !match_records.empty();
+    }
+    if (match_records.empty()) {
+        return false;
+    }
+
+    switch (batch_options.result_format) {
+    case batch_search_options::grep_lines:
+        write_grep_match_set(output_sink, show_file_names ? std::string_view(file_path) : std::string_view(),
+                             match_set, engine.context_window(), groups_written);
+        break;
+    case batch_search_options::json_lines:
+        write_json_match_set(output_sink, file_path, match_set, engine);
+        break;
+    case batch_search_options::match_report:
+        output_sink.write("File: ");
+        output_sink.write(file_path);
+        output_sink.write(" - ");
+        output_sink.write_decimal(match_records.size());
+        output_sink.write(" match(es)\n");
+        write_match_set(output_sink, match_set, engine);
+        break;
+    }
+    return true;
+}
+
+// Function to search every path of a batch request with an engine that already holds its query
+// Results go to the sink and errors to the error stream; warm mappings are used when a cache is given
+// Returns a grep-style exit status: 0 if a line matched, 1 if none did, 2 on any error
+int execute_batch_search(const batch_search_options& batch_options, const search_engine& engine,
+                         result_output_sink& output_sink, std::ostream& error_stream,
+                         mapped_file_cache* warm_mappings = nullptr) {
+    std::string error_message;
+    bool show_file_names = batch_options.search_paths.size() > 1;
+    bool any_match = false;
+    bool any_error = false;
+    bool groups_written = false;
+
+    for (const std::string& search_path : batch_options.search_paths) {
+        std::error_code status_error;
+        if (std::filesystem::is_directory(search_path, status_error)) {
+            // You name every file found below a directory, as grep -r does
+            directory_search_summary search_summary = engine.search_directory(
+                search_path, [&](directory_file_result& file_result) {
+                    any_match |= write_batch_file_result(output_sink, batch_options, true, file_result.file_path,
+                                                         file_result.file_matches, engine, groups_written);
+                });
+            if (search_summary.unreadable_entries > 0) {
+                output_sink.flush();
+                error_stream << "text_search: " << search_path << ": " << search_summary.unreadable_entries
+                          << " unreadable entries\n";
+                any_error = true;
+            }
+            continue;
+        }
+
+        // You search a warm mapping when one is available and open the file otherwise
+        std::shared_ptr<const mapped_file_region> warm_mapping;
+        if (warm_mappings != nullptr) {
+            warm_mapping = warm_mappings->acquire(search_path);
+        }
+        search_match_set match_set;
+        if (warm_mapping) {
+            match_set = engine.search_mapped_file(warm_mapping);
+        } else if (!engine.search_file(search_path, match_set, error_message)) {
+            output_sink.flush();
+            error_stream << "text_search: " << error_message << "\n";
+            any_error = true;
+            continue;
+        }
+        any_match |= write_batch_file_result(output_sink, batch_options, show_file_names, search_path,
+                                             match_set, engine, groups_written);
+    }
+    output_sink.flush();
+
+    if (any_error) {
+        return 2;
+    }
+    return any_match ? 0 : 1;
+}
+
+// Function to build a trigram index of one directory and save it, reporting its size
+// Returns 0 when the index was written and 2 otherwise
+int build_search_index(const batch_search_options& batch_options) {
+    std::string error_message;
+    trigram_index index;
+    auto build_start = std::chrono::steady_clock::now();
+    if (!index.build(batch_options.search_paths[0], error_message) ||
+        !index.save(batch_options.build_index_path, error_message)) {
+        std::cerr << "text_search: " << error_message << "\n";
+        return 2;
+    }
+    double build_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - build_start).count();
+
+    // You map the saved file back and check its checksum, so a bad write is caught now rather than at search time
+    trigram_index saved_index;
+    if (!saved_index.load(batch_options.build_index_path, error_message) ||
+        !saved_index.verify_checksum(error_message)) {
+        std::cerr << "text_search: " << error_message << "\n";
+        return 2;
+    }
+    std::cout << "Indexed " << saved_index.file_count() << " file(s) in " << saved_index.block_count() << " block(s): "
+              << saved_index.trigram_count() << " trigrams, " << saved_index.posting_count() << " postings packed in "
+              << saved_index.packed_posting_bytes() << " bytes, " << saved_index.image_bytes() << " bytes in all, " << std::fixed << std::setprecision(2) << build_seconds
+              << " s\n";
+    return 0;
+}
+
+// Function to write a block filter sidecar beside each given file, reporting its size
+// Returns 0 when every sidecar was written and 2 otherwise
+int build_block_filters(const batch_search_options& batch_options) {
+    int exit_status = 0;
+    for (const std::string& file_path : batch_options.search_paths) {
+        std::string error_message;
+        std::string sidecar_path = file_path + BLOCK_FILTER_SUFFIX;
+        block_filter_sidecar block_filters;
+        block_filter_sidecar saved_filters;
+        if (!block_filters.build(file_path, error_message) || !block_filters.save(sidecar_path, error_message) ||
+            !saved_filters.load(sidecar_path, error_message) || !saved_filters.verify_checksum(error_message)) {
+            std::cerr << "text_search: " << error_message << "\n";
+            exit_status = 2;
+            continue;
+        }
+        std::cout << "Filtered " << file_path << ": " << saved_filters.covered_bytes() << " byte(s) in "
+                  << saved_filters.block_count() << " block(s), " << saved_filters.filter_bytes()
+                  << " bytes of filters in " << sidecar_path << "\n";
+    }
+    return exit_status;
+}
+
+// Function to write a line table sidecar beside each given file, reporting how many lines it covers
+// Returns 0 when every sidecar was written and 2 otherwise
+int build_line_tables(const batch_search_options& batch_options) {
+    int exit_status = 0;
+    for (const std::string& file_path : batch_options.search_paths) {
+        std::string error_message;
+        std::string sidecar_path = file_path + LINE_TABLE_SUFFIX;
+        line_offset_table line_table;
+        line_offset_table saved_table;
+        if (!line_table.build(file_path, error_message) || !line_table.save(sidecar_path, error_message) ||
+            !saved_table.load(sidecar_path, error_message)) {
+            std::cerr << "text_search: " << error_message << "\n";
+            exit_status = 2;
+            continue;
+        }
+        std::cout << "Numbered " << file_path << ": " << saved_table.covered_lines() << " line(s) in "
+                  << saved_table.covered_bytes() << " byte(s), " << saved_table.image_bytes() << " bytes of line starts in "
+                  << sidecar_path << "\n";
+    }
+    return exit_status;
+}
+
+// Function to print one line of each given file by number, with the requested context around it
+// Lines are reached through the line table saved beside each file by --build-lines, or one built in memory
+// Returns 0 if every file has the line, 1 if any file is shorter, 2 on any error
+int execute_line_lookup(const batch_search_options& batch_options, result_output_sink& output_sink,
+                        std::ostream& error_stream) {
+    // You format lines through an engine without a query, which adds no match labels
+    search_engine engine;
+    engine.set_context_window(batch_options.context_window);
+    bool show_file_names = batch_options.search_paths.size() > 1;
+    bool every_line_found = true;
+    bool any_error = false;
+    bool groups_written = false;
+
+    for (const std::string& file_path : batch_options.search_paths) {
+        std::string error_message;
+        search_match_set match_set;
+        if (!lookup_numbered_line(file_path, batch_options.line_number, match_set, error_message)) {
+            output_sink.flush();
+            error_stream << "text_search: " << error_message << "\n";
+            any_error = true;
+            continue;
+        }
+        every_line_found &= write_batch_file_result(output_sink, batch_options, show_file_names, file_path,
+                                                    match_set, engine, groups_written);
+    }
+    output_sink.flush();
+
+    if (any_error) {
+        return 2;
+    }
+    return every_line_found ? 0 : 1;
+}
+
+// Function to search the files of a saved trigram index, scanning only the blocks that can match
+// The index is mapped and used in place, so opening it costs the same at any size
+// Returns a grep-style exit status: 0 if a line matched, 1 if none did, 2 on any error
+int execute_index_search(const batch_search_options& batch_options, const search_engine& engine,
+                         result_output_sink& output_sink, std::ostream& error_stream) {
+    std::string error_message;
+    trigram_index index;
+    if (!index.load(batch_options.index_path, error_message)) {
+        error_stream << "text_search: " << error_message << "\n";
+        return 2;
+    }
+
+    bool any_match = false;
+    bool groups_written = false;
+    index_search_summary search_summary = engine.search_index(index, [&](directory_file_result& file_result) {
+        any_match |= write_batch_file_result(output_sink, batch_options, true, file_result.file_path,
+                                             file_result.file_matches, engine, groups_written);
+    });
+    output_sink.flush();
+
+    // You mention files that changed since the build, since new files below the directory are not seen
+    if (search_summary.changed_files > 0 || search_summary.missing_files > 0) {
+        error_stream << "text_search: " << batch_options.index_path << ": " << search_summary.changed_files
+                     << " changed and " << search_summary.missing_files << " missing file(s) since the index was built\n";
+    }
+    if (search_summary.damaged_entries > 0) {
+        error_stream << "text_search: " << batch_options.index_path << ": " << search_summary.damaged_entries
+                     << " damaged entries; rebuild it with --build-index\n";
+        return 2;
+    }
+    return any_match ? 0 : 1;
+}
+
+#if TEXT_SEARCH_HAS_UNIX_SOCKETS
+// Tag at the start of every daemon request; the trailing digit versions the protocol
+const uint32_t DAEMON_PROTOCOL_MAGIC = 0x31445354; // "TSD1" in little-endian byte order
+
+// Request flag asking for match counts instead of matching lines
+const uint32_t DAEMON_REQUEST_COUNT_ONLY = 1;
+
+// Request flag marking the single path as a trigram index to search instead of a file or directory
+const uint32_t DAEMON_REQUEST_INDEX_SEARCH = 2;
+
+// Largest query or path the daemon accepts, so a malformed request cannot allocate without bound
+const uint32_t DAEMON_MAX_TEXT_LENGTH = 1 << 20;
+
+// Largest number of paths in one request
+const uint32_t DAEMON_MAX_PATH_COUNT = 1 << 16;
+
+// Compiled queries the daemon keeps warm between requests
+const size_t DAEMON_QUERY_CACHE_LIMIT = 64;
+
+// Seconds a client may stall while sending its request or reading results before it is dropped
+const int DAEMON_CLIENT_TIMEOUT_SECONDS = 30;
+
+// Fixed-size request header; the query bytes and the client's working directory follow it,
+// then each path as a 32-bit length and its bytes
+// Fields use native byte order because both ends of a Unix domain socket run on the same machine
+struct daemon_request_header {
+    uint32_t protocol_magic;
+    uint32_t request_flags;
+    uint32_t output_format;
+    uint32_t lines_before;
+    uint32_t lines_after;
+    uint32_t query_length;
+    uint32_t directory_length;
+    uint32_t path_count;
+};
+
+// Header of each reply frame: result bytes and error text may repeat, and one status frame ends the reply
+struct daemon_frame_header {
+    enum frame_kind : uint32_t { output_frame = 1, error_frame = 2, status_frame = 3 };
+
+    uint32_t frame_type;
+    uint32_t payload_length;
+};
+
+// Function to read exactly the requested number of bytes, retrying after interrupts
+// Returns false if the peer closes the connection or the read fails first
+bool read_all_bytes(int input_descriptor, char* destination, size_t requested_bytes) {
+    while (requested_bytes > 0) {
+        ssize_t bytes_read = ::read(input_descriptor, destination, requested_bytes);
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0) {
+            return false;
+        }
+        destination += bytes_read;
+        requested_bytes -= static_cast<size_t>(bytes_read);
+    }
+    return true;
+}
+
+// Function to send one reply frame, splitting payloads too large for a 32-bit length
+bool send_daemon_frame(int socket_descriptor, uint32_t frame_type, const char* payload, size_t payload_size) {
+    do {
+        size_t frame_size = std::min(payload_size, static_cast<size_t>(DAEMON_MAX_TEXT_LENGTH) << 10);
+        daemon_frame_header frame_header{frame_type, static_cast<uint32_t>(frame_size)};
+        if (!write_all_bytes(socket_descriptor, reinterpret_cast<const char*>(&frame_header), sizeof(frame_header)) ||
+            !write_all_bytes(socket_descriptor, payload, frame_size)) {
+            return false;
+        }
+        payload += frame_size;
+        payload_size -= frame_size;
+    } while (payload_size > 0);
+    return true;
+}
+
+// Function to fill a Unix domain socket address, rejecting paths longer than the address can hold
+bool make_daemon_address(const std::string& socket_path, sockaddr_un& socket_address, std::string& error_message) {
+    std::memset(&socket_address, 0, sizeof(socket_address));
+    socket_address.sun_family = AF_UNIX;
+    if (socket_path.empty() || socket_path.size() >= sizeof(socket_address.sun_path)) {
+        error_message = "Socket path '" + socket_path + "' is empty or too long";
+        return false;
+    }
+    std::memcpy(socket_address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+    return true;
+}
+
+// Function to connect to a daemon socket; returns the descriptor, or -1 if nothing is listening
+int connect_daemon_socket(const std::string& socket_path, std::string& error_message) {
+    sockaddr_un socket_address;
+    if (!make_daemon_address(socket_path, socket_address, error_message)) {
+        return -1;
+    }
+    int socket_descriptor = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socket_descriptor < 0) {
+        error_message = std::string("Cannot create a socket: ") + std::strerror(errno);
+        return -1;
+    }
+    if (::connect(socket_descriptor, reinterpret_cast<const sockaddr*>(&socket_address), sizeof(socket_address)) != 0) {
+        error_message = "Cannot connect to search daemon at '" + socket_path + "': " + std::strerror(errno);
+        ::close(socket_descriptor);
+        return -1;
+    }
+    return socket_descriptor;
+}
+
+// Compiled queries kept warm between daemon requests, with the least recently used one evicted first
+// Engines stay in place between requests, so regex state caches keep what earlier searches built
+class daemon_query_cache {
+public:
+    // You return the cached engine for a query, compiling it on first use
+    // Returns nullptr with a description in error_message when the query does not compile
+    // An "@file" list is read again on every request, from the client's directory, and the engine is cached by the
+    // terms it holds; keyed by its text, another client's list of the same name or an edited list would be missed
+    search_engine* acquire(const std::string& query_text, std::string& error_message) {
+        search_engine compiled_engine;
+        std::string cache_key = query_text;
+        bool pattern_list = query_text.size() > 1 && query_text[0] == '@';
+        if (pattern_list) {
+            if (!compiled_engine.compile(query_text, error_message)) {
+                return nullptr;
+            }
+            cache_key = compiled_engine.query().normalized_text;
+        }
+
+        auto cached_entry = cached_engines.find(cache_key);
+        if (cached_entry == cached_engines.end()) {
+            if (!pattern_list && !compiled_engine.compile(query_text, error_message)) {
+                return nullptr;
+            }
+            if (cached_engines.size() >= DAEMON_QUERY_CACHE_LIMIT) {
+                forget_least_recent_engine();
+            }
+            cached_entry = cached_engines.emplace(cache_key, cached_engine{std::move(compiled_engine), 0}).first;
+        }
+        cached_entry->second.last_use = ++use_clock;
+        return &cached_entry->second.engine;
+    }
+
+private:
+    struct cached_engine {
+        search_engine engine;
+        unsigned long long last_use;
+    };
+
+    void forget_least_recent_engine() {
+        auto oldest_entry = cached_engines.begin();
+        for (auto cached_entry = cached_engines.begin(); cached_entry != cached_engines.end(); ++cached_entry) {
+            if (cached_entry->second.last_use < oldest_entry->second.last_use) {
+                oldest_entry = cached_entry;
+            }
+        }
+        cached_engines.erase(oldest_entry);
+    }
+
+    std::map<std::string, cached_engine> cached_engines;
+    unsigned long long use_clock = 0;
+};
+
+// Function to read one length-prefixed or fixed-length text field of a daemon request
+bool read_daemon_text(int socket_descriptor, uint32_t text_length, std::string& text) {
+    if (text_length > DAEMON_MAX_TEXT_LENGTH) {
+        return false;
+    }
+    text.resize(text_length);
+    return read_all_bytes(socket_descriptor, &text[0], text_length);
+}
+
+// Function to decode a daemon request into the same options a batch command line produces
+bool read_daemon_request(int socket_descriptor, batch_search_options& batch_options, std::string& working_directory) {
+    daemon_request_header request_header;
+    if (!read_all_bytes(socket_descriptor, reinterpret_cast<char*>(&request_header), sizeof(request_header)) ||
+        request_header.protocol_magic != DAEMON_PROTOCOL_MAGIC ||
+        request_header.output_format > batch_search_options::match_report ||
+        request_header.path_count > DAEMON_MAX_PATH_COUNT ||
+        !read_daemon_text(socket_descriptor, request_header.query_length, batch_options.search_query) ||
+        !read_daemon_text(socket_descriptor, request_header.directory_length, working_directory)) {
+        return false;
+    }
+
+    batch_options.count_only = (request_header.request_flags & DAEMON_REQUEST_COUNT_ONLY) != 0;
+    bool index_search = (request_header.request_flags & DAEMON_REQUEST_INDEX_SEARCH) != 0;
+    if (index_search && request_header.path_count != 1) {
+        return false;
+    }
+    batch_options.result_format = static_cast<batch_search_options::output_format>(request_header.output_format);
+    batch_options.context_window.lines_before = std::min(static_cast<size_t>(request_header.lines_before),
+                                                         MAX_CONTEXT_LINES);
+    batch_options.context_window.lines_after = std::min(static_cast<size_t>(request_header.lines_after),
+                                                        MAX_CONTEXT_LINES);
+
+    batch_options.search_paths.resize(request_header.path_count);
+    for (std::string& search_path : batch_options.search_paths) {
+        uint32_t path_length = 0;
+        if (!read_all_bytes(socket_descriptor, reinterpret_cast<char*>(&path_length), sizeof(path_length)) ||
+            !read_daemon_text(socket_descriptor, path_length, search_path)) {
+            return false;
+        }
+    }
+    if (index_search) {
+        batch_options.index_path = batch_options.search_paths[0];
+        batch_options.search_paths.clear();
+    }
+    return true;
+}
+
+// Function to answer one daemon request with result frames, error text and a final exit status
+void serve_daemon_request(int socket_descriptor, daemon_query_cache& warm_queries, mapped_file_cache& warm_mappings) {
+    batch_search_options batch_options;
+    std::string working_directory;
+    std::ostringstream error_stream;
+    int exit_status = 2;
+
+    // You resolve relative paths from the client's directory, so results name files exactly as it did
+    if (!read_daemon_request(socket_descriptor, batch_options, working_directory)) {
+        error_stream << "text_search: Malformed request sent to the search daemon\n";
+    } else if (::chdir(working_directory.c_str()) != 0) {
+        error_stream << "text_search: Cannot enter directory '" << working_directory << "'\n";
+    } else {
+        std::string error_message;
+        search_engine* engine = warm_queries.acquire(batch_options.search_query, error_message);
+        if (engine == nullptr) {
+            error_stream << "text_search: " << error_message << "\n";
+        } else {
+            // You stream results back as the sink fills, so large replies never sit in memory whole
+            engine->set_context_window(batch_options.context_window);
+            result_output_sink socket_sink([socket_descriptor](const char* output_data, size_t output_size) {
+                send_daemon_frame(socket_descriptor, daemon_frame_header::output_frame, output_data, output_size);
+            });
+            if (!batch_options.index_path.empty()) {
+                exit_status = execute_index_search(batch_options, *engine, socket_sink, error_stream);
+            } else {
+                exit_status = execute_batch_search(batch_options, *engine, socket_sink, error_stream, &warm_mappings);
+            }
+        }
+    }
+
+    std::string error_text = error_stream.str();
+    if (!error_text.empty()) {
+        send_daemon_frame(socket_descriptor, daemon_frame_header::error_frame, error_text.data(), error_text.size());
+    }
+    int32_t status_payload = exit_status;
+    send_daemon_frame(socket_descriptor, daemon_frame_header::status_frame,
+                      reinterpret_cast<const char*>(&status_payload), sizeof(status_payload));
+}
+
+// Set by SIGINT or SIGTERM to stop the daemon's accept loop
+volatile std::sig_atomic_t daemon_stop_requested = 0;
+
+// Function to record a stop request; the interrupted accept call then returns to the loop
+extern "C" void request_daemon_stop(int) {
+    daemon_stop_requested = 1;
+}
+
+// Function to serve searches over a Unix domain socket until interrupted
+// Requests are answered one at a time, each using every search thread, so warm state needs no locking
+// and each request can run in its client's working directory
+int run_search_daemon(const std::string& socket_path) {
+    std::string error_message;
+    sockaddr_un socket_address;
+    if (!make_daemon_address(socket_path, socket_address, error_message)) {
+        std::cerr << "text_search: " << error_message << "\n";
+        return 2;
+    }
+
+    // You refuse to take over a socket another daemon still answers, and clear one left by a daemon that died
+    int existing_daemon = connect_daemon_socket(socket_path, error_message);
+    if (existing_daemon >= 0) {
+        ::close(existing_daemon);
+        std::cerr << "text_search: A search daemon is already listening on '" << socket_path << "'\n";
+        return 2;
+    }
+    struct stat socket_status;
+    if (::lstat(socket_path.c_str(), &socket_status) == 0 && S_ISSOCK(socket_status.st_mode)) {
+        ::unlink(socket_path.c_str());
+    }
+
+    int listening_socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listening_socket < 0 ||
+        ::bind(listening_socket, reinterpret_cast<const sockaddr*>(&socket_address), sizeof(socket_address)) != 0 ||
+        ::listen(listening_socket, SOMAXCONN) != 0) {
+        std::cerr << "text_search: Cannot listen on '" << socket_path << "': " << std::strerror(errno) << "\n";
+        if (listening_socket >= 0) {
+            ::close(listening_socket);
+        }
+        return 2;
+    }
+
+    // You survive clients that disconnect early and stop cleanly on SIGINT or SIGTERM
+    std::signal(SIGPIPE, SIG_IGN);
+    struct sigaction stop_action;
+    std::memset(&stop_action, 0, sizeof(stop_action));
+    stop_action.sa_handler = request_daemon_stop;
+    sigemptyset(&stop_action.sa_mask);
+    ::sigaction(SIGINT, &stop_action, nullptr);
+    ::sigaction(SIGTERM, &stop_action, nullptr);
+
+    std::cout << "Search daemon listening on " << socket_path << std::endl;
+
+    daemon_query_cache warm_queries;
+    mapped_file_cache warm_mappings;
+    while (!daemon_stop_requested) {
+        int client_socket = ::accept(listening_socket, nullptr, nullptr);
+        if (client_socket < 0) {
+            continue; // You go back to check for a stop request after an interrupt
+        }
+
+        timeval client_timeout{DAEMON_CLIENT_TIMEOUT_SECONDS, 0};
+        ::setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, &client_timeout, sizeof(client_timeout));
+        ::setsockopt(client_socket, SOL_SOCKET, SO_SNDTIMEO, &client_timeout, sizeof(client_timeout));
+        serve_daemon_request(client_socket, warm_queries, warm_mappings);
+        ::close(client_socket);
+    }
+
+    ::close(listening_socket);
+    ::unlink(socket_path.c_str());
+    std::cout << "Search daemon stopped\n";
+    return 0;
+}
+
+// Function to send a batch search to a running daemon and relay its reply to this process's outputs
+// Returns the daemon's exit status, or 2 when the daemon cannot be reached
+int request_daemon_search(const batch_search_options& batch_options) {
+    std::string error_message;
+    int socket_descriptor = connect_daemon_socket(batch_options.daemon_socket_path, error_message);
+    if (socket_descriptor < 0) {
+        std::cerr << "text_search: " << error_message << "\n";
+        return 2;
+    }
+
+    // You send the working directory because the daemon resolves relative paths from it
+    std::error_code directory_error;
+    std::string working_directory = std::filesystem::current_path(directory_error).string();
+    // You send an index search as its one index path, marked by a request flag
+    std::vector<std::string> request_paths = batch_options.search_paths;
+    uint32_t request_flags = batch_options.count_only ? DAEMON_REQUEST_COUNT_ONLY : 0;
+    if (!batch_options.index_path.empty()) {
+        request_paths.assign(1, batch_options.index_path);
+        request_flags |= DAEMON_REQUEST_INDEX_SEARCH;
+    }
+    daemon_request_header request_header{DAEMON_PROTOCOL_MAGIC, request_flags,
+                                         static_cast<uint32_t>(batch_options.result_format),
+                                         static_cast<uint32_t>(batch_options.context_window.lines_before),
+                                         static_cast<uint32_t>(batch_options.context_window.lines_after),
+                                         static_cast<uint32_t>(batch_options.search_query.size()),
+                                         static_cast<uint32_t>(working_directory.size()),
+                                         static_cast<uint32_t>(request_paths.size())};
+    std::string request_bytes(reinterpret_cast<const char*>(&request_header), sizeof(request_header));
+    request_bytes += batch_options.search_query;
+    request_bytes += working_directory;
+    for (const std::string& search_path : request_paths) {
+        uint32_t path_length = static_cast<uint32_t>(search_path.size());
+        request_bytes.append(reinterpret_cast<const char*>(&path_length), sizeof(path_length));
+        request_bytes += search_path;
+    }
+
+    std::signal(SIGPIPE, SIG_IGN);
+    if (!write_all_bytes(socket_descriptor, request_bytes.data(), request_bytes.size())) {
+        std::cerr << "text_search: Cannot send the search to the daemon\n";
+        ::close(socket_descriptor);
+        return 2;
+    }
+
+    // You relay frames until the status frame arrives
+    std::string frame_payload;
+    daemon_frame_header frame_header;
+    while (read_all_bytes(socket_descriptor, reinterpret_cast<char*>(&frame_header), sizeof(frame_header))) {
+        frame_payload.resize(frame_header.payload_length);
+        if (!read_all_bytes(socket_descriptor, &frame_payload[0], frame_payload.size())) {
+            break;
+        }
+        if (frame_header.frame_type == daemon_frame_header::output_frame) {
+            write_all_bytes(STDOUT_FILENO, frame_payload.data(), frame_payload.size());
+        } else if (frame_header.frame_type == daemon_frame_header::error_frame) {
+            std::cerr << frame_payload;
+        } else if (frame_header.frame_type == daemon_frame_header::status_frame &&
+                   frame_payload.size() == sizeof(int32_t)) {
+            int32_t exit_status = 0;
+            std::memcpy(&exit_status, frame_payload.data(), sizeof(exit_status));
+            ::close(socket_descriptor);
+            return exit_status;
+        }
+    }
+
+    std::cerr << "text_search: The search daemon closed the connection before finishing\n";
+    ::close(socket_descriptor);
+    return 2;
+}
+#else
+// Function to report that the daemon needs Unix domain sockets, which this platform lacks
+int run_search_daemon(const std::string&) {
+    std::cerr << "text_search: Daemon mode needs Unix domain sockets, which this platform does not provide\n";
+    return 2;
+}
+
+// Function to report that the daemon needs Unix domain sockets, which this platform lacks
+int request_daemon_search(const batch_search_options&) {
+    return run_search_daemon(std::string());
+}
+#endif
+
+// Function to write one ranked file, and its best lines when asked, in the requested batch format
+void write_ranked_file(result_output_sink& output_sink, const batch_search_options& batch_options, size_t file_rank,
+                       const ranked_file& ranked_result, const search_match_set& match_set,
+                       const std::vector<ranked_line>& best_lines) {
+    char score_text[32];
+    std::snprintf(score_text, sizeof(score_text), "%.4f", ranked_result.relevance_score);
+
+    if (batch_options.result_format == batch_search_options::json_lines) {
+        output_sink.write("{\"rank\":");
+        output_sink.write_decimal(file_rank);
+        output_sink.write(",\"path\":");
+        write_json_string(output_sink, ranked_result.file_path);
+        output_sink.write(",\"score\":");
+        output_sink.write(score_text);
+        output_sink.write(",\"matching_lines\":");
+        output_sink.write_decimal(ranked_result.matching_lines);
+        output_sink.write(",\"words\":");
+        output_sink.write_decimal(ranked_result.word_count);
+        if (batch_options.ranked_lines > 0) {
+            output_sink.write(",\"lines\":[");
+            for (size_t line_index = 0; line_index < best_lines.size(); line_index++) {
+                const match_record& record = match_set.match_records[best_lines[line_index].record_index];
+                std::snprintf(score_text, sizeof(score_text), "%.4f", best_lines[line_index].relevance_score);
+                output_sink.write(line_index > 0 ? ",{\"line\":" : "{\"line\":");
+                output_sink.write_decimal(record.line_number);
+                output_sink.write(",\"score\":");
+                output_sink.write(score_text);
+                output_sink.write(",\"text\":");
+                write_json_string(output_sink, match_set.line_text(record));
+                output_sink.write("}");
+            }
+            output_sink.write("]");
+        }
+        output_sink.write("}\n");
+        return;
+    }
+
+    // You write "rank. path (score, counts)" and then grep-style lines for the grep and report formats
+    output_sink.write_decimal(file_rank);
+    output_sink.write(". ");
+    output_sink.write(ranked_result.file_path);
+    output_sink.write(" (score ");
+    output_sink.write(score_text);
+    output_sink.write(", ");
+    output_sink.write_decimal(ranked_result.matching_lines);
+    output_sink.write(" matching line(s), ");
+    output_sink.write_decimal(ranked_result.word_count);
+    output_sink.write(" words)\n");
+    for (const ranked_line& best_line : best_lines) {
+        const match_record& record = match_set.match_records[best_line.record_index];
+        write_grep_line(output_sink, ranked_result.file_path, record.line_number, ":", match_set.line_text(record));
+    }
+}
+
+// Function to rank every file below the batch paths by BM25 and write only the most relevant ones
+// Word counts come from the search scan itself; only the files shown are searched again, to list their best lines
+// Returns a grep-style exit status: 0 if a line matched, 1 if none did, 2 on any error
+int execute_ranked_search(const batch_search_options& batch_options, const search_engine& engine,
+                          result_output_sink& output_sink, std::ostream& error_stream) {
+    std::string error_message;
+    relevance_ranker ranker(engine.query());
+    bool any_error = false;
+
+    for (const std::string& search_path : batch_options.search_paths) {
+        std::error_code status_error;
+        if (std::filesystem::is_directory(search_path, status_error)) {
+            directory_search_summary search_summary = engine.search_directory(
+                search_path, [&ranker](directory_file_result& file_result) {
+                    ranker.add_file(file_result.file_path, file_result.file_matches, file_result.file_statistics);
+                }, true);
+            if (search_summary.unreadable_entries > 0) {
+                error_stream << "text_search: " << search_path << ": " << search_summary.unreadable_entries
+                             << " unreadable entries\n";
+                any_error = true;
+            }
+            continue;
+        }
+
+        search_match_set match_set;
+        file_content_statistics file_statistics;
+        if (!engine.search_file(search_path, match_set, error_message, &file_statistics)) {
+            error_stream << "text_search: " << error_message << "\n";
+            any_error = true;
+            continue;
+        }
+        ranker.add_file(search_path, match_set, file_statistics);
+    }
+
+    std::vector<ranked_file> ranked_files = ranker.top_files(batch_options.rank_limit);
+    for (size_t file_index = 0; file_index < ranked_files.size(); file_index++) {
+        search_match_set match_set;
+        std::vector<ranked_line> best_lines;
+        if (batch_options.ranked_lines > 0 && engine.search_file(ranked_files[file_index].file_path, match_set,
+                                                                 error_message)) {
+            best_lines = ranker.top_lines(match_set, batch_options.ranked_lines);
+        }
+        write_ranked_file(output_sink, batch_options, file_index + 1, ranked_files[file_index], match_set, best_lines);
+    }
+    output_sink.flush();
+
+    if (any_error) {
+        return 2;
+    }
+    return ranked_files.empty() ? 1 : 0;
+}
+
+// Function to run a search described entirely by command-line arguments, without banners or prompts
+// Returns a grep-style exit status: 0 if a line matched, 1 if none did, 2 on any error
+int run_batch_search(const std::vector<std::string>& arguments) {
+    batch_search_options batch_options;
+    std::string error_message;
+    if (!parse_batch_arguments(arguments, batch_options, error_message)) {
+        std::cerr << "text_search: " << error_message << "\n";
+        display_batch_usage(std::cerr);
+        return 2;
+    }
+    if (!batch_options.daemon_socket_path.empty()) {
+        return request_daemon_search(batch_options);
+    }
+    if (!batch_options.build_index_path.empty()) {
+        return build_search_index(batch_options);
+    }
+    if (batch_options.build_filters) {
+        return build_block_filters(batch_options);
+    }
+    if (batch_options.build_line_tables) {
+        return build_line_tables(batch_options);
+    }
+    if (batch_options.line_number > 0) {
+        return execute_line_lookup(batch_options, standard_output_sink(), std::cerr);
+    }
+
+    // You compile the query once and reuse it for every path
+    search_engine engine;
+    if (!engine.compile(batch_options.search_query, error_message)) {
+        std::cerr << "text_search: " << error_message << "\n";
+        return 2;
+    }
+    engine.set_context_window(batch_options.context_window);
+    if (!batch_options.index_path.empty()) {
+        return execute_index_search(batch_options, engine, standard_output_sink(), std::cerr);
+    }
+    if (batch_options.rank_limit > 0) {
+        return execute_ranked_search(batch_options, engine, standard_output_sink(), std::cerr);
+    }
+    return execute_batch_search(batch_options, engine, standard_output_sink(), std::cerr);
+}
+
 // Main execution function for universal file search application
-int main() {
+int main(int argc, char* argv[]) {
+    // You stop iostreams from synchronising with stdio on every write; results go through the output sink
+    std::ios::sync_with_stdio(false);
+
+    // You switch to a batch search when the command line names a pattern or path instead of only options
+    // Nothing after "--" is an option, so a pattern such as "--help" can be searched for
+    std::vector<std::string> batch_arguments;
+    std::string daemon_socket_path;
+    bool batch_mode = false;
+    for (int argument_index = 1; argument_index < argc; argument_index++) {
+        std::string argument = argv[argument_index];
+        if (argument == "--") {
+            batch_mode = true;
+            break;
+        }
+        if (argument == "-h" || argument == "--help") {
+            display_batch_usage(std::cout);
+            return 0;
+        }
+        if (argument.empty() || argument[0] != '-' || argument.compare(0, 9, "--daemon=") == 0 ||
+            argument.compare(0, 14, "--build-index=") == 0 || argument.compare(0, 8, "--index=") == 0 ||
+            argument == "--build-filter" || argument == "--build-lines") {
+            batch_mode = true;
+        }
+    }
+    int failure_status = batch_mode ? 2 : 1;
+    std::ostream& error_stream = batch_mode ? std::cerr : std::cout;
+
+    // You honour a forced matching kernel or thread count for benchmarking, e.g. --kernel=sse2 --threads=1
+    for (int argument_index = 1; argument_index < argc; argument_index++) {
+        std::string argument = argv[argument_index];
+        if (argument == "--") {
+            // You hand "--" and everything after it to the batch parser unchanged
+            batch_arguments.insert(batch_arguments.end(), argv + argument_index, argv + argc);
+            break;
+        }
+        if (argument.compare(0, 9, "--kernel=") == 0) {
+            std::string error_message;
+            if (!select_matching_kernel(argument.substr(9), error_message)) {
+                error_stream << "Error: " << error_message << ".\n";
+                return failure_status;
+            }
+        } else if (argument.compare(0, 10, "--threads=") == 0) {
+            char* count_end = nullptr;
+            std::string count_text = argument.substr(10);
+            size_t thread_count = std::strtoul(count_text.c_str(), &count_end, 10);
+            if (count_text.empty() || count_text[0] == '-' || *count_end != '\0' || thread_count == 0) {
+                error_stream << "Error: Thread count must be a positive number.\n";
+                return failure_status;
+            }
+            search_thread_count() = thread_count;
+        } else if (argument.compare(0, 9, "--daemon=") == 0) {
+            daemon_socket_path = argument.substr(9);
+        } else if (batch_mode) {
+            batch_arguments.push_back(argument);
+        } else {
+            std::cout << "Warning: Ignoring unknown option '" << argument << "'\n";
+        }
+    }
+
+    if (!daemon_socket_path.empty()) {
+        return run_search_daemon(daemon_socket_path);
+    }
+    if (batch_mode) {
+        return run_batch_search(batch_arguments);
+    }
+
     // You initialize the universal file search application
     display_application_header();
     
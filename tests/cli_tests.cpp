@@ -0,0 +1,224 @@
+/*
+ * Tests for the text_search command line tool
+ * Each check runs the built tool, given as the first argument, and compares its output and exit status
+ */
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <csignal>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Number of failed checks across the whole run
+static size_t failed_checks = 0;
+
+// Absolute path of the tool under test
+static std::string tool_path;
+
+// Function to report a failed check with enough context to reproduce it
+static void check(bool condition, const std::string& description) {
+    if (!condition) {
+        failed_checks++;
+        std::cerr << "FAILED: " << description << "\n";
+    }
+}
+
+// Function to write a whole file, replacing any earlier contents
+static void write_file(const std::string& file_path, const std::string& content) {
+    std::ofstream output_file(file_path, std::ios::binary | std::ios::trunc);
+    output_file << content;
+}
+
+// Exit status and standard output of one run of the tool
+struct tool_run {
+    int exit_status = -1;
+    std::string output_text;
+};
+
+// Function to start the tool with the given arguments in a working directory, without a shell
+// Its standard output goes to output_descriptor, and its error messages are discarded
+static pid_t start_tool(const std::vector<std::string>& arguments, const std::string& working_directory,
+                        int output_descriptor) {
+    pid_t child_process = fork();
+    if (child_process != 0) {
+        return child_process;
+    }
+
+    int null_descriptor = open("/dev/null", O_WRONLY);
+    dup2(output_descriptor, STDOUT_FILENO);
+    dup2(null_descriptor, STDERR_FILENO);
+    if (chdir(working_directory.c_str()) != 0) {
+        _exit(127);
+    }
+    std::vector<char*> argument_pointers;
+    argument_pointers.push_back(const_cast<char*>(tool_path.c_str()));
+    for (const std::string& argument : arguments) {
+        argument_pointers.push_back(const_cast<char*>(argument.c_str()));
+    }
+    argument_pointers.push_back(nullptr);
+    execv(tool_path.c_str(), argument_pointers.data());
+    _exit(127);
+}
+
+// Function to run the tool to completion and collect its exit status and output
+static tool_run run_tool(const std::vector<std::string>& arguments, const std::string& working_directory) {
+    tool_run finished_run;
+    int output_pipe[2];
+    if (pipe(output_pipe) != 0) {
+        return finished_run;
+    }
+    pid_t child_process = start_tool(arguments, working_directory, output_pipe[1]);
+    close(output_pipe[1]);
+
+    char read_buffer[4096];
+    ssize_t bytes_read = 0;
+    while ((bytes_read = read(output_pipe[0], read_buffer, sizeof(read_buffer))) > 0) {
+        finished_run.output_text.append(read_buffer, static_cast<size_t>(bytes_read));
+    }
+    close(output_pipe[0]);
+
+    int wait_status = 0;
+    if (child_process > 0 && waitpid(child_process, &wait_status, 0) == child_process && WIFEXITED(wait_status)) {
+        finished_run.exit_status = WEXITSTATUS(wait_status);
+    }
+    return finished_run;
+}
+
+// Function to describe a run for a failed check
+static std::string describe_run(const std::string& command_text, const tool_run& finished_run) {
+    return command_text + " exited " + std::to_string(finished_run.exit_status) + " with output '" +
+           finished_run.output_text + "'";
+}
+
+// Batch searches must exit 0 on a match, 1 without one and 2 on any error, like grep
+static void test_batch_exit_status(const std::string& test_directory) {
+    write_file(test_directory + "/notes.txt", "one\nneedle two\nthree\n");
+    write_file(test_directory + "/other.txt", "needle\n");
+
+    tool_run matched_run = run_tool({"needle", "notes.txt"}, test_directory);
+    check(matched_run.exit_status == 0 && matched_run.output_text == "2:needle two\n",
+          describe_run("needle notes.txt", matched_run));
+    tool_run two_file_run = run_tool({"needle", "notes.txt", "other.txt"}, test_directory);
+    check(two_file_run.exit_status == 0 && two_file_run.output_text == "notes.txt:2:needle two\nother.txt:1:needle\n",
+          describe_run("needle notes.txt other.txt", two_file_run));
+
+    tool_run unmatched_run = run_tool({"haystack", "notes.txt"}, test_directory);
+    check(unmatched_run.exit_status == 1 && unmatched_run.output_text.empty(),
+          describe_run("haystack notes.txt", unmatched_run));
+
+    const std::vector<std::vector<std::string>> failing_commands = {{"needle", "missing.txt"},
+                                                                    {"--bogus", "needle", "notes.txt"},
+                                                                    {"re:(a", "notes.txt"},
+                                                                    {"--threads=0", "needle", "notes.txt"},
+                                                                    {"--threads=4x", "needle", "notes.txt"},
+                                                                    {"--threads=", "needle", "notes.txt"},
+                                                                    {"--kernel=none", "needle", "notes.txt"}};
+    for (const std::vector<std::string>& arguments : failing_commands) {
+        tool_run failed_run = run_tool(arguments, test_directory);
+        check(failed_run.exit_status == 2, describe_run(arguments[0] + " ...", failed_run));
+    }
+
+    tool_run threaded_run = run_tool({"--threads=2", "needle", "notes.txt"}, test_directory);
+    check(threaded_run.exit_status == 0 && threaded_run.output_text == "2:needle two\n",
+          describe_run("--threads=2 needle notes.txt", threaded_run));
+}
+
+// Everything after "--" must reach the search as pattern and paths, even when it looks like an option
+static void test_end_of_options(const std::string& test_directory) {
+    write_file(test_directory + "/options.txt", "--threads=2 here\n-h\n--daemon=x\nplain\n");
+
+    const std::vector<std::pair<std::string, std::string>> option_patterns = {
+        {"--threads=2", "1:--threads=2 here\n"}, {"-h", "2:-h\n"}, {"--daemon=x", "3:--daemon=x\n"}};
+    for (const std::pair<std::string, std::string>& option_pattern : option_patterns) {
+        tool_run finished_run = run_tool({"--threads=1", "--", option_pattern.first, "options.txt"}, test_directory);
+        check(finished_run.exit_status == 0 && finished_run.output_text == option_pattern.second,
+              describe_run("-- " + option_pattern.first + " options.txt", finished_run));
+    }
+
+    tool_run count_run = run_tool({"-c", "--", "plain", "options.txt"}, test_directory);
+    check(count_run.exit_status == 0 && count_run.output_text == "1\n",
+          describe_run("-c -- plain options.txt", count_run));
+}
+
+// A daemon must answer exactly like a local search, and read an "@file" list from each client's directory
+// on every request, so clients in different directories and edits to a list are both seen
+static void test_daemon_round_trip(const std::string& test_directory) {
+    std::string socket_path = test_directory + "/daemon.sock";
+    int null_descriptor = open("/dev/null", O_WRONLY);
+    pid_t daemon_process = start_tool({"--daemon=" + socket_path}, test_directory, null_descriptor);
+    close(null_descriptor);
+    for (size_t attempt = 0; attempt < 500 && !std::filesystem::exists(socket_path); attempt++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    check(std::filesystem::exists(socket_path), "daemon socket created");
+
+    std::string first_client = test_directory + "/first";
+    std::string second_client = test_directory + "/second";
+    std::filesystem::create_directories(first_client);
+    std::filesystem::create_directories(second_client);
+    write_file(test_directory + "/corpus.txt", "alpha line\nbeta line\ngamma line\n");
+    write_file(first_client + "/terms.txt", "alpha\n");
+    write_file(second_client + "/terms.txt", "beta\n");
+    std::string server_option = "--server=" + socket_path;
+
+    const std::vector<std::vector<std::string>> compared_searches = {
+        {"line", "../corpus.txt"}, {"-C", "1", "beta", "../corpus.txt"}, {"delta", "../corpus.txt"},
+        {"line", "../missing.txt"}, {"re:(", "../corpus.txt"}};
+    for (const std::vector<std::string>& arguments : compared_searches) {
+        std::vector<std::string> daemon_arguments = arguments;
+        daemon_arguments.insert(daemon_arguments.begin(), server_option);
+        tool_run local_run = run_tool(arguments, first_client);
+        tool_run daemon_run = run_tool(daemon_arguments, first_client);
+        check(daemon_run.exit_status == local_run.exit_status && daemon_run.output_text == local_run.output_text,
+              describe_run("daemon search for " + arguments[0], daemon_run) + ", locally " +
+                  describe_run(arguments[0], local_run));
+    }
+
+    tool_run first_list_run = run_tool({server_option, "@terms.txt", "../corpus.txt"}, first_client);
+    check(first_list_run.exit_status == 0 && first_list_run.output_text == "1:alpha line\n",
+          describe_run("@terms.txt from the first client", first_list_run));
+    tool_run second_list_run = run_tool({server_option, "@terms.txt", "../corpus.txt"}, second_client);
+    check(second_list_run.exit_status == 0 && second_list_run.output_text == "2:beta line\n",
+          describe_run("@terms.txt from the second client", second_list_run));
+    write_file(first_client + "/terms.txt", "gamma\n");
+    tool_run edited_list_run = run_tool({server_option, "@terms.txt", "../corpus.txt"}, first_client);
+    check(edited_list_run.exit_status == 0 && edited_list_run.output_text == "3:gamma line\n",
+          describe_run("@terms.txt after an edit", edited_list_run));
+
+    int wait_status = 0;
+    kill(daemon_process, SIGTERM);
+    check(waitpid(daemon_process, &wait_status, 0) == daemon_process && WIFEXITED(wait_status) &&
+              WEXITSTATUS(wait_status) == 0,
+          "daemon stops cleanly on SIGTERM");
+}
+
+int main(int argument_count, char* arguments[]) {
+    if (argument_count < 2) {
+        std::cerr << "Usage: cli_tests PATH_TO_TEXT_SEARCH\n";
+        return 2;
+    }
+    tool_path = std::filesystem::absolute(arguments[1]).string();
+    std::string test_directory =
+        (std::filesystem::temp_directory_path() / ("text_search_cli_tests_" + std::to_string(::getpid()))).string();
+    std::filesystem::create_directories(test_directory);
+
+    test_batch_exit_status(test_directory);
+    test_end_of_options(test_directory);
+    test_daemon_round_trip(test_directory);
+
+    std::error_code remove_error;
+    std::filesystem::remove_all(test_directory, remove_error);
+    if (failed_checks > 0) {
+        std::cerr << failed_checks << " check(s) failed\n";
+        return 1;
+    }
+    std::cout << "All checks passed\n";
+    return 0;
+}
@@ -0,0 +1,648 @@
+/*
+ * Tests for the text search library
+ * Where a slow, obviously correct reference exists, a check compares the fast path against it
+ */
+
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <regex>
+
+#include "textsearch.h"
+
+// Number of failed checks across the whole run
+static size_t failed_checks = 0;
+
+// Function to report a failed check with enough context to reproduce it
+static void check(bool condition, const std::string& description) {
+    if (!condition) {
+        failed_checks++;
+        std::cerr << "FAILED: " << description << "\n";
+    }
+}
+
+// Function to write a whole file, replacing any earlier contents
+static void write_file(const std::string& file_path, const std::string& content) {
+    std::ofstream output_file(file_path, std::ios::binary | std::ios::trunc);
+    output_file << content;
+}
+
+// Function to list the line numbers of a match set, for comparing two searches
+static std::vector<size_t> matched_line_numbers(const search_match_set& match_set) {
+    std::vector<size_t> line_numbers;
+    for (const match_record& record : match_set.match_records) {
+        line_numbers.push_back(record.line_number);
+    }
+    return line_numbers;
+}
+
+// The header must build on its own and search buffers and files through the search_engine interface
+static void test_search_engine_interface(const std::string& test_directory) {
+    search_engine engine;
+    std::string error_message;
+    check(engine.compile("needle", error_message), "compile a literal term: " + error_message);
+    check(!engine.compile("re:(", error_message) && !error_message.empty(), "malformed regex is refused");
+
+    std::string content = "hay\nNeedle one\nhay\nsecond needle\n";
+    std::vector<size_t> line_numbers;
+    size_t match_count = engine.search_buffer(content, [&](const match_record& record, std::string_view line_text) {
+        line_numbers.push_back(record.line_number);
+        check(line_text.find("eedle") != std::string_view::npos, "buffer match line text");
+    });
+    check(match_count == 2 && line_numbers == std::vector<size_t>({2, 4}), "search a buffer");
+
+    std::string file_path = test_directory + "/engine.txt";
+    write_file(file_path, content);
+    search_match_set match_set;
+    check(engine.search_file(file_path, match_set, error_message) && matched_line_numbers(match_set) == line_numbers,
+          "search a file");
+    check(!engine.search_file(test_directory + "/missing.txt", match_set, error_message), "missing file is reported");
+}
+
+// Function to overwrite bytes inside a file without changing its size, then move its time forward
+// The time is set explicitly so the edit is visible even where timestamps are coarse
+static void edit_file_in_place(const std::string& file_path, size_t edit_offset, const std::string& new_bytes) {
+    std::filesystem::file_time_type modified_time = std::filesystem::last_write_time(file_path);
+    {
+        std::fstream edited_file(file_path, std::ios::binary | std::ios::in | std::ios::out);
+        edited_file.seekp(static_cast<std::streamoff>(edit_offset));
+        edited_file << new_bytes;
+    }
+    std::filesystem::last_write_time(file_path, modified_time + std::chrono::seconds(1));
+}
+
+// Function to append bytes to a file and move its time forward
+static void append_file(const std::string& file_path, const std::string& appended_bytes) {
+    std::filesystem::file_time_type modified_time = std::filesystem::last_write_time(file_path);
+    {
+        std::ofstream output_file(file_path, std::ios::binary | std::ios::app);
+        output_file << appended_bytes;
+    }
+    std::filesystem::last_write_time(file_path, modified_time + std::chrono::seconds(1));
+}
+
+// Function to search a file with a plain scan that uses no sidecar and no cache
+static std::vector<size_t> scanned_line_numbers(const std::string& file_path, const compiled_query& query) {
+    input_file_handle input_file;
+    input_file.open(file_path);
+    return matched_line_numbers(search_opened_file(input_file, query, context_window_options()));
+}
+
+// Block filters must be used for an unchanged or appended file, and refused after an in-place edit
+static void test_block_filter_invalidation(const std::string& test_directory) {
+    std::string file_path = test_directory + "/filtered.log";
+    std::string content;
+    for (size_t line_index = 0; content.size() < 4 * FILTER_BLOCK_SIZE; line_index++) {
+        content += "entry " + std::to_string(line_index) + " ordinary log text\n";
+    }
+    write_file(file_path, content);
+
+    block_filter_sidecar block_filters;
+    std::string error_message;
+    check(block_filters.build(file_path, error_message) &&
+              block_filters.save(file_path + BLOCK_FILTER_SUFFIX, error_message),
+          "block filter build: " + error_message);
+
+    compiled_query query;
+    prepare_search_query("zqxj", query, error_message);
+    auto filtered_search = [&](std::vector<size_t>& line_numbers) {
+        input_file_handle input_file;
+        search_match_set match_set;
+        input_file.open(file_path);
+        bool used_filters = search_filtered_file(file_path, input_file, query, match_set);
+        line_numbers = matched_line_numbers(match_set);
+        return used_filters;
+    };
+
+    std::vector<size_t> line_numbers;
+    check(filtered_search(line_numbers) && line_numbers.empty(), "block filters on an unchanged file");
+
+    append_file(file_path, "appended zqxj\n");
+    check(filtered_search(line_numbers) && line_numbers == scanned_line_numbers(file_path, query),
+          "block filters after an append");
+
+    // You edit the middle of a covered block without changing the size, which the edge fingerprint cannot see
+    // The sidecar is rebuilt first, since a file that grew since the build is taken to have been appended to
+    check(block_filters.build(file_path, error_message) &&
+              block_filters.save(file_path + BLOCK_FILTER_SUFFIX, error_message),
+          "block filter rebuild: " + error_message);
+    edit_file_in_place(file_path, 3000000, "ZQXJ");
+    check(!filtered_search(line_numbers), "block filters refused after an in-place edit");
+    check(matched_line_numbers(search_file_content(file_path, "zqxj")) == scanned_line_numbers(file_path, query) &&
+              scanned_line_numbers(file_path, query).size() == 2,
+          "search after an in-place edit finds the edited line");
+}
+
+// Function to build a random string over a small alphabet, so matches are frequent enough to test
+static std::string random_text(std::mt19937& generator, size_t text_length, const std::string& alphabet) {
+    std::string text;
+    for (size_t byte_index = 0; byte_index < text_length; byte_index++) {
+        text += alphabet[generator() % alphabet.size()];
+    }
+    return text;
+}
+
+// The regular expression engine must match the same lines and spans as std::regex's POSIX grammar
+static void test_regex_against_std_regex() {
+    const std::vector<std::string> patterns = {"a.*c|b", "ab|a", "a*",     "(ab)+",   "^ab",     "b$",     "a|ab|abc",
+                                               "[bc]+a", "x?y",  "(a|b)*c", "a{2,3}", "[^a]b",   "^$",     "(a|ab)(c|bcd)",
+                                               "b+$",    "^a?b", "c(a|x)*", "a{2}b?", "(x|y)+a", "[a-c]{3}"};
+    std::mt19937 generator(29);
+    for (const std::string& pattern : patterns) {
+        lazy_dfa_regex regex_engine;
+        std::string error_message;
+        if (!regex_engine.compile(pattern, error_message)) {
+            check(false, "regex compile of '" + pattern + "': " + error_message);
+            continue;
+        }
+        std::regex reference_regex(pattern, std::regex::extended | std::regex::icase);
+
+        for (size_t trial = 0; trial < 1500; trial++) {
+            std::string line_text = random_text(generator, generator() % 10, "abcxyAB");
+            const char* line_end = line_text.data() + line_text.size();
+            std::smatch reference_match;
+            bool reference_found = std::regex_search(line_text, reference_match, reference_regex);
+            std::string description = "re:" + pattern + " on '" + line_text + "'";
+            check(regex_engine.line_matches(line_text.data(), line_end) == reference_found, description);
+            if (!line_text.empty()) { // You scan no lines at all in an empty range
+                check((regex_engine.find(line_text.data(), line_end) != nullptr) == reference_found,
+                      description + " find");
+            }
+            if (!reference_found) {
+                continue;
+            }
+            size_t match_column = 0;
+            size_t match_length = 0;
+            regex_engine.locate_line_match(line_text.data(), line_end, match_column, match_length);
+            check(match_column == static_cast<size_t>(reference_match.position(0)) &&
+                      match_length == static_cast<size_t>(reference_match.length(0)),
+                  description + " column");
+        }
+    }
+
+    // You need the match column in linear time even when every start could begin a long failed attempt
+    lazy_dfa_regex regex_engine;
+    std::string error_message;
+    regex_engine.compile("a.*c|b", error_message);
+    std::string hostile_line(20000, 'a');
+    hostile_line += 'b';
+    size_t match_column = 0;
+    size_t match_length = 0;
+    auto locate_start = std::chrono::steady_clock::now();
+    regex_engine.locate_line_match(hostile_line.data(), hostile_line.data() + hostile_line.size(), match_column,
+                                   match_length);
+    double locate_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - locate_start).count();
+    check(match_column == 20000 && match_length == 1, "hostile line column");
+    check(locate_seconds < 1.0, "hostile line took " + std::to_string(locate_seconds) + " s");
+}
+
+// Line tables must number matches exactly as a scan, and be refused after an in-place edit
+static void test_line_table_invalidation(const std::string& test_directory) {
+    std::string file_path = test_directory + "/numbered.txt";
+    std::string content;
+    for (size_t line_index = 0; line_index < 5000; line_index++) {
+        content += std::string(line_index % 7, ' ') + "row " + std::to_string(line_index) +
+                   (line_index % 97 == 3 ? " mark\n" : "\n");
+    }
+    write_file(file_path, content);
+
+    line_offset_table line_table;
+    std::string error_message;
+    check(line_table.build(file_path, error_message) && line_table.save(file_path + LINE_TABLE_SUFFIX, error_message),
+          "line table build: " + error_message);
+
+    compiled_query query;
+    prepare_search_query("mark", query, error_message);
+    auto numbered_search = [&](std::vector<size_t>& line_numbers) {
+        input_file_handle input_file;
+        search_match_set match_set;
+        input_file.open(file_path);
+        bool used_table = search_numbered_file(file_path, input_file, query, match_set);
+        line_numbers = matched_line_numbers(match_set);
+        return used_table;
+    };
+
+    std::vector<size_t> line_numbers;
+    check(numbered_search(line_numbers) && line_numbers == scanned_line_numbers(file_path, query),
+          "line table on an unchanged file");
+
+    search_match_set looked_up_line;
+    lookup_numbered_line(file_path, 4321, looked_up_line, error_message);
+    check(looked_up_line.match_records.size() == 1 &&
+              looked_up_line.line_text(looked_up_line.match_records[0]) == std::string(4320 % 7, ' ') + "row 4320",
+          "line lookup through the table");
+
+    append_file(file_path, "extra\nlast mark\n");
+    check(numbered_search(line_numbers) && line_numbers == scanned_line_numbers(file_path, query),
+          "line table after an append");
+
+    check(line_table.build(file_path, error_message) && line_table.save(file_path + LINE_TABLE_SUFFIX, error_message),
+          "line table rebuild: " + error_message);
+    edit_file_in_place(file_path, 10, "\n\n");
+    check(!numbered_search(line_numbers), "line table refused after an in-place edit");
+
+    // You never write a sidecar from a lookup; only --build-lines does
+    std::string plain_path = test_directory + "/plain.txt";
+    write_file(plain_path, "a\nb\nc\n");
+    lookup_numbered_line(plain_path, 2, looked_up_line, error_message);
+    check(!std::filesystem::exists(plain_path + LINE_TABLE_SUFFIX), "line lookup leaves no sidecar behind");
+}
+
+// Function to list the lines of a buffer that a query matches, or none if it does not compile
+static std::vector<size_t> buffer_line_numbers(const std::string& query_text, const std::string& content) {
+    search_engine engine;
+    std::string error_message;
+    std::vector<size_t> line_numbers;
+    if (!engine.compile(query_text, error_message)) {
+        check(false, "compile of '" + query_text + "': " + error_message);
+        return line_numbers;
+    }
+    engine.search_buffer(content, [&](const match_record& record, std::string_view) {
+        line_numbers.push_back(record.line_number);
+    });
+    return line_numbers;
+}
+
+// Several words must all appear on a line in any order, while a quoted phrase is matched as typed
+static void test_all_terms_matching() {
+    std::string content = "hello world\nworld hello\nhelloworld\nHELLO there WORLD\nhello there\nsay \"hello world\"\n";
+    check(buffer_line_numbers("hello world", content) == std::vector<size_t>({1, 2, 3, 4, 6}), "words in any order");
+    check(buffer_line_numbers("\"hello world\"", content) == std::vector<size_t>({1, 6}), "quoted phrase");
+    check(buffer_line_numbers("hello  hello", content) == std::vector<size_t>({1, 2, 3, 4, 5, 6}), "repeated word");
+
+    compiled_query first_query;
+    compiled_query second_query;
+    std::string error_message;
+    prepare_search_query("hello world", first_query, error_message);
+    prepare_search_query("WORLD  hello", second_query, error_message);
+    check(first_query.normalized_text == second_query.normalized_text, "word order leaves the cache key unchanged");
+
+    all_terms_matcher empty_matcher;
+    empty_matcher.compile({});
+    check(empty_matcher.find(content.data(), content.data() + content.size()) == nullptr, "matcher without terms");
+}
+
+// A directory search must report its files in full-path order at any thread count
+// Many small directories make listing and searching interleave differently on every run
+static void test_directory_order(const std::string& test_directory) {
+    std::string tree_root = test_directory + "/tree";
+    std::vector<std::string> relative_paths = {"b.txt", "b-x/c.txt", "b/a.txt", "b/z/deep.md", "b0.txt", "a.log"};
+    for (size_t directory_index = 0; directory_index < 12; directory_index++) {
+        for (size_t file_index = 0; file_index < 25; file_index++) {
+            relative_paths.push_back("d" + std::to_string(directory_index % 4) + "/n" + std::to_string(directory_index) +
+                                     "/f" + std::to_string(file_index) + ".txt");
+        }
+    }
+
+    // You put the match on a different line in each file, so a result attached to the wrong path shows
+    std::map<std::string, size_t> expected_lines;
+    std::vector<std::string> expected_paths;
+    for (size_t file_index = 0; file_index < relative_paths.size(); file_index++) {
+        std::filesystem::path file_path = std::filesystem::path(tree_root) / relative_paths[file_index];
+        std::filesystem::create_directories(file_path.parent_path());
+        write_file(file_path.string(), std::string(file_index % 5, '\n') + "needle\n");
+        expected_lines[file_path.string()] = file_index % 5 + 1;
+        expected_paths.push_back(file_path.string());
+    }
+    write_file(tree_root + "/b/image.bin", "needle\n");
+    std::sort(expected_paths.begin(), expected_paths.end());
+
+    compiled_query query;
+    std::string error_message;
+    prepare_search_query("needle", query, error_message);
+    size_t default_thread_count = search_thread_count();
+    for (size_t thread_count : {1, 2, 8}) {
+        search_thread_count() = thread_count;
+        std::vector<std::string> reported_paths;
+        directory_search_summary search_summary =
+            search_directory_tree(tree_root, query, context_window_options(), [&](directory_file_result& file_result) {
+                reported_paths.push_back(file_result.file_path);
+                check(matched_line_numbers(file_result.file_matches) ==
+                          std::vector<size_t>({expected_lines[file_result.file_path]}),
+                      "matches of " + file_result.file_path);
+            });
+        std::string description = " with " + std::to_string(thread_count) + " threads";
+        check(reported_paths == expected_paths, "directory output order" + description);
+        check(search_summary.files_searched == expected_paths.size() && search_summary.files_skipped == 1,
+              "directory file counts" + description);
+    }
+    search_thread_count() = default_thread_count;
+}
+
+// Packed posting groups must decode to the block numbers they were built from at every bit width
+static void test_posting_round_trip() {
+    std::mt19937 generator(17);
+    for (uint32_t bit_width = 0; bit_width <= 32; bit_width++) {
+        uint32_t widest_gap = bit_width == 32 ? 0xFFFFFFFFu : (1u << bit_width) - 1;
+        uint32_t gaps[POSTING_GROUP_SIZE];
+        uint32_t expected_blocks[POSTING_GROUP_SIZE];
+        uint32_t base_value = generator();
+        uint32_t running_total = base_value;
+        for (size_t gap_index = 0; gap_index < POSTING_GROUP_SIZE; gap_index++) {
+            gaps[gap_index] = gap_index == 0 ? widest_gap : static_cast<uint32_t>(generator()) & widest_gap;
+            running_total += gaps[gap_index];
+            expected_blocks[gap_index] = running_total;
+        }
+
+        std::string packed_bytes;
+        pack_posting_group(gaps, bit_width, packed_bytes);
+        check(packed_bytes.size() == bit_width * POSTING_GROUP_SIZE / 8,
+              "packed size at bit width " + std::to_string(bit_width));
+        packed_bytes.resize(packed_bytes.size() + 16, '\0'); // You let the vector decoder read its last row whole
+
+        uint32_t decoded_blocks[POSTING_GROUP_SIZE];
+        unpack_posting_group(packed_bytes.data(), bit_width, base_value, decoded_blocks);
+        check(std::equal(decoded_blocks, decoded_blocks + POSTING_GROUP_SIZE, expected_blocks),
+              "posting round trip at bit width " + std::to_string(bit_width));
+        if (bit_width > 0) {
+            unpack_posting_group_scalar(packed_bytes.data(), bit_width, base_value, decoded_blocks);
+            check(std::equal(decoded_blocks, decoded_blocks + POSTING_GROUP_SIZE, expected_blocks),
+                  "scalar posting round trip at bit width " + std::to_string(bit_width));
+        }
+    }
+}
+
+// Every kernel must find the same first match as the scalar reference, under each forced kernel
+static void test_matching_kernels() {
+    std::mt19937 generator(11);
+    const std::string alphabet = "abAB\n\x80\xff";
+    for (const matching_kernel_entry& kernel_entry : available_matching_kernels()) {
+        std::string error_message;
+        if (!select_matching_kernel(kernel_entry.kernel_name, error_message)) {
+            continue; // You can only force the kernels this processor supports
+        }
+        for (size_t trial = 0; trial < 20000; trial++) {
+            std::string haystack = random_text(generator, generator() % 200, alphabet);
+            std::string folded_term = fold_search_term(random_text(generator, 1 + generator() % 6, "abAB\x80"));
+            const char* haystack_end = haystack.data() + haystack.size();
+            const char* expected = find_case_insensitive_scalar(haystack.data(), haystack_end, folded_term);
+            const char* found = find_case_insensitive(haystack.data(), haystack_end, folded_term);
+            if (expected != found) {
+                check(false, std::string("kernel ") + kernel_entry.kernel_name + " finds '" + folded_term +
+                                 "' at a different offset in a " + std::to_string(haystack.size()) + "-byte range");
+                break;
+            }
+        }
+
+        // You also run a whole line search, which reaches the kernel through the literal matcher
+        check(buffer_line_numbers("ab", "xx\nAB\nzz aB\nnothing\nab") == std::vector<size_t>({2, 3, 5}),
+              std::string("kernel ") + kernel_entry.kernel_name + " line search");
+    }
+    std::string error_message;
+    select_matching_kernel("auto", error_message);
+}
+
+// Function to compute the fewest edits turning the term into any substring of the text
+static size_t brute_force_substring_distance(const std::string& folded_term, const std::string& text) {
+    std::vector<size_t> previous_column(folded_term.size() + 1);
+    for (size_t term_index = 0; term_index <= folded_term.size(); term_index++) {
+        previous_column[term_index] = term_index;
+    }
+    size_t smallest_distance = folded_term.size();
+    for (char text_byte : text) {
+        std::vector<size_t> current_column(folded_term.size() + 1, 0); // You let a match start at any byte
+        for (size_t term_index = 1; term_index <= folded_term.size(); term_index++) {
+            size_t substitution = previous_column[term_index - 1] +
+                                  (fold_ascii_case(static_cast<unsigned char>(text_byte)) ==
+                                           static_cast<unsigned char>(folded_term[term_index - 1])
+                                       ? 0
+                                       : 1);
+            current_column[term_index] =
+                std::min(substitution, std::min(previous_column[term_index], current_column[term_index - 1]) + 1);
+        }
+        smallest_distance = std::min(smallest_distance, current_column[folded_term.size()]);
+        previous_column.swap(current_column);
+    }
+    return smallest_distance;
+}
+
+// Myers' bit-parallel matcher must agree with a plain dynamic program on every line
+static void test_fuzzy_matching() {
+    std::mt19937 generator(23);
+    for (size_t trial = 0; trial < 3000; trial++) {
+        std::string search_term = random_text(generator, 2 + generator() % 9, "abcd");
+        size_t maximum_distance = generator() % std::min<size_t>(3, search_term.size());
+        fuzzy_term_matcher fuzzy_matcher;
+        std::string error_message;
+        if (!fuzzy_matcher.compile(search_term, maximum_distance, error_message)) {
+            check(false, "fuzzy compile of '" + search_term + "': " + error_message);
+            continue;
+        }
+
+        std::string line_text = random_text(generator, generator() % 24, "abcdABx");
+        const char* line_end = line_text.data() + line_text.size();
+        size_t expected_distance = brute_force_substring_distance(fold_search_term(search_term), line_text);
+        bool line_found = fuzzy_matcher.find(line_text.data(), line_end) != nullptr;
+        std::string description = "~" + std::to_string(maximum_distance) + ":" + search_term + " on '" + line_text + "'";
+        check(line_found == (expected_distance <= maximum_distance), description);
+        if (line_found) {
+            check(fuzzy_matcher.describe_line_matches(line_text.data(), line_end) ==
+                      "distance " + std::to_string(expected_distance),
+                  description + " distance");
+        }
+    }
+}
+
+// The result cache must reuse an unchanged file, rescan only an appended tail, and rescan an edited file whole
+static void test_result_cache_invalidation(const std::string& test_directory) {
+    std::string file_path = test_directory + "/cached.txt";
+    std::string content;
+    for (size_t line_index = 0; line_index < 2000; line_index++) {
+        content += "line " + std::to_string(line_index) + (line_index % 100 == 7 ? " needle\n" : " hay\n");
+    }
+    write_file(file_path, content);
+
+    compiled_query query;
+    std::string error_message;
+    prepare_search_query("needle", query, error_message);
+    search_result_cache result_cache;
+    auto cached_search = [&](result_cache_lookup& lookup) {
+        input_file_handle input_file;
+        std::shared_ptr<mapped_file_region> mapped_file = std::make_shared<mapped_file_region>();
+        input_file.open(file_path);
+        mapped_file->map(input_file);
+        return matched_line_numbers(result_cache.search(std::move(mapped_file), input_file.identity(), query, nullptr,
+                                                        &lookup));
+    };
+
+    result_cache_lookup lookup;
+    check(cached_search(lookup) == scanned_line_numbers(file_path, query) && lookup.kind == result_cache_lookup::full_scan,
+          "result cache first search");
+    check(cached_search(lookup) == scanned_line_numbers(file_path, query) &&
+              lookup.kind == result_cache_lookup::cached_result,
+          "result cache unchanged file");
+
+    append_file(file_path, "tail needle\n");
+    check(cached_search(lookup) == scanned_line_numbers(file_path, query) &&
+              lookup.kind == result_cache_lookup::appended_tail,
+          "result cache append");
+
+    edit_file_in_place(file_path, content.size() / 2, "NEEDLE");
+    check(cached_search(lookup) == scanned_line_numbers(file_path, query) && lookup.kind == result_cache_lookup::full_scan,
+          "result cache in-place edit");
+}
+
+// A pattern list must match exactly the lines that hold any listed term, as one naive search per term would
+static void test_pattern_list(const std::string& test_directory) {
+    std::string list_path = test_directory + "/terms.txt";
+    write_file(list_path, "he\nShe\n\nhis\r\nhers\nhe\n   \nab\xff\n");
+    const std::vector<std::string> listed_terms = {"he", "she", "his", "hers", "ab\xff"};
+
+    std::mt19937 generator(31);
+    std::string content;
+    std::vector<size_t> expected_lines;
+    for (size_t line_index = 0; line_index < 3000; line_index++) {
+        std::string line_text = random_text(generator, generator() % 12, "hersiHERSab\xff ");
+        std::string folded_line = fold_search_term(line_text);
+        bool holds_term = false;
+        for (const std::string& listed_term : listed_terms) {
+            holds_term = holds_term || folded_line.find(listed_term) != std::string::npos;
+        }
+        if (holds_term) {
+            expected_lines.push_back(line_index + 1);
+        }
+        content += line_text + "\n";
+    }
+    check(buffer_line_numbers("@" + list_path, content) == expected_lines, "pattern list lines");
+
+    // You key the query by its terms, so editing the list gives it a new key
+    compiled_query first_query;
+    compiled_query edited_query;
+    std::string error_message;
+    prepare_search_query("@" + list_path, first_query, error_message);
+    write_file(list_path, "he\nshe\nhis\n");
+    prepare_search_query("@" + list_path, edited_query, error_message);
+    check(first_query.normalized_text != edited_query.normalized_text, "edited pattern list changes the cache key");
+
+    compiled_query refused_query;
+    write_file(list_path, "\n  \n");
+    check(!prepare_search_query("@" + list_path, refused_query, error_message), "empty pattern list is refused");
+    check(!prepare_search_query("@" + test_directory + "/no_such_list.txt", refused_query, error_message),
+          "missing pattern list is refused");
+}
+
+// The reorder buffer must emit results in sequence whatever order they arrive in, and stop admitting work when full
+static void test_reorder_buffer() {
+    std::vector<size_t> emitted_results;
+    reorder_buffer<size_t> ordered_results(4, 100, [&](size_t& result) { emitted_results.push_back(result); });
+    check(ordered_results.admission_limit() == 4, "admission window of an empty buffer");
+
+    ordered_results.publish(2, 2, 60);
+    ordered_results.publish(1, 1, 60);
+    check(emitted_results.empty(), "results held until the first one arrives");
+    check(ordered_results.admission_limit() == 1, "no new work past the byte limit");
+    ordered_results.publish(0, 0, 0);
+    check(emitted_results == std::vector<size_t>({0, 1, 2}), "held results released in order");
+    check(ordered_results.admission_limit() == 7, "admission window after the release");
+
+    std::mt19937 generator(37);
+    std::vector<size_t> arrival_order(500);
+    std::iota(arrival_order.begin(), arrival_order.end(), 3);
+    std::shuffle(arrival_order.begin(), arrival_order.end(), generator);
+    for (size_t sequence_number : arrival_order) {
+        ordered_results.publish(sequence_number, sequence_number, 1);
+    }
+    std::vector<size_t> expected_results(503);
+    std::iota(expected_results.begin(), expected_results.end(), 0);
+    check(emitted_results == expected_results, "shuffled results emitted in order");
+
+    reorder_buffer_statistics buffer_statistics = ordered_results.statistics();
+    check(buffer_statistics.delayed_results >= 2 && buffer_statistics.peak_held_bytes >= 120,
+          "reorder buffer statistics");
+}
+
+// A BM25 ranking must put denser and shorter matching files first, break ties by path, and keep every top-k a prefix
+static void test_relevance_ranking(const std::string& test_directory) {
+    std::string corpus_directory = test_directory + "/corpus";
+    std::filesystem::create_directories(corpus_directory);
+    std::string filler_words;
+    for (size_t word_index = 0; word_index < 60; word_index++) {
+        filler_words += " filler";
+    }
+    const std::vector<std::pair<std::string, std::string>> documents = {
+        {"dense.txt", "apple pie\napple pie apple\n"}, {"long.txt", "apple pie" + filler_words + "\n"},
+        {"none.txt", "nothing to see\n"},             {"single.txt", "apple pie\n"},
+        {"tie_a.txt", "apple pie and cream\n"},       {"tie_b.txt", "apple pie and cream\n"}};
+
+    search_engine engine;
+    std::string error_message;
+    engine.compile("apple pie", error_message);
+    relevance_ranker ranker(engine.query());
+    search_match_set dense_matches;
+    for (const std::pair<std::string, std::string>& document : documents) {
+        std::string file_path = corpus_directory + "/" + document.first;
+        write_file(file_path, document.second);
+        search_match_set match_set;
+        file_content_statistics file_statistics;
+        engine.search_file(file_path, match_set, error_message, &file_statistics);
+        ranker.add_file(file_path, match_set, file_statistics);
+        if (document.first == "dense.txt") {
+            dense_matches = match_set;
+        }
+    }
+    check(ranker.document_count() == 6 && ranker.matching_document_count() == 5, "ranked document counts");
+
+    const std::vector<std::string> expected_order = {"dense.txt", "single.txt", "tie_a.txt", "tie_b.txt", "long.txt"};
+    for (size_t result_limit = 0; result_limit <= expected_order.size() + 1; result_limit++) {
+        std::vector<ranked_file> ranked_files = ranker.top_files(result_limit);
+        bool order_matches = ranked_files.size() == std::min(result_limit, expected_order.size());
+        for (size_t rank_index = 0; order_matches && rank_index < ranked_files.size(); rank_index++) {
+            order_matches = ranked_files[rank_index].file_path == corpus_directory + "/" + expected_order[rank_index];
+        }
+        check(order_matches, "top " + std::to_string(result_limit) + " files");
+    }
+
+    std::vector<ranked_line> ranked_lines = ranker.top_lines(dense_matches, 1);
+    check(ranked_lines.size() == 1 && ranked_lines[0].record_index == 1, "best line of a ranked file");
+}
+
+// Deeply nested groups and stacked repeats must be refused with an error instead of overflowing the stack
+static void test_regex_nesting_limit() {
+    auto nested_groups = [](size_t group_depth) {
+        return std::string(group_depth, '(') + "a" + std::string(group_depth, ')');
+    };
+    lazy_dfa_regex regex_engine;
+    std::string error_message;
+    std::string line_text = "xay";
+    check(regex_engine.compile(nested_groups(MAX_REGEX_NESTING_DEPTH), error_message) &&
+              regex_engine.line_matches(line_text.data(), line_text.data() + line_text.size()),
+          "groups nested to the limit: " + error_message);
+    check(!regex_engine.compile(nested_groups(MAX_REGEX_NESTING_DEPTH + 1), error_message) &&
+              error_message == "Groups nested deeper than " + std::to_string(MAX_REGEX_NESTING_DEPTH) +
+                                   " in regular expression",
+          "groups nested past the limit");
+    check(!regex_engine.compile("a" + std::string(100000, '?'), error_message), "stacked repeats past the limit");
+
+    compiled_query query;
+    check(!prepare_search_query("re:" + nested_groups(20000), query, error_message), "20000 nested groups in a query");
+}
+
+int main() {
+    std::string test_directory =
+        (std::filesystem::temp_directory_path() / ("textsearch_tests_" + std::to_string(::getpid()))).string();
+    std::filesystem::create_directories(test_directory);
+
+    test_search_engine_interface(test_directory);
+    test_block_filter_invalidation(test_directory);
+    test_regex_against_std_regex();
+    test_line_table_invalidation(test_directory);
+    test_all_terms_matching();
+    test_directory_order(test_directory);
+    test_posting_round_trip();
+    test_matching_kernels();
+    test_fuzzy_matching();
+    test_result_cache_invalidation(test_directory);
+    test_pattern_list(test_directory);
+    test_reorder_buffer();
+    test_relevance_ranking(test_directory);
+    test_regex_nesting_limit();
+
+    std::error_code remove_error;
+    std::filesystem::remove_all(test_directory, remove_error);
+    if (failed_checks > 0) {
+        std::cerr << failed_checks << " check(s) failed\n";
+        return 1;
+    }
+    std::cout << "All checks passed\n";
+    return 0;
+}
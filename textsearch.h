@@ -0,0 +1,6028 @@
+/*
+ * Universal File Content Search Library
+ * Console-free search core shared by the interactive tool and applications that embed it
+ * Code hints and optimizations by artlest
+ * Header-only: include it from any number of translation units
+ */
+
+#ifndef TEXT_SEARCH_ENGINE_H
+#define TEXT_SEARCH_ENGINE_H
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <string_view>
+#include <cstdint>
+#include <cmath>
+#include <cerrno>
+#include <chrono>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <filesystem>
+
+// You enable memory-mapped scanning on POSIX systems and stream everywhere else
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define TEXT_SEARCH_HAS_MMAP 1
+#else
+#define TEXT_SEARCH_HAS_MMAP 0
+#endif
+
+// You use the SSE2 matching kernel wherever the target guarantees SSE2
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#define TEXT_SEARCH_HAS_SSE2 1
+#else
+#define TEXT_SEARCH_HAS_SSE2 0
+#endif
+
+// You compile AVX2 and AVX-512 kernels on x86-64 and pick one at runtime from cpuid
+#if TEXT_SEARCH_HAS_SSE2 && (defined(__x86_64__) || defined(_M_X64))
+#include <immintrin.h>
+#define TEXT_SEARCH_HAS_X86_DISPATCH 1
+#else
+#define TEXT_SEARCH_HAS_X86_DISPATCH 0
+#endif
+
+// You enable instruction sets per function so the rest of the binary stays baseline
+#if defined(__GNUC__) || defined(__clang__)
+#define TEXT_SEARCH_TARGET(instruction_sets) __attribute__((target(instruction_sets)))
+#else
+#define TEXT_SEARCH_TARGET(instruction_sets)
+#endif
+
+// Function to extract the lowercase extension of a file name, or an empty string if it has none
+inline std::string lowercase_file_extension(const std::string& file_path) {
+    // You look for the extension only in the final path component
+    size_t name_position = file_path.find_last_of("/\\");
+    size_t extension_position = file_path.find_last_of(".");
+    if (extension_position == std::string::npos ||
+        (name_position != std::string::npos && extension_position < name_position)) {
+        return std::string();
+    }
+
+    std::string file_extension = file_path.substr(extension_position);
+    std::transform(file_extension.begin(), file_extension.end(),
+                  file_extension.begin(), ::tolower);
+    return file_extension;
+}
+
+// Function to check quietly whether a file name looks like a supported text format
+inline bool is_supported_text_format(const std::string& file_path) {
+    std::string file_extension = lowercase_file_extension(file_path);
+    if (file_extension.empty()) {
+        // You handle files without extensions as potential text files
+        return true;
+    }
+
+    // You define supported text file extensions
+    static const std::vector<std::string> supported_extensions = {
+        ".txt", ".cpp", ".c", ".h", ".hpp", ".py", ".js", ".html", 
+        ".htm", ".css", ".xml", ".json", ".md", ".log", ".cfg", 
+        ".ini", ".yaml", ".yml", ".sql", ".sh", ".bat", ".cs", 
+        ".java", ".php", ".rb", ".go", ".rs", ".swift"
+    };
+
+    // You check if the file extension is in the supported list
+    for (const std::string& supported_ext : supported_extensions) {
+        if (file_extension == supported_ext) {
+            return true; // You confirm supported file format
+        }
+    }
+    return false;
+}
+
+// Size of each block processed by the fused statistics and search pass
+const size_t SCAN_BLOCK_SIZE = 1 << 20;
+
+// Matching line located directly inside the scanned bytes without copying it
+struct content_match_view {
+    size_t line_number;          // 1-based line number of the matching line
+    size_t line_offset;          // Byte offset of the line start within the scanned content
+    std::string_view line_text;  // Line bytes without the trailing newline
+};
+
+// Compact record of one matching line; its text is read back only when the match is displayed
+struct match_record {
+    size_t line_number;   // 1-based line number of the matching line
+    size_t line_offset;   // Byte offset of the line start within the file
+    size_t match_column;  // Byte offset of the first match within the line
+    size_t match_length;  // Length of that match in bytes
+};
+
+// Identity of a file's current contents: which file it is, plus the size and time of its last change
+struct file_identity {
+    unsigned long long device_id = 0;
+    unsigned long long inode_number = 0;
+    unsigned long long file_size = 0;
+    long long modified_nanoseconds = 0;
+
+    bool operator==(const file_identity& other) const {
+        return device_id == other.device_id && inode_number == other.inode_number &&
+               file_size == other.file_size && modified_nanoseconds == other.modified_nanoseconds;
+    }
+    bool operator!=(const file_identity& other) const { return !(*this == other); }
+};
+
+#if TEXT_SEARCH_HAS_MMAP
+// Function to build a file identity from the result of stat or fstat
+inline file_identity make_file_identity(const struct stat& file_status) {
+#if defined(__APPLE__)
+    const struct timespec& modified_time = file_status.st_mtimespec;
+#else
+    const struct timespec& modified_time = file_status.st_mtim;
+#endif
+    file_identity identity;
+    identity.device_id = static_cast<unsigned long long>(file_status.st_dev);
+    identity.inode_number = static_cast<unsigned long long>(file_status.st_ino);
+    identity.file_size = static_cast<unsigned long long>(file_status.st_size);
+    identity.modified_nanoseconds = static_cast<long long>(modified_time.tv_sec) * 1000000000LL + modified_time.tv_nsec;
+    return identity;
+}
+#endif
+
+// Function to read the current identity of a file by path
+// Returns false when the file cannot be examined or the platform has no stable file identity
+inline bool read_file_identity(const std::string& file_path, file_identity& identity) {
+#if TEXT_SEARCH_HAS_MMAP
+    struct stat file_status;
+    if (::stat(file_path.c_str(), &file_status) != 0) {
+        return false;
+    }
+    identity = make_file_identity(file_status);
+    return true;
+#else
+    (void)file_path;
+    (void)identity;
+    return false;
+#endif
+}
+
+// Single open of an input file shared by validation, mapping and streaming
+class input_file_handle {
+public:
+    input_file_handle() = default;
+    input_file_handle(const input_file_handle&) = delete;
+    input_file_handle& operator=(const input_file_handle&) = delete;
+    ~input_file_handle() { close(); }
+
+    // You open the file once and record whether it is a regular file that can be mapped
+    bool open(const std::string& file_path) {
+        close();
+#if TEXT_SEARCH_HAS_MMAP
+        file_descriptor = ::open(file_path.c_str(), O_RDONLY);
+        if (file_descriptor < 0) {
+            return false;
+        }
+
+        struct stat file_status;
+        if (::fstat(file_descriptor, &file_status) == 0 && S_ISREG(file_status.st_mode)) {
+            regular_file = true;
+            regular_file_size = static_cast<size_t>(file_status.st_size);
+            opened_identity = make_file_identity(file_status);
+        }
+        return true;
+#else
+        file_stream.open(file_path, std::ios::binary);
+        return file_stream.is_open();
+#endif
+    }
+
+    // You read the next piece of the file, returning zero once the input is exhausted
+    size_t read_some(char* destination, size_t requested_bytes) {
+#if TEXT_SEARCH_HAS_MMAP
+        while (true) {
+            ssize_t bytes_read = ::read(file_descriptor, destination, requested_bytes);
+            if (bytes_read < 0 && errno == EINTR) {
+                continue;
+            }
+            return bytes_read < 0 ? 0 : static_cast<size_t>(bytes_read);
+        }
+#else
+        file_stream.read(destination, static_cast<std::streamsize>(requested_bytes));
+        return static_cast<size_t>(file_stream.gcount());
+#endif
+    }
+
+    // You release the descriptor or stream if one is open
+    void close() {
+#if TEXT_SEARCH_HAS_MMAP
+        if (file_descriptor >= 0) {
+            ::close(file_descriptor);
+        }
+        file_descriptor = -1;
+#else
+        if (file_stream.is_open()) {
+            file_stream.close();
+        }
+#endif
+        regular_file = false;
+        regular_file_size = 0;
+        opened_identity = file_identity();
+    }
+
+#if TEXT_SEARCH_HAS_MMAP
+    bool is_open() const { return file_descriptor >= 0; }
+    int descriptor() const { return file_descriptor; }
+#else
+    bool is_open() const { return file_stream.is_open(); }
+#endif
+    bool is_regular_file() const { return regular_file; }
+    size_t file_size() const { return regular_file_size; }
+
+    // You identify the opened regular file; the identity stays empty for pipes and on non-POSIX systems
+    const file_identity& identity() const { return opened_identity; }
+
+private:
+#if TEXT_SEARCH_HAS_MMAP
+    int file_descriptor = -1;
+#else
+    std::ifstream file_stream;
+#endif
+    bool regular_file = false;
+    size_t regular_file_size = 0;
+    file_identity opened_identity;
+};
+
+// Read-only memory mapping of a whole file, released when the object goes away
+class mapped_file_region {
+public:
+    mapped_file_region() = default;
+    mapped_file_region(const mapped_file_region&) = delete;
+    mapped_file_region& operator=(const mapped_file_region&) = delete;
+    ~mapped_file_region() { release(); }
+
+    // You map an opened regular file read-only; pipes, devices and non-POSIX systems report failure
+    bool map(const input_file_handle& input_file) {
+        release();
+#if TEXT_SEARCH_HAS_MMAP
+        if (!input_file.is_open() || !input_file.is_regular_file()) {
+            return false;
+        }
+
+        // You treat an empty file as a successful mapping of zero bytes
+        mapped_size = input_file.file_size();
+        if (mapped_size == 0) {
+            is_mapped = true;
+            return true;
+        }
+
+        void* mapping_address = ::mmap(nullptr, mapped_size, PROT_READ, MAP_PRIVATE, input_file.descriptor(), 0);
+        if (mapping_address == MAP_FAILED) {
+            mapped_size = 0;
+            return false;
+        }
+
+        ::madvise(mapping_address, mapped_size, MADV_SEQUENTIAL);
+        mapped_data = static_cast<const char*>(mapping_address);
+        is_mapped = true;
+        return true;
+#else
+        (void)input_file;
+        return false;
+#endif
+    }
+
+    // You unmap the file if a mapping is currently held
+    void release() {
+#if TEXT_SEARCH_HAS_MMAP
+        if (mapped_data != nullptr) {
+            ::munmap(const_cast<char*>(mapped_data), mapped_size);
+        }
+#endif
+        mapped_data = nullptr;
+        mapped_size = 0;
+        is_mapped = false;
+    }
+
+    // You stop read-ahead on a mapping whose blocks will be read selectively
+    void advise_random_access() {
+#if TEXT_SEARCH_HAS_MMAP
+        if (mapped_data != nullptr) {
+            ::madvise(const_cast<char*>(mapped_data), mapped_size, MADV_RANDOM);
+        }
+#endif
+    }
+
+    // You ask for one range to be read in ahead of a scan, starting from its page boundary
+    void advise_range_needed(size_t range_offset, size_t range_size) {
+#if TEXT_SEARCH_HAS_MMAP
+        size_t page_size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+        if (mapped_data != nullptr && page_size > 0 && range_offset < mapped_size) {
+            size_t page_offset = range_offset - range_offset % page_size;
+            size_t advised_size = std::min(range_offset + range_size, mapped_size) - page_offset;
+            ::madvise(const_cast<char*>(mapped_data) + page_offset, advised_size, MADV_WILLNEED);
+        }
+#else
+        (void)range_offset;
+        (void)range_size;
+#endif
+    }
+
+    bool mapped() const { return is_mapped; }
+    const char* data() const { return mapped_data; }
+    size_t size() const { return mapped_size; }
+    std::string_view content() const { return std::string_view(mapped_data, mapped_size); }
+
+private:
+    const char* mapped_data = nullptr;
+    size_t mapped_size = 0;
+    bool is_mapped = false;
+};
+
+// Function to fold a single ASCII byte to lowercase for case-insensitive comparison
+inline unsigned char fold_ascii_case(unsigned char byte_value) {
+    return (byte_value >= 'A' && byte_value <= 'Z') ? static_cast<unsigned char>(byte_value + ('a' - 'A'))
+                                                    : byte_value;
+}
+
+// Function to lowercase the search term once per search instead of once per line
+inline std::string fold_search_term(const std::string& search_term) {
+    std::string folded_term = search_term;
+    for (char& term_character : folded_term) {
+        term_character = static_cast<char>(fold_ascii_case(static_cast<unsigned char>(term_character)));
+    }
+    return folded_term;
+}
+
+// Function to compare a candidate with the lowercase term while folding the candidate's case
+inline bool folded_bytes_equal(const char* candidate, const char* folded_term, size_t compare_length) {
+    for (size_t byte_index = 0; byte_index < compare_length; byte_index++) {
+        if (fold_ascii_case(static_cast<unsigned char>(candidate[byte_index])) !=
+            static_cast<unsigned char>(folded_term[byte_index])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Function to locate a lowercase term one byte at a time while ignoring case
+inline const char* find_case_insensitive_scalar(const char* range_begin, const char* range_end,
+                                         const std::string& folded_term) {
+    size_t term_length = folded_term.size();
+    if (term_length == 0 || static_cast<size_t>(range_end - range_begin) < term_length) {
+        return nullptr;
+    }
+
+    // You compare bytes in place so no lowercase copy of the content is ever built
+    const unsigned char first_term_byte = static_cast<unsigned char>(folded_term[0]);
+    const char* last_candidate = range_end - term_length;
+    for (const char* candidate = range_begin; candidate <= last_candidate; ++candidate) {
+        if (fold_ascii_case(static_cast<unsigned char>(*candidate)) == first_term_byte &&
+            folded_bytes_equal(candidate + 1, folded_term.data() + 1, term_length - 1)) {
+            return candidate;
+        }
+    }
+
+    return nullptr;
+}
+
+#if TEXT_SEARCH_HAS_SSE2
+// Function to return the index of the lowest set bit of a non-zero mask
+inline unsigned lowest_set_bit(unsigned bit_mask) {
+#if defined(_MSC_VER)
+    unsigned long bit_index;
+    _BitScanForward(&bit_index, bit_mask);
+    return static_cast<unsigned>(bit_index);
+#else
+    return static_cast<unsigned>(__builtin_ctz(bit_mask));
+#endif
+}
+
+// Function to return the index of the lowest set bit of a non-zero 64-bit mask
+inline unsigned lowest_set_bit_64(unsigned long long bit_mask) {
+#if defined(_MSC_VER)
+    unsigned long bit_index;
+    _BitScanForward64(&bit_index, bit_mask);
+    return static_cast<unsigned>(bit_index);
+#else
+    return static_cast<unsigned>(__builtin_ctzll(bit_mask));
+#endif
+}
+
+// Function to lowercase sixteen ASCII bytes inside a register
+inline __m128i fold_ascii_case_sse2(__m128i byte_block) {
+    // You shift 'A'..'Z' onto the bottom of the signed range so one compare finds them
+    const __m128i shifted_block = _mm_add_epi8(byte_block, _mm_set1_epi8(static_cast<char>(0x80 - 'A')));
+    const __m128i uppercase_mask = _mm_cmplt_epi8(shifted_block, _mm_set1_epi8(static_cast<char>(-128 + 26)));
+    return _mm_or_si128(byte_block, _mm_and_si128(uppercase_mask, _mm_set1_epi8(0x20)));
+}
+
+// Function to locate a lowercase term sixteen candidates at a time using SSE2
+inline const char* find_case_insensitive_sse2(const char* range_begin, const char* range_end,
+                                       const std::string& folded_term) {
+    size_t term_length = folded_term.size();
+    if (term_length == 0 || static_cast<size_t>(range_end - range_begin) < term_length) {
+        return nullptr;
+    }
+
+    // You filter candidates on the folded first and last term bytes before verifying the middle
+    const __m128i first_term_bytes = _mm_set1_epi8(folded_term[0]);
+    const __m128i last_term_bytes = _mm_set1_epi8(folded_term[term_length - 1]);
+    const char* last_candidate = range_end - term_length;
+    const char* candidate_block = range_begin;
+
+    for (; candidate_block + 16 <= last_candidate + 1; candidate_block += 16) {
+        const __m128i first_block = fold_ascii_case_sse2(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(candidate_block)));
+        const __m128i last_block = fold_ascii_case_sse2(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(candidate_block + term_length - 1)));
+        unsigned candidate_mask = static_cast<unsigned>(_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(first_block, first_term_bytes),
+                          _mm_cmpeq_epi8(last_block, last_term_bytes))));
+
+        while (candidate_mask != 0) {
+            const char* candidate = candidate_block + lowest_set_bit(candidate_mask);
+            if (term_length <= 2 || folded_bytes_equal(candidate + 1, folded_term.data() + 1, term_length - 2)) {
+                return candidate;
+            }
+            candidate_mask &= candidate_mask - 1;
+        }
+    }
+
+    // You finish the last few candidates that do not fill a whole register
+    return find_case_insensitive_scalar(candidate_block, range_end, folded_term);
+}
+#endif
+
+#if TEXT_SEARCH_HAS_X86_DISPATCH
+// Function to lowercase thirty-two ASCII bytes inside a register
+TEXT_SEARCH_TARGET("avx2")
+inline __m256i fold_ascii_case_avx2(__m256i byte_block) {
+    const __m256i shifted_block = _mm256_add_epi8(byte_block, _mm256_set1_epi8(static_cast<char>(0x80 - 'A')));
+    const __m256i uppercase_mask = _mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(-128 + 26)), shifted_block);
+    return _mm256_or_si256(byte_block, _mm256_and_si256(uppercase_mask, _mm256_set1_epi8(0x20)));
+}
+
+// Function to locate a lowercase term thirty-two candidates at a time using AVX2
+TEXT_SEARCH_TARGET("avx2")
+inline const char* find_case_insensitive_avx2(const char* range_begin, const char* range_end,
+                                       const std::string& folded_term) {
+    size_t term_length = folded_term.size();
+    if (term_length == 0 || static_cast<size_t>(range_end - range_begin) < term_length) {
+        return nullptr;
+    }
+
+    const __m256i first_term_bytes = _mm256_set1_epi8(folded_term[0]);
+    const __m256i last_term_bytes = _mm256_set1_epi8(folded_term[term_length - 1]);
+    const char* last_candidate = range_end - term_length;
+    const char* candidate_block = range_begin;
+
+    for (; candidate_block + 32 <= last_candidate + 1; candidate_block += 32) {
+        const __m256i first_block = fold_ascii_case_avx2(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(candidate_block)));
+        const __m256i last_block = fold_ascii_case_avx2(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(candidate_block + term_length - 1)));
+        unsigned candidate_mask = static_cast<unsigned>(_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(first_block, first_term_bytes),
+                             _mm256_cmpeq_epi8(last_block, last_term_bytes))));
+
+        while (candidate_mask != 0) {
+            const char* candidate = candidate_block + lowest_set_bit(candidate_mask);
+            if (term_length <= 2 || folded_bytes_equal(candidate + 1, folded_term.data() + 1, term_length - 2)) {
+                return candidate;
+            }
+            candidate_mask &= candidate_mask - 1;
+        }
+    }
+
+    // You let the SSE2 kernel finish the candidates that do not fill a whole register
+    return find_case_insensitive_sse2(candidate_block, range_end, folded_term);
+}
+
+// Function to locate a lowercase term sixty-four candidates at a time using AVX-512BW
+TEXT_SEARCH_TARGET("avx512f,avx512bw")
+inline const char* find_case_insensitive_avx512(const char* range_begin, const char* range_end,
+                                         const std::string& folded_term) {
+    size_t term_length = folded_term.size();
+    if (term_length == 0 || static_cast<size_t>(range_end - range_begin) < term_length) {
+        return nullptr;
+    }
+
+    // You fold case with mask registers: subtract 'A' and add 0x20 wherever the byte was a capital
+    const __m512i uppercase_base = _mm512_set1_epi8('A');
+    const __m512i uppercase_span = _mm512_set1_epi8('Z' - 'A');
+    const __m512i case_bit = _mm512_set1_epi8(0x20);
+    const __m512i first_term_bytes = _mm512_set1_epi8(folded_term[0]);
+    const __m512i last_term_bytes = _mm512_set1_epi8(folded_term[term_length - 1]);
+    const char* last_candidate = range_end - term_length;
+    const char* candidate_block = range_begin;
+
+    for (; candidate_block + 64 <= last_candidate + 1; candidate_block += 64) {
+        const __m512i first_block = _mm512_loadu_si512(candidate_block);
+        const __m512i last_block = _mm512_loadu_si512(candidate_block + term_length - 1);
+        const __mmask64 first_uppercase = _mm512_cmple_epu8_mask(_mm512_sub_epi8(first_block, uppercase_base), uppercase_span);
+        const __mmask64 last_uppercase = _mm512_cmple_epu8_mask(_mm512_sub_epi8(last_block, uppercase_base), uppercase_span);
+        unsigned long long candidate_mask =
+            _mm512_cmpeq_epi8_mask(_mm512_mask_add_epi8(first_block, first_uppercase, first_block, case_bit), first_term_bytes) &
+            _mm512_cmpeq_epi8_mask(_mm512_mask_add_epi8(last_block, last_uppercase, last_block, case_bit), last_term_bytes);
+
+        while (candidate_mask != 0) {
+            const char* candidate = candidate_block + lowest_set_bit_64(candidate_mask);
+            if (term_length <= 2 || folded_bytes_equal(candidate + 1, folded_term.data() + 1, term_length - 2)) {
+                return candidate;
+            }
+            candidate_mask &= candidate_mask - 1;
+        }
+    }
+
+    return find_case_insensitive_avx2(candidate_block, range_end, folded_term);
+}
+
+// Function to ask the processor and operating system which vector extensions are usable
+inline bool cpu_supports_extension(const char* extension_name) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int cpu_registers[4];
+    __cpuid(cpu_registers, 0);
+    if (cpu_registers[0] < 7) {
+        return false;
+    }
+
+    // You require the OS to save the wide registers before trusting the cpuid feature bits
+    __cpuid(cpu_registers, 1);
+    bool os_saves_registers = (cpu_registers[2] & (1 << 27)) != 0;
+    unsigned long long enabled_state = os_saves_registers ? _xgetbv(0) : 0;
+    __cpuidex(cpu_registers, 7, 0);
+
+    if (std::strcmp(extension_name, "avx2") == 0) {
+        return (enabled_state & 0x6) == 0x6 && (cpu_registers[1] & (1 << 5)) != 0;
+    }
+    if (std::strcmp(extension_name, "avx512bw") == 0) {
+        return (enabled_state & 0xE6) == 0xE6 && (cpu_registers[1] & (1 << 16)) != 0 &&
+               (cpu_registers[1] & (1 << 30)) != 0;
+    }
+    return false;
+#else
+    __builtin_cpu_init();
+    if (std::strcmp(extension_name, "avx2") == 0) {
+        return __builtin_cpu_supports("avx2");
+    }
+    if (std::strcmp(extension_name, "avx512bw") == 0) {
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+    }
+    return false;
+#endif
+}
+#endif
+
+// Signature shared by every case-insensitive matching kernel
+typedef const char* (*case_insensitive_finder)(const char* range_begin, const char* range_end,
+                                               const std::string& folded_term);
+
+// Matching kernel that can be selected at startup
+struct matching_kernel_entry {
+    const char* kernel_name;
+    case_insensitive_finder kernel_finder;
+    bool kernel_supported;
+};
+
+// Function to list the kernels compiled into this binary, slowest first, with runtime support flags
+inline const std::vector<matching_kernel_entry>& available_matching_kernels() {
+    static const std::vector<matching_kernel_entry> matching_kernels = {
+        {"scalar", find_case_insensitive_scalar, true},
+#if TEXT_SEARCH_HAS_SSE2
+        {"sse2", find_case_insensitive_sse2, true},
+#endif
+#if TEXT_SEARCH_HAS_X86_DISPATCH
+        {"avx2", find_case_insensitive_avx2, cpu_supports_extension("avx2")},
+        {"avx512", find_case_insensitive_avx512, cpu_supports_extension("avx512bw")},
+#endif
+    };
+    return matching_kernels;
+}
+
+// Function to pick the fastest kernel this processor supports
+inline const matching_kernel_entry& best_matching_kernel() {
+    const std::vector<matching_kernel_entry>& matching_kernels = available_matching_kernels();
+    for (size_t kernel_index = matching_kernels.size(); kernel_index-- > 0;) {
+        if (matching_kernels[kernel_index].kernel_supported) {
+            return matching_kernels[kernel_index];
+        }
+    }
+    return matching_kernels.front();
+}
+
+// Kernel used by every search, chosen from cpuid the first time it is needed
+inline const matching_kernel_entry*& active_matching_kernel() {
+    static const matching_kernel_entry* selected_kernel = &best_matching_kernel();
+    return selected_kernel;
+}
+
+// Function to force a specific kernel by name, or the best one for "auto"
+// Returns false with a description in error_message when the kernel cannot be used
+inline bool select_matching_kernel(const std::string& kernel_name, std::string& error_message) {
+    if (kernel_name == "auto") {
+        active_matching_kernel() = &best_matching_kernel();
+        return true;
+    }
+
+    for (const matching_kernel_entry& kernel_entry : available_matching_kernels()) {
+        if (kernel_name == kernel_entry.kernel_name) {
+            if (!kernel_entry.kernel_supported) {
+                error_message = "This processor does not support the '" + kernel_name + "' kernel";
+                return false;
+            }
+            active_matching_kernel() = &kernel_entry;
+            return true;
+        }
+    }
+
+    error_message = "Unknown matching kernel '" + kernel_name + "'";
+    return false;
+}
+
+// Function to locate a lowercase term inside a byte range while ignoring case
+inline const char* find_case_insensitive(const char* range_begin, const char* range_end,
+                                         const std::string& folded_term) {
+    return active_matching_kernel()->kernel_finder(range_begin, range_end, folded_term);
+}
+
+// Function to find the end of the line that contains the given position
+inline const char* find_line_end(const char* position, const char* range_end) {
+    const void* newline_position = std::memchr(position, '\n', static_cast<size_t>(range_end - position));
+    return newline_position ? static_cast<const char*>(newline_position) : range_end;
+}
+
+// Function to find the start of the line that contains the given position
+inline const char* find_line_begin(const char* range_begin, const char* position) {
+    while (position > range_begin && position[-1] != '\n') {
+        --position;
+    }
+    return position;
+}
+
+// Function to scan a block of lines and report each line the matcher accepts
+// The matcher's find returns a position inside the first accepted line of a range that starts at a line start
+// Returns the line number that follows the last newline of the block
+template <typename LineMatcher, typename MatchVisitor>
+size_t scan_lines_for_matches(const char* block_begin, const char* block_end, size_t first_line_number,
+                              const LineMatcher& line_matcher, MatchVisitor&& on_match) {
+    const char* scan_cursor = block_begin;
+    size_t line_number = first_line_number;
+
+    // You jump straight to each candidate instead of splitting the block into lines
+    while (scan_cursor < block_end) {
+        const char* match_position = line_matcher.find(scan_cursor, block_end);
+        if (match_position == nullptr) {
+            break;
+        }
+
+        // You count the skipped newlines so line numbers stay exact
+        const char* line_begin = scan_cursor;
+        while (const void* newline_position =
+                   std::memchr(line_begin, '\n', static_cast<size_t>(match_position - line_begin))) {
+            line_begin = static_cast<const char*>(newline_position) + 1;
+            line_number++;
+        }
+
+        const char* line_end = find_line_end(match_position, block_end);
+        on_match(line_number, line_begin, line_end);
+
+        if (line_end == block_end) {
+            return line_number; // You stop at an unterminated final line
+        }
+        scan_cursor = line_end + 1;
+        line_number++;
+    }
+
+    // You account for the newlines after the last match
+    while (scan_cursor < block_end) {
+        const void* newline_position =
+            std::memchr(scan_cursor, '\n', static_cast<size_t>(block_end - scan_cursor));
+        if (newline_position == nullptr) {
+            break;
+        }
+        scan_cursor = static_cast<const char*>(newline_position) + 1;
+        line_number++;
+    }
+    return line_number;
+}
+
+// Case-insensitive literal search term matched with the active kernel
+struct literal_term_matcher {
+    std::string folded_term;
+
+    const char* find(const char* range_begin, const char* range_end) const {
+        return find_case_insensitive(range_begin, range_end, folded_term);
+    }
+
+    // You add no labels because a single term needs no explanation
+    std::string describe_line_matches(const char*, const char*) const { return std::string(); }
+
+    // You report where the term first occurs on a line the scan accepted
+    void locate_line_match(const char* line_begin, const char* line_end, size_t& match_column,
+                           size_t& match_length) const {
+        const char* match_position = find_case_insensitive(line_begin, line_end, folded_term);
+        match_column = match_position != nullptr ? static_cast<size_t>(match_position - line_begin) : 0;
+        match_length = match_position != nullptr ? folded_term.size() : 0;
+    }
+};
+
+// Function to return every line of an in-memory buffer that contains the term as zero-copy views
+inline std::vector<content_match_view> find_matching_lines(std::string_view content, const std::string& search_term) {
+    std::vector<content_match_view> line_matches;
+    const literal_term_matcher term_matcher{fold_search_term(search_term)};
+    const char* content_begin = content.data();
+
+    scan_lines_for_matches(content_begin, content_begin + content.size(), 1, term_matcher,
+                           [&](size_t line_number, const char* line_begin, const char* line_end) {
+                               line_matches.push_back({line_number,
+                                                       static_cast<size_t>(line_begin - content_begin),
+                                                       std::string_view(line_begin, static_cast<size_t>(line_end - line_begin))});
+                           });
+    return line_matches;
+}
+
+// Function to estimate how often a folded byte occurs in typical text, from 255 for spaces down to 10 for rare bytes
+// This is a fixed guess, not a measurement of the files searched: letters follow a hard-coded table of English
+// letter frequencies, so terms in other languages or in code may be checked in a worse order, never a wrong one
+inline unsigned estimated_byte_frequency(unsigned char folded_byte) {
+    static const char letters_by_frequency[] = "etaoinshrdlcumwfgypbvkjxqz";
+    if (folded_byte == ' ') {
+        return 255;
+    }
+    if (folded_byte >= 'a' && folded_byte <= 'z') {
+        size_t letter_rank = static_cast<size_t>(std::strchr(letters_by_frequency, folded_byte) - letters_by_frequency);
+        return static_cast<unsigned>(200 - letter_rank * 6);
+    }
+    if (folded_byte >= '0' && folded_byte <= '9') {
+        return 60;
+    }
+    return std::strchr(".,;:_-()=/'\"", folded_byte) != nullptr && folded_byte != '\0' ? 40 : 10;
+}
+
+// Function to score how rarely a folded term should occur; longer terms made of rarer bytes score higher
+inline unsigned estimated_term_rarity(const std::string& folded_term) {
+    unsigned rarity_score = 0;
+    for (unsigned char term_byte : folded_term) {
+        rarity_score += 256 - estimated_byte_frequency(term_byte);
+    }
+    return rarity_score;
+}
+
+// Matcher for lines holding every one of several terms, in any order
+// The term estimated rarest by estimated_term_rarity drives the SIMD scan, and the others are checked in the same
+// order only on the lines it finds
+class all_terms_matcher {
+public:
+    // You fold the terms, drop repeats and order them from rarest to most common
+    void compile(const std::vector<std::string>& search_terms) {
+        folded_terms.clear();
+        for (const std::string& search_term : search_terms) {
+            folded_terms.push_back(fold_search_term(search_term));
+        }
+        std::sort(folded_terms.begin(), folded_terms.end());
+        folded_terms.erase(std::unique(folded_terms.begin(), folded_terms.end()), folded_terms.end());
+        std::stable_sort(folded_terms.begin(), folded_terms.end(), [](const std::string& left, const std::string& right) {
+            return estimated_term_rarity(left) > estimated_term_rarity(right);
+        });
+    }
+
+    // You return a position on the first line that holds every term; a matcher without terms finds nothing
+    const char* find(const char* range_begin, const char* range_end) const {
+        if (folded_terms.empty()) {
+            return nullptr;
+        }
+        const char* scan_cursor = range_begin;
+        while (scan_cursor < range_end) {
+            const char* candidate = find_case_insensitive(scan_cursor, range_end, folded_terms[0]);
+            if (candidate == nullptr) {
+                return nullptr;
+            }
+
+            const char* line_end = find_line_end(candidate, range_end);
+            if (line_holds_other_terms(find_line_begin(scan_cursor, candidate), line_end)) {
+                return candidate;
+            }
+            if (line_end == range_end) {
+                return nullptr;
+            }
+            scan_cursor = line_end + 1;
+        }
+        return nullptr;
+    }
+
+    // You add no labels because every matching line holds all the terms
+    std::string describe_line_matches(const char*, const char*) const { return std::string(); }
+
+    // You report the leftmost occurrence of any term on a line the scan accepted
+    void locate_line_match(const char* line_begin, const char* line_end, size_t& match_column,
+                           size_t& match_length) const {
+        const char* leftmost_match = nullptr;
+        match_column = 0;
+        match_length = 0;
+        for (const std::string& folded_term : folded_terms) {
+            const char* match_position = find_case_insensitive(line_begin, line_end, folded_term);
+            if (match_position != nullptr && (leftmost_match == nullptr || match_position < leftmost_match)) {
+                leftmost_match = match_position;
+                match_column = static_cast<size_t>(match_position - line_begin);
+                match_length = folded_term.size();
+            }
+        }
+    }
+
+    size_t term_count() const { return folded_terms.size(); }
+    const std::string& folded_term(size_t term_index) const { return folded_terms[term_index]; }
+
+private:
+    // You stop at the first missing term; the rarest ones come first, so most lines are rejected after one check
+    bool line_holds_other_terms(const char* line_begin, const char* line_end) const {
+        for (size_t term_index = 1; term_index < folded_terms.size(); term_index++) {
+            if (find_case_insensitive(line_begin, line_end, folded_terms[term_index]) == nullptr) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::vector<std::string> folded_terms;
+};
+
+// Case-insensitive Aho-Corasick automaton over many terms, stored as a dense DFA table
+class aho_corasick_automaton {
+public:
+    // You build the trie, failure links and full transition table for the given terms
+    void build(const std::vector<std::string>& search_terms) {
+        pattern_texts.clear();
+        std::vector<std::string> folded_patterns;
+        for (const std::string& search_term : search_terms) {
+            std::string folded_pattern = fold_search_term(search_term);
+            if (folded_pattern.empty() ||
+                std::find(folded_patterns.begin(), folded_patterns.end(), folded_pattern) != folded_patterns.end()) {
+                continue; // You drop empty and duplicate terms
+            }
+            folded_patterns.push_back(folded_pattern);
+            pattern_texts.push_back(search_term);
+        }
+
+        // You compress the alphabet to the bytes that occur in a term; every other byte shares class zero
+        std::fill(std::begin(byte_classes), std::end(byte_classes), static_cast<unsigned char>(0));
+        class_count = 1;
+        for (const std::string& folded_pattern : folded_patterns) {
+            for (char pattern_character : folded_pattern) {
+                unsigned char pattern_byte = static_cast<unsigned char>(pattern_character);
+                if (byte_classes[pattern_byte] == 0) {
+                    byte_classes[pattern_byte] = static_cast<unsigned char>(class_count++);
+                }
+            }
+        }
+        for (unsigned byte_value = 'A'; byte_value <= 'Z'; byte_value++) {
+            byte_classes[byte_value] = byte_classes[fold_ascii_case(static_cast<unsigned char>(byte_value))];
+        }
+
+        // You insert every term into a trie whose missing edges are marked with -1
+        std::vector<long long> goto_table(class_count, -1);
+        std::vector<std::vector<unsigned>> state_patterns(1);
+        for (size_t pattern_index = 0; pattern_index < folded_patterns.size(); pattern_index++) {
+            size_t state = 0;
+            for (char pattern_character : folded_patterns[pattern_index]) {
+                size_t symbol_class = byte_classes[static_cast<unsigned char>(pattern_character)];
+                if (goto_table[state * class_count + symbol_class] < 0) {
+                    goto_table[state * class_count + symbol_class] = static_cast<long long>(state_patterns.size());
+                    goto_table.resize(goto_table.size() + class_count, -1);
+                    state_patterns.emplace_back();
+                }
+                state = static_cast<size_t>(goto_table[state * class_count + symbol_class]);
+            }
+            state_patterns[state].push_back(static_cast<unsigned>(pattern_index));
+        }
+
+        // You complete the table breadth-first so every state has a transition for every class
+        size_t state_count = state_patterns.size();
+        std::vector<size_t> failure_links(state_count, 0);
+        std::vector<size_t> breadth_first_order;
+        breadth_first_order.reserve(state_count);
+        for (size_t symbol_class = 0; symbol_class < class_count; symbol_class++) {
+            long long& root_edge = goto_table[symbol_class];
+            if (root_edge < 0) {
+                root_edge = 0;
+            } else {
+                breadth_first_order.push_back(static_cast<size_t>(root_edge));
+            }
+        }
+        for (size_t queue_index = 0; queue_index < breadth_first_order.size(); queue_index++) {
+            size_t state = breadth_first_order[queue_index];
+            const std::vector<unsigned>& inherited_patterns = state_patterns[failure_links[state]];
+            state_patterns[state].insert(state_patterns[state].end(), inherited_patterns.begin(), inherited_patterns.end());
+
+            for (size_t symbol_class = 0; symbol_class < class_count; symbol_class++) {
+                long long& edge = goto_table[state * class_count + symbol_class];
+                size_t fallback_state = static_cast<size_t>(goto_table[failure_links[state] * class_count + symbol_class]);
+                if (edge < 0) {
+                    edge = static_cast<long long>(fallback_state);
+                } else {
+                    failure_links[static_cast<size_t>(edge)] = fallback_state;
+                    breadth_first_order.push_back(static_cast<size_t>(edge));
+                }
+            }
+        }
+
+        // You store each edge as the target row offset shifted left with the accepting flag in bit zero
+        transition_table.assign(state_count * class_count, 0);
+        for (size_t table_index = 0; table_index < transition_table.size(); table_index++) {
+            size_t target_state = static_cast<size_t>(goto_table[table_index]);
+            transition_table[table_index] = static_cast<unsigned>(
+                ((target_state * class_count) << 1) | (state_patterns[target_state].empty() ? 0u : 1u));
+        }
+
+        output_offsets.assign(1, 0);
+        output_patterns.clear();
+        for (const std::vector<unsigned>& reported_patterns : state_patterns) {
+            output_patterns.insert(output_patterns.end(), reported_patterns.begin(), reported_patterns.end());
+            output_offsets.push_back(static_cast<unsigned>(output_patterns.size()));
+        }
+    }
+
+    // You run the automaton until the first accepting state and return where that term ends
+    const char* find(const char* range_begin, const char* range_end) const {
+        if (pattern_texts.empty()) {
+            return nullptr;
+        }
+        const unsigned* transitions = transition_table.data();
+        unsigned current_edge = 0;
+        for (const char* position = range_begin; position < range_end; ++position) {
+            current_edge = transitions[(current_edge >> 1) + byte_classes[static_cast<unsigned char>(*position)]];
+            if (current_edge & 1u) {
+                return position;
+            }
+        }
+        return nullptr;
+    }
+
+    // You list every distinct term found on a matching line in term order
+    std::string describe_line_matches(const char* line_begin, const char* line_end) const {
+        std::vector<unsigned> found_patterns;
+        unsigned current_edge = 0;
+        for (const char* position = line_begin; position < line_end; ++position) {
+            current_edge = transition_table[(current_edge >> 1) + byte_classes[static_cast<unsigned char>(*position)]];
+            if (current_edge & 1u) {
+                size_t state = (current_edge >> 1) / class_count;
+                found_patterns.insert(found_patterns.end(), output_patterns.begin() + output_offsets[state],
+                                      output_patterns.begin() + output_offsets[state + 1]);
+            }
+        }
+        std::sort(found_patterns.begin(), found_patterns.end());
+        found_patterns.erase(std::unique(found_patterns.begin(), found_patterns.end()), found_patterns.end());
+
+        std::string match_labels;
+        for (unsigned pattern_index : found_patterns) {
+            if (!match_labels.empty()) {
+                match_labels += ", ";
+            }
+            match_labels += pattern_texts[pattern_index];
+        }
+        return match_labels;
+    }
+
+    // You report the term that ends first on the line, preferring the longest term ending there
+    void locate_line_match(const char* line_begin, const char* line_end, size_t& match_column,
+                           size_t& match_length) const {
+        match_column = 0;
+        match_length = 0;
+        const char* match_end = find(line_begin, line_end);
+        if (match_end == nullptr) {
+            return;
+        }
+
+        unsigned current_edge = 0;
+        for (const char* position = line_begin; position <= match_end; ++position) {
+            current_edge = transition_table[(current_edge >> 1) + byte_classes[static_cast<unsigned char>(*position)]];
+        }
+        size_t state = (current_edge >> 1) / class_count;
+        for (unsigned output_index = output_offsets[state]; output_index < output_offsets[state + 1]; output_index++) {
+            match_length = std::max(match_length, pattern_texts[output_patterns[output_index]].size());
+        }
+        match_column = static_cast<size_t>(match_end + 1 - line_begin) - match_length;
+    }
+
+    size_t pattern_count() const { return pattern_texts.size(); }
+    const std::string& pattern_text(size_t pattern_index) const { return pattern_texts[pattern_index]; }
+
+private:
+    unsigned char byte_classes[256] = {};
+    size_t class_count = 1;
+    std::vector<unsigned> transition_table;
+    std::vector<unsigned> output_offsets;
+    std::vector<unsigned> output_patterns;
+    std::vector<std::string> pattern_texts;
+};
+
+// Line, word and character totals gathered during the search pass
+struct file_content_statistics {
+    size_t line_count = 0;
+    size_t word_count = 0;
+    size_t character_count = 0;
+    bool inside_word = false;  // Scan state carried across block boundaries
+    bool inside_line = false;
+};
+
+// Function to check whether a byte separates words the way stream extraction does
+inline bool is_word_separator(unsigned char byte_value) {
+    return byte_value == ' ' || (byte_value >= '\t' && byte_value <= '\r');
+}
+
+// Function to add the statistics of one block of file content to the running totals
+inline void accumulate_content_statistics(const char* block_begin, const char* block_end,
+                                   file_content_statistics& file_statistics) {
+    size_t line_count = file_statistics.line_count;
+    size_t word_count = file_statistics.word_count;
+    size_t character_count = file_statistics.character_count;
+    bool inside_word = file_statistics.inside_word;
+    bool inside_line = file_statistics.inside_line;
+
+    // You count every byte once while the block is still hot in cache
+    for (const char* position = block_begin; position < block_end; ++position) {
+        unsigned char byte_value = static_cast<unsigned char>(*position);
+        if (byte_value == '\n') {
+            line_count++;
+            inside_line = false;
+        } else {
+            character_count++;
+            inside_line = true;
+        }
+
+        bool separator = is_word_separator(byte_value);
+        if (!separator && !inside_word) {
+            word_count++;
+        }
+        inside_word = !separator;
+    }
+
+    file_statistics.line_count = line_count;
+    file_statistics.word_count = word_count;
+    file_statistics.character_count = character_count;
+    file_statistics.inside_word = inside_word;
+    file_statistics.inside_line = inside_line;
+}
+
+// Function to close the statistics once the final block has been seen
+inline void finish_content_statistics(file_content_statistics& file_statistics) {
+    if (file_statistics.inside_line) {
+        file_statistics.line_count++; // You count an unterminated final line
+        file_statistics.inside_line = false;
+    }
+}
+
+// Boolean condition over folded byte trigrams that every matching line satisfies, used to consult a trigram index
+// A plan that matches everything tells the index it cannot rule out any block
+struct trigram_plan {
+    enum plan_kind { match_all, trigram_leaf, all_of, any_of };
+
+    plan_kind kind = match_all;
+    uint32_t trigram = 0;
+    std::vector<trigram_plan> children;
+};
+
+// Function to pack three folded bytes into the key a trigram index uses
+inline uint32_t pack_trigram(unsigned char first_byte, unsigned char second_byte, unsigned char third_byte) {
+    return (static_cast<uint32_t>(first_byte) << 16) | (static_cast<uint32_t>(second_byte) << 8) | third_byte;
+}
+
+// Function to require every child plan, dropping children that rule nothing out
+inline trigram_plan plan_all_of(std::vector<trigram_plan> child_plans) {
+    trigram_plan combined_plan;
+    for (trigram_plan& child_plan : child_plans) {
+        if (child_plan.kind == trigram_plan::all_of) {
+            for (trigram_plan& grandchild_plan : child_plan.children) {
+                combined_plan.children.push_back(std::move(grandchild_plan));
+            }
+        } else if (child_plan.kind != trigram_plan::match_all) {
+            combined_plan.children.push_back(std::move(child_plan));
+        }
+    }
+    if (combined_plan.children.size() == 1) {
+        return std::move(combined_plan.children[0]);
+    }
+    combined_plan.kind = combined_plan.children.empty() ? trigram_plan::match_all : trigram_plan::all_of;
+    return combined_plan;
+}
+
+// Function to accept any child plan; one child that rules nothing out makes the whole plan rule nothing out
+inline trigram_plan plan_any_of(std::vector<trigram_plan> child_plans) {
+    trigram_plan combined_plan;
+    for (trigram_plan& child_plan : child_plans) {
+        if (child_plan.kind == trigram_plan::match_all) {
+            return trigram_plan();
+        }
+        combined_plan.children.push_back(std::move(child_plan));
+    }
+    if (combined_plan.children.size() == 1) {
+        return std::move(combined_plan.children[0]);
+    }
+    combined_plan.kind = combined_plan.children.empty() ? trigram_plan::match_all : trigram_plan::any_of;
+    return combined_plan;
+}
+
+// Function to require every trigram of a lowercase literal; literals under three bytes rule nothing out
+inline trigram_plan plan_for_literal(const std::string& folded_literal) {
+    std::vector<trigram_plan> trigram_leaves;
+    for (size_t literal_index = 0; literal_index + 3 <= folded_literal.size(); literal_index++) {
+        trigram_plan trigram_leaf;
+        trigram_leaf.kind = trigram_plan::trigram_leaf;
+        trigram_leaf.trigram = pack_trigram(static_cast<unsigned char>(folded_literal[literal_index]),
+                                            static_cast<unsigned char>(folded_literal[literal_index + 1]),
+                                            static_cast<unsigned char>(folded_literal[literal_index + 2]));
+        trigram_leaves.push_back(trigram_leaf);
+    }
+    return plan_all_of(std::move(trigram_leaves));
+}
+
+// Function to accept any of several lowercase literals
+inline trigram_plan plan_for_any_literal(const std::vector<std::string>& folded_literals) {
+    std::vector<trigram_plan> literal_plans;
+    for (const std::string& folded_literal : folded_literals) {
+        literal_plans.push_back(plan_for_literal(folded_literal));
+    }
+    return plan_any_of(std::move(literal_plans));
+}
+
+// Largest NFA a regular expression may compile to, which also bounds {m,n} expansion
+const size_t MAX_REGEX_PROGRAM_SIZE = 20000;
+
+// Largest count allowed in a {m,n} repeat
+const int MAX_REGEX_REPEAT_COUNT = 1000;
+
+// Deepest nesting of groups a regular expression may use, which bounds the parser's recursion
+// The compiler's recursion follows the syntax tree, which may be a few levels deeper per group
+const int MAX_REGEX_NESTING_DEPTH = 1000;
+const int MAX_REGEX_SYNTAX_DEPTH = 4 * MAX_REGEX_NESTING_DEPTH;
+
+// Most alternative literals a regex prefilter may search for at once
+const size_t MAX_PREFILTER_LITERALS = 64;
+
+// Most DFA states the lazy regex engine caches before it starts over with an empty cache
+const size_t LAZY_DFA_STATE_LIMIT = 4096;
+
+// Regular expression matched line by line with a lazily built, bounded DFA
+// The DFA cache is filled during find, so each thread needs its own copy
+class lazy_dfa_regex {
+public:
+    // You parse the pattern and compile it into a Thompson NFA; the DFA is built while searching
+    bool compile(const std::string& pattern, std::string& error_message) {
+        pattern_text = pattern;
+        parse_position = 0;
+        syntax_nodes.clear();
+        program_nodes.clear();
+        byte_sets.clear();
+
+        root_node = parse_alternation(0, error_message);
+        if (root_node < 0) {
+            return false;
+        }
+        if (parse_position < pattern_text.size()) {
+            error_message = "Unmatched ')' in regular expression";
+            return false;
+        }
+
+        int accept_state = add_program_node(program_node::accept, -1, -1, -1);
+        syntax_too_deep = false;
+        program_start = compile_syntax_node(root_node, accept_state, 0);
+        if (program_nodes.size() > MAX_REGEX_PROGRAM_SIZE) {
+            error_message = "Regular expression is too large";
+            return false;
+        }
+        if (syntax_too_deep) {
+            error_message = "Regular expression is nested too deeply";
+            return false;
+        }
+
+        build_byte_classes();
+        reset_state_cache();
+
+        // You decide empty lines up front because both line edges hold at the same position
+        std::vector<int> empty_line_states;
+        begin_closure_pass();
+        add_closure(program_start, true, true, empty_line_states);
+        empty_line_matches = false;
+        for (int nfa_state : empty_line_states) {
+            empty_line_matches = empty_line_matches || program_nodes[nfa_state].type == program_node::accept;
+        }
+        return true;
+    }
+
+    // You run the DFA over each line in turn and return a position inside the first matching line
+    const char* find(const char* range_begin, const char* range_end) const {
+        if (range_begin < range_end && state_matched[line_start_row / row_stride]) {
+            return range_begin; // You accept every line when the pattern matches the empty string
+        }
+
+        const char* line_begin = range_begin;
+        size_t current_row = line_start_row;
+        for (const char* position = range_begin; position < range_end; ++position) {
+            unsigned char byte_value = static_cast<unsigned char>(*position);
+            if (byte_value == '\n') {
+                bool line_matched = position == line_begin ? empty_line_matches
+                                                           : (line_end_edge(current_row) & 1) != 0;
+                if (line_matched) {
+                    return line_begin;
+                }
+                current_row = line_start_row;
+                line_begin = position + 1;
+                continue;
+            }
+
+            int next_edge = transition_cache[current_row + byte_classes[byte_value]];
+            if (next_edge < 0) {
+                next_edge = compute_transition(current_row, byte_classes[byte_value]);
+            }
+            if (next_edge & 1) {
+                return position;
+            }
+            current_row = static_cast<size_t>(next_edge >> 1);
+        }
+
+        // You check the line end of an unterminated final line
+        if (line_begin < range_end && (line_end_edge(current_row) & 1) != 0) {
+            return line_begin;
+        }
+        return nullptr;
+    }
+
+    // You test whether a single line (without its newline) matches
+    bool line_matches(const char* line_begin, const char* line_end) const {
+        if (line_begin == line_end || state_matched[line_start_row / row_stride]) {
+            return empty_line_matches || state_matched[line_start_row / row_stride];
+        }
+
+        size_t current_row = line_start_row;
+        for (const char* position = line_begin; position < line_end; ++position) {
+            unsigned char byte_class = byte_classes[static_cast<unsigned char>(*position)];
+            int next_edge = transition_cache[current_row + byte_class];
+            if (next_edge < 0) {
+                next_edge = compute_transition(current_row, byte_class);
+            }
+            if (next_edge & 1) {
+                return true;
+            }
+            current_row = static_cast<size_t>(next_edge >> 1);
+        }
+        return (line_end_edge(current_row) & 1) != 0;
+    }
+
+    std::string describe_line_matches(const char*, const char*) const { return std::string(); }
+
+    // You find the leftmost-longest match on a line in one pass of the NFA, tagging each state with its start
+    // Two threads that reach a state together share every future, so only the earlier start is kept; the states
+    // stay ordered by start, which makes that one the first to arrive. Each byte costs at most one step per state
+    void locate_line_match(const char* line_begin, const char* line_end, size_t& match_column,
+                           size_t& match_length) const {
+        size_t line_length = static_cast<size_t>(line_end - line_begin);
+        std::vector<int> current_states;
+        std::vector<size_t> current_starts;
+        std::vector<int> next_states;
+        std::vector<size_t> next_starts;
+        bool found_match = false;
+        match_column = 0;
+        match_length = 0;
+
+        begin_closure_pass();
+        add_closure(program_start, true, line_length == 0, current_states);
+        current_starts.assign(current_states.size(), 0);
+        for (size_t position = 0;; position++) {
+            for (size_t thread_index = 0; thread_index < current_states.size(); thread_index++) {
+                size_t match_start = current_starts[thread_index];
+                if (program_nodes[current_states[thread_index]].type == program_node::accept &&
+                    (!found_match || match_start < match_column ||
+                     (match_start == match_column && position - match_start > match_length))) {
+                    found_match = true;
+                    match_column = match_start; // You keep extending to the longest match from the leftmost start
+                    match_length = position - match_start;
+                }
+            }
+            if (position == line_length) {
+                return;
+            }
+
+            // You step every state over the next byte, dropping threads that started after the best match
+            unsigned char byte_value = static_cast<unsigned char>(line_begin[position]);
+            bool at_line_end = position + 1 == line_length;
+            next_states.clear();
+            next_starts.clear();
+            begin_closure_pass();
+            for (size_t thread_index = 0; thread_index < current_states.size(); thread_index++) {
+                const program_node& node = program_nodes[current_states[thread_index]];
+                if ((found_match && current_starts[thread_index] > match_column) ||
+                    node.type != program_node::byte_set_match || !byte_sets[node.byte_set_index][byte_value]) {
+                    continue;
+                }
+                add_closure(node.next_state, false, at_line_end, next_states);
+                next_starts.resize(next_states.size(), current_starts[thread_index]);
+            }
+            if (!found_match) {
+                add_closure(program_start, false, at_line_end, next_states); // You try a later start last
+                next_starts.resize(next_states.size(), position + 1);
+            }
+            if (next_states.empty()) {
+                return;
+            }
+            current_states.swap(next_states);
+            current_starts.swap(next_starts);
+        }
+    }
+
+    // You report lowercase literals of which every matching line must contain at least one
+    // An empty list means the pattern has no usable required literal
+    std::vector<std::string> required_literals() const {
+        if (root_node < 0) {
+            return std::vector<std::string>();
+        }
+        return analyze_required_literals(root_node);
+    }
+
+    // You derive the trigram condition every matching line satisfies, combining all required pieces
+    trigram_plan index_plan() const {
+        if (root_node < 0) {
+            return trigram_plan();
+        }
+        return analyze_trigram_plan(root_node);
+    }
+
+private:
+    // Parsed pattern element before it is compiled to NFA states
+    struct syntax_node {
+        enum node_kind { byte_set_node, concatenation, alternation, repetition, line_begin, line_end, empty };
+        node_kind kind;
+        int byte_set_index;
+        std::vector<int> children;
+        int minimum_repeats;
+        int maximum_repeats; // -1 means unbounded
+    };
+
+    // NFA state: consumes a byte from a set, branches, asserts a line edge or accepts
+    struct program_node {
+        enum node_type { byte_set_match, split, assert_line_begin, assert_line_end, accept };
+        node_type type;
+        int next_state;
+        int alternative_state;
+        int byte_set_index;
+    };
+
+    typedef std::vector<bool> byte_membership;
+
+    // ---- Parsing ----
+
+    int add_syntax_node(syntax_node::node_kind kind, int byte_set_index = -1) {
+        syntax_nodes.push_back({kind, byte_set_index, {}, 0, 0});
+        return static_cast<int>(syntax_nodes.size() - 1);
+    }
+
+    int add_byte_set(const byte_membership& member_bytes) {
+        byte_sets.push_back(member_bytes);
+        return static_cast<int>(byte_sets.size() - 1);
+    }
+
+    // You make every byte set case-insensitive by adding the other case of each letter
+    static void fold_byte_set(byte_membership& member_bytes) {
+        for (int letter = 'a'; letter <= 'z'; letter++) {
+            bool either_case = member_bytes[letter] || member_bytes[letter - 'a' + 'A'];
+            member_bytes[letter] = either_case;
+            member_bytes[letter - 'a' + 'A'] = either_case;
+        }
+    }
+
+    // You add the bytes of a shorthand class such as \d or \w
+    static bool add_shorthand_class(char class_letter, byte_membership& member_bytes) {
+        byte_membership shorthand_bytes(256, false);
+        char lower_letter = static_cast<char>(fold_ascii_case(static_cast<unsigned char>(class_letter)));
+        if (lower_letter == 'd') {
+            for (int digit = '0'; digit <= '9'; digit++) shorthand_bytes[digit] = true;
+        } else if (lower_letter == 'w') {
+            for (int byte_value = 0; byte_value < 256; byte_value++) {
+                shorthand_bytes[byte_value] = (byte_value >= '0' && byte_value <= '9') ||
+                                              (byte_value >= 'a' && byte_value <= 'z') ||
+                                              (byte_value >= 'A' && byte_value <= 'Z') || byte_value == '_';
+            }
+        } else if (lower_letter == 's') {
+            for (int byte_value = 0; byte_value < 256; byte_value++) {
+                shorthand_bytes[byte_value] = is_word_separator(static_cast<unsigned char>(byte_value));
+            }
+        } else {
+            return false;
+        }
+
+        bool negated = class_letter != lower_letter;
+        for (int byte_value = 0; byte_value < 256; byte_value++) {
+            if (shorthand_bytes[byte_value] != negated) {
+                member_bytes[byte_value] = true;
+            }
+        }
+        return true;
+    }
+
+    // You translate a single escaped character such as \t into its byte value
+    static unsigned char escaped_byte(char escaped_character) {
+        switch (escaped_character) {
+            case 't': return '\t';
+            case 'n': return '\n';
+            case 'r': return '\r';
+            case 'f': return '\f';
+            case 'v': return '\v';
+            default: return static_cast<unsigned char>(escaped_character);
+        }
+    }
+
+    // You pass down how many groups enclose the text being parsed, so a deeply nested pattern is refused
+    // before it can exhaust the stack
+    int parse_alternation(int nesting_depth, std::string& error_message) {
+        std::vector<int> branches;
+        while (true) {
+            int branch = parse_concatenation(nesting_depth, error_message);
+            if (branch < 0) {
+                return -1;
+            }
+            branches.push_back(branch);
+            if (parse_position < pattern_text.size() && pattern_text[parse_position] == '|') {
+                parse_position++;
+                continue;
+            }
+            break;
+        }
+
+        if (branches.size() == 1) {
+            return branches[0];
+        }
+        int alternation_node = add_syntax_node(syntax_node::alternation);
+        syntax_nodes[alternation_node].children = branches;
+        return alternation_node;
+    }
+
+    int parse_concatenation(int nesting_depth, std::string& error_message) {
+        int concatenation_node = add_syntax_node(syntax_node::concatenation);
+        while (parse_position < pattern_text.size() && pattern_text[parse_position] != '|' &&
+               pattern_text[parse_position] != ')') {
+            int atom = parse_repetition(nesting_depth, error_message);
+            if (atom < 0) {
+                return -1;
+            }
+            syntax_nodes[concatenation_node].children.push_back(atom);
+        }
+        return concatenation_node;
+    }
+
+    // You read {m}, {m,} or {m,n}; anything else leaves the brace as a literal
+    bool parse_counted_repeat(int& minimum_repeats, int& maximum_repeats) {
+        size_t cursor = parse_position + 1;
+        auto read_number = [&](int& number_value) {
+            size_t digits_begin = cursor;
+            number_value = 0;
+            while (cursor < pattern_text.size() && pattern_text[cursor] >= '0' && pattern_text[cursor] <= '9' &&
+                   cursor - digits_begin < 6) {
+                number_value = number_value * 10 + (pattern_text[cursor] - '0');
+                cursor++;
+            }
+            return cursor > digits_begin;
+        };
+
+        if (!read_number(minimum_repeats)) {
+            return false;
+        }
+        maximum_repeats = minimum_repeats;
+        if (cursor < pattern_text.size() && pattern_text[cursor] == ',') {
+            cursor++;
+            if (!read_number(maximum_repeats)) {
+                maximum_repeats = -1;
+            }
+        }
+        if (cursor >= pattern_text.size() || pattern_text[cursor] != '}') {
+            return false;
+        }
+        parse_position = cursor + 1;
+        return true;
+    }
+
+    int parse_repetition(int nesting_depth, std::string& error_message) {
+        int atom = parse_atom(nesting_depth, error_message);
+        if (atom < 0) {
+            return -1;
+        }
+
+        while (parse_position < pattern_text.size()) {
+            char quantifier = pattern_text[parse_position];
+            int minimum_repeats = 0;
+            int maximum_repeats = -1;
+            if (quantifier == '*') {
+                parse_position++;
+            } else if (quantifier == '+') {
+                minimum_repeats = 1;
+                parse_position++;
+            } else if (quantifier == '?') {
+                maximum_repeats = 1;
+                parse_position++;
+            } else if (quantifier == '{' && parse_counted_repeat(minimum_repeats, maximum_repeats)) {
+                if (maximum_repeats >= 0 && maximum_repeats < minimum_repeats) {
+                    error_message = "Invalid repeat range in regular expression";
+                    return -1;
+                }
+                if (minimum_repeats > MAX_REGEX_REPEAT_COUNT || maximum_repeats > MAX_REGEX_REPEAT_COUNT) {
+                    error_message = "Repeat count above " + std::to_string(MAX_REGEX_REPEAT_COUNT) +
+                                    " in regular expression";
+                    return -1;
+                }
+            } else {
+                break;
+            }
+
+            // You accept lazy quantifiers; they match the same lines as greedy ones
+            if (parse_position < pattern_text.size() && pattern_text[parse_position] == '?') {
+                parse_position++;
+            }
+
+            int repetition_node = add_syntax_node(syntax_node::repetition);
+            syntax_nodes[repetition_node].children.push_back(atom);
+            syntax_nodes[repetition_node].minimum_repeats = minimum_repeats;
+            syntax_nodes[repetition_node].maximum_repeats = maximum_repeats;
+            atom = repetition_node;
+        }
+        return atom;
+    }
+
+    int parse_bracket_class(std::string& error_message) {
+        byte_membership member_bytes(256, false);
+        bool negated = false;
+        if (parse_position < pattern_text.size() && pattern_text[parse_position] == '^') {
+            negated = true;
+            parse_position++;
+        }
+
+        bool first_item = true;
+        while (parse_position < pattern_text.size() && (pattern_text[parse_position] != ']' || first_item)) {
+            first_item = false;
+            unsigned char range_start = static_cast<unsigned char>(pattern_text[parse_position++]);
+            if (range_start == '\\' && parse_position < pattern_text.size()) {
+                char escaped_character = pattern_text[parse_position++];
+                if (add_shorthand_class(escaped_character, member_bytes)) {
+                    continue;
+                }
+                range_start = escaped_byte(escaped_character);
+            }
+
+            unsigned char range_end = range_start;
+            if (parse_position + 1 < pattern_text.size() && pattern_text[parse_position] == '-' &&
+                pattern_text[parse_position + 1] != ']') {
+                parse_position++;
+                range_end = static_cast<unsigned char>(pattern_text[parse_position++]);
+                if (range_end == '\\' && parse_position < pattern_text.size()) {
+                    range_end = escaped_byte(pattern_text[parse_position++]);
+                }
+                if (range_end < range_start) {
+                    error_message = "Invalid character range in regular expression";
+                    return -1;
+                }
+            }
+            for (int byte_value = range_start; byte_value <= range_end; byte_value++) {
+                member_bytes[byte_value] = true;
+            }
+        }
+
+        if (parse_position >= pattern_text.size()) {
+            error_message = "Unterminated '[' in regular expression";
+            return -1;
+        }
+        parse_position++; // You consume the closing bracket
+
+        fold_byte_set(member_bytes);
+        if (negated) {
+            member_bytes.flip();
+            member_bytes['\n'] = false;
+        }
+        return add_syntax_node(syntax_node::byte_set_node, add_byte_set(member_bytes));
+    }
+
+    int parse_atom(int nesting_depth, std::string& error_message) {
+        char atom_character = pattern_text[parse_position++];
+        byte_membership member_bytes(256, false);
+
+        switch (atom_character) {
+            case '(': {
+                if (nesting_depth >= MAX_REGEX_NESTING_DEPTH) {
+                    error_message = "Groups nested deeper than " + std::to_string(MAX_REGEX_NESTING_DEPTH) +
+                                    " in regular expression";
+                    return -1;
+                }
+                if (pattern_text.compare(parse_position, 2, "?:") == 0) {
+                    parse_position += 2; // You treat non-capturing groups like plain groups
+                }
+                int group_node = parse_alternation(nesting_depth + 1, error_message);
+                if (group_node < 0) {
+                    return -1;
+                }
+                if (parse_position >= pattern_text.size() || pattern_text[parse_position] != ')') {
+                    error_message = "Unmatched '(' in regular expression";
+                    return -1;
+                }
+                parse_position++;
+                return group_node;
+            }
+            case '[':
+                return parse_bracket_class(error_message);
+            case '^':
+                return add_syntax_node(syntax_node::line_begin);
+            case '$':
+                return add_syntax_node(syntax_node::line_end);
+            case '.':
+                member_bytes.flip();
+                member_bytes['\n'] = false;
+                return add_syntax_node(syntax_node::byte_set_node, add_byte_set(member_bytes));
+            case '*':
+            case '+':
+            case '?':
+                error_message = std::string("Nothing to repeat before '") + atom_character + "' in regular expression";
+                return -1;
+            case '\\':
+                if (parse_position >= pattern_text.size()) {
+                    error_message = "Trailing '\\' in regular expression";
+                    return -1;
+                }
+                atom_character = pattern_text[parse_position++];
+                if (add_shorthand_class(atom_character, member_bytes)) {
+                    return add_syntax_node(syntax_node::byte_set_node, add_byte_set(member_bytes));
+                }
+                member_bytes[escaped_byte(atom_character)] = true;
+                break;
+            default:
+                member_bytes[static_cast<unsigned char>(atom_character)] = true;
+                break;
+        }
+
+        fold_byte_set(member_bytes);
+        return add_syntax_node(syntax_node::byte_set_node, add_byte_set(member_bytes));
+    }
+
+    // ---- Required literal analysis ----
+
+    // You recognise byte sets that stand for exactly one character in either case
+    bool single_character_set(int byte_set_index, char& folded_character) const {
+        const byte_membership& member_bytes = byte_sets[byte_set_index];
+        int member_count = 0;
+        int first_member = -1;
+        for (int byte_value = 0; byte_value < 256; byte_value++) {
+            if (member_bytes[byte_value]) {
+                member_count++;
+                if (first_member < 0) {
+                    first_member = byte_value;
+                }
+            }
+        }
+
+        unsigned char folded_byte = fold_ascii_case(static_cast<unsigned char>(first_member));
+        bool is_letter = folded_byte >= 'a' && folded_byte <= 'z';
+        if (member_count != (is_letter ? 2 : 1)) {
+            return false;
+        }
+        folded_character = static_cast<char>(folded_byte);
+        return true;
+    }
+
+    // You rank literal alternatives by their shortest member, preferring fewer alternatives on ties
+    static bool better_literal_choice(const std::vector<std::string>& candidate,
+                                      const std::vector<std::string>& current_choice) {
+        auto shortest_length = [](const std::vector<std::string>& literals) {
+            size_t shortest = literals.empty() ? 0 : literals[0].size();
+            for (const std::string& literal_text : literals) {
+                shortest = std::min(shortest, literal_text.size());
+            }
+            return shortest;
+        };
+        size_t candidate_length = shortest_length(candidate);
+        size_t current_length = shortest_length(current_choice);
+        if (candidate_length != current_length) {
+            return candidate_length > current_length;
+        }
+        return !candidate.empty() && (current_choice.empty() || candidate.size() < current_choice.size());
+    }
+
+    // You derive the literals one of which must appear in any text this node matches
+    std::vector<std::string> analyze_required_literals(int node_index) const {
+        const syntax_node& node = syntax_nodes[node_index];
+        char folded_character = 0;
+
+        switch (node.kind) {
+            case syntax_node::byte_set_node:
+                if (single_character_set(node.byte_set_index, folded_character)) {
+                    return std::vector<std::string>(1, std::string(1, folded_character));
+                }
+                return std::vector<std::string>();
+            case syntax_node::repetition:
+                if (node.minimum_repeats >= 1) {
+                    return analyze_required_literals(node.children[0]);
+                }
+                return std::vector<std::string>();
+            case syntax_node::alternation: {
+                // You need a literal from every branch, otherwise one branch could match without any
+                std::vector<std::string> branch_literals;
+                for (int branch_node : node.children) {
+                    std::vector<std::string> branch_choice = analyze_required_literals(branch_node);
+                    if (branch_choice.empty()) {
+                        return std::vector<std::string>();
+                    }
+                    branch_literals.insert(branch_literals.end(), branch_choice.begin(), branch_choice.end());
+                }
+                std::sort(branch_literals.begin(), branch_literals.end());
+                branch_literals.erase(std::unique(branch_literals.begin(), branch_literals.end()), branch_literals.end());
+                if (branch_literals.size() > MAX_PREFILTER_LITERALS) {
+                    return std::vector<std::string>();
+                }
+                return branch_literals;
+            }
+            case syntax_node::concatenation: {
+                // You join adjacent single characters into runs and keep the best run or child requirement
+                std::vector<std::string> best_choice;
+                std::string literal_run;
+                auto finish_run = [&]() {
+                    std::vector<std::string> run_choice(1, literal_run);
+                    if (!literal_run.empty() && better_literal_choice(run_choice, best_choice)) {
+                        best_choice = run_choice;
+                    }
+                    literal_run.clear();
+                };
+
+                for (int child_node : node.children) {
+                    const syntax_node& child = syntax_nodes[child_node];
+                    if (child.kind == syntax_node::byte_set_node &&
+                        single_character_set(child.byte_set_index, folded_character)) {
+                        literal_run += folded_character;
+                        continue;
+                    }
+                    if (child.kind == syntax_node::line_begin || child.kind == syntax_node::line_end) {
+                        continue; // You let zero-width anchors sit inside a run
+                    }
+
+                    finish_run();
+                    std::vector<std::string> child_choice = analyze_required_literals(child_node);
+                    if (better_literal_choice(child_choice, best_choice)) {
+                        best_choice = child_choice;
+                    }
+                }
+                finish_run();
+                return best_choice;
+            }
+            default:
+                return std::vector<std::string>();
+        }
+    }
+
+    // You build the trigram plan of a node: runs of known characters become trigram conjunctions,
+    // concatenations require every part and alternations accept any branch
+    trigram_plan analyze_trigram_plan(int node_index) const {
+        const syntax_node& node = syntax_nodes[node_index];
+
+        switch (node.kind) {
+            case syntax_node::repetition:
+                if (node.minimum_repeats >= 1) {
+                    return analyze_trigram_plan(node.children[0]);
+                }
+                return trigram_plan();
+            case syntax_node::alternation: {
+                std::vector<trigram_plan> branch_plans;
+                for (int branch_node : node.children) {
+                    branch_plans.push_back(analyze_trigram_plan(branch_node));
+                }
+                return plan_any_of(std::move(branch_plans));
+            }
+            case syntax_node::concatenation: {
+                std::vector<trigram_plan> part_plans;
+                std::string literal_run;
+                char folded_character = 0;
+                for (int child_node : node.children) {
+                    const syntax_node& child = syntax_nodes[child_node];
+                    if (child.kind == syntax_node::byte_set_node &&
+                        single_character_set(child.byte_set_index, folded_character)) {
+                        literal_run += folded_character;
+                        continue;
+                    }
+                    if (child.kind == syntax_node::line_begin || child.kind == syntax_node::line_end) {
+                        continue; // You let zero-width anchors sit inside a run
+                    }
+                    part_plans.push_back(plan_for_literal(literal_run));
+                    literal_run.clear();
+                    part_plans.push_back(analyze_trigram_plan(child_node));
+                }
+                part_plans.push_back(plan_for_literal(literal_run));
+                return plan_all_of(std::move(part_plans));
+            }
+            default:
+                return trigram_plan(); // You cannot require anything of a single character set
+        }
+    }
+
+    // ---- NFA construction ----
+
+    int add_program_node(program_node::node_type type, int next_state, int alternative_state, int byte_set_index) {
+        program_nodes.push_back({type, next_state, alternative_state, byte_set_index});
+        return static_cast<int>(program_nodes.size() - 1);
+    }
+
+    // You compile a syntax node so that a successful match continues at next_state
+    // Stacked repeats such as "a???" deepen the tree without any group, so the depth is checked here as well
+    int compile_syntax_node(int node_index, int next_state, int syntax_depth) {
+        if (program_nodes.size() > MAX_REGEX_PROGRAM_SIZE) {
+            return next_state; // You stop growing; compile reports the pattern as too large
+        }
+        if (syntax_depth > MAX_REGEX_SYNTAX_DEPTH) {
+            syntax_too_deep = true; // You stop descending; compile reports the pattern as too deep
+            return next_state;
+        }
+
+        const syntax_node node = syntax_nodes[node_index];
+        switch (node.kind) {
+            case syntax_node::byte_set_node:
+                return add_program_node(program_node::byte_set_match, next_state, -1, node.byte_set_index);
+            case syntax_node::line_begin:
+                return add_program_node(program_node::assert_line_begin, next_state, -1, -1);
+            case syntax_node::line_end:
+                return add_program_node(program_node::assert_line_end, next_state, -1, -1);
+            case syntax_node::empty:
+                return next_state;
+            case syntax_node::concatenation: {
+                int entry_state = next_state;
+                for (size_t child_index = node.children.size(); child_index-- > 0;) {
+                    entry_state = compile_syntax_node(node.children[child_index], entry_state, syntax_depth + 1);
+                }
+                return entry_state;
+            }
+            case syntax_node::alternation: {
+                int entry_state = compile_syntax_node(node.children.back(), next_state, syntax_depth + 1);
+                for (size_t child_index = node.children.size() - 1; child_index-- > 0;) {
+                    int branch_state = compile_syntax_node(node.children[child_index], next_state, syntax_depth + 1);
+                    entry_state = add_program_node(program_node::split, branch_state, entry_state, -1);
+                }
+                return entry_state;
+            }
+            case syntax_node::repetition: {
+                int repeated_node = node.children[0];
+                int entry_state = next_state;
+                if (node.maximum_repeats < 0) {
+                    // You loop through a split that either repeats the body or leaves
+                    int loop_state = add_program_node(program_node::split, -1, next_state, -1);
+                    program_nodes[loop_state].next_state =
+                        compile_syntax_node(repeated_node, loop_state, syntax_depth + 1);
+                    entry_state = loop_state;
+                } else {
+                    for (int optional_copy = node.minimum_repeats;
+                         optional_copy < node.maximum_repeats && program_nodes.size() <= MAX_REGEX_PROGRAM_SIZE;
+                         optional_copy++) {
+                        int body_state = compile_syntax_node(repeated_node, entry_state, syntax_depth + 1);
+                        entry_state = add_program_node(program_node::split, body_state, next_state, -1);
+                    }
+                }
+                for (int required_copy = 0;
+                     required_copy < node.minimum_repeats && program_nodes.size() <= MAX_REGEX_PROGRAM_SIZE;
+                     required_copy++) {
+                    entry_state = compile_syntax_node(repeated_node, entry_state, syntax_depth + 1);
+                }
+                return entry_state;
+            }
+        }
+        return next_state;
+    }
+
+    // You group bytes that every byte set treats alike so DFA rows stay narrow
+    void build_byte_classes() {
+        std::map<std::vector<bool>, unsigned char> class_by_signature;
+        for (int byte_value = 0; byte_value < 256; byte_value++) {
+            std::vector<bool> membership_signature(byte_sets.size());
+            for (size_t set_index = 0; set_index < byte_sets.size(); set_index++) {
+                membership_signature[set_index] = byte_sets[set_index][byte_value];
+            }
+            auto inserted = class_by_signature.emplace(membership_signature,
+                                                       static_cast<unsigned char>(class_by_signature.size()));
+            byte_classes[byte_value] = inserted.first->second;
+            class_representatives[inserted.first->second] = static_cast<unsigned char>(byte_value);
+        }
+        class_count = class_by_signature.size();
+        row_stride = class_count + 1; // You keep one extra column for the end-of-line transition
+    }
+
+    // ---- Lazy DFA ----
+
+    // You follow empty transitions from a state, collecting byte consumers, line-end asserts and accepts
+    void add_closure(int start_state, bool at_line_begin, bool at_line_end, std::vector<int>& nfa_states) const {
+        closure_stack.assign(1, start_state);
+        while (!closure_stack.empty()) {
+            int state = closure_stack.back();
+            closure_stack.pop_back();
+            if (state < 0 || closure_marks[state] == closure_generation) {
+                continue;
+            }
+            closure_marks[state] = closure_generation;
+
+            const program_node& node = program_nodes[state];
+            switch (node.type) {
+                case program_node::split:
+                    closure_stack.push_back(node.alternative_state);
+                    closure_stack.push_back(node.next_state);
+                    break;
+                case program_node::assert_line_begin:
+                    if (at_line_begin) {
+                        closure_stack.push_back(node.next_state);
+                    }
+                    break;
+                case program_node::assert_line_end:
+                    if (at_line_end) {
+                        closure_stack.push_back(node.next_state);
+                    } else {
+                        nfa_states.push_back(state);
+                    }
+                    break;
+                default:
+                    nfa_states.push_back(state);
+                    break;
+            }
+        }
+    }
+
+    // You return the cached DFA state for a set of NFA states, flushing the cache when it is full
+    int intern_state(std::vector<int>& nfa_states) const {
+        std::sort(nfa_states.begin(), nfa_states.end());
+        nfa_states.erase(std::unique(nfa_states.begin(), nfa_states.end()), nfa_states.end());
+
+        auto existing_state = state_index.find(nfa_states);
+        if (existing_state != state_index.end()) {
+            return existing_state->second;
+        }
+
+        if (state_sets.size() >= LAZY_DFA_STATE_LIMIT) {
+            std::vector<int> pending_states = nfa_states;
+            reset_state_cache();
+            return intern_state(pending_states);
+        }
+
+        int new_state = static_cast<int>(state_sets.size());
+        bool accepting = false;
+        for (int nfa_state : nfa_states) {
+            accepting = accepting || program_nodes[nfa_state].type == program_node::accept;
+        }
+        state_sets.push_back(nfa_states);
+        state_index.emplace(nfa_states, new_state);
+        state_matched.push_back(accepting ? 1 : 0);
+        transition_cache.resize(transition_cache.size() + row_stride, -1);
+        return new_state;
+    }
+
+    // You start a new closure computation, clearing the visit marks only when the stamp wraps around
+    void begin_closure_pass() const {
+        if (closure_marks.size() != program_nodes.size() || ++closure_generation == 0) {
+            closure_marks.assign(program_nodes.size(), 0);
+            closure_generation = 1;
+        }
+    }
+
+    // You clear every cached state and rebuild the start state
+    void reset_state_cache() const {
+        state_sets.clear();
+        state_index.clear();
+        state_matched.clear();
+        transition_cache.clear();
+        cache_flush_count++;
+
+        std::vector<int> start_states;
+        begin_closure_pass();
+        add_closure(program_start, true, false, start_states);
+        line_start_row = static_cast<size_t>(intern_state(start_states)) * row_stride;
+    }
+
+    // You compute a missing transition by stepping every NFA state and restarting the unanchored search
+    // Edges are stored as the target row offset shifted left with the accepting flag in bit zero
+    int compute_transition(size_t current_row, size_t column_index) const {
+        size_t current_state = current_row / row_stride;
+        std::vector<int> next_states;
+        begin_closure_pass();
+        const std::vector<int> current_states = state_sets[current_state];
+        bool line_end_column = column_index == class_count;
+
+        for (int nfa_state : current_states) {
+            const program_node& node = program_nodes[nfa_state];
+            if (node.type == program_node::accept) {
+                next_states.push_back(nfa_state); // You keep a found match once it has been seen
+            } else if (line_end_column && node.type == program_node::assert_line_end) {
+                add_closure(node.next_state, false, true, next_states);
+            } else if (!line_end_column && node.type == program_node::byte_set_match &&
+                       byte_sets[node.byte_set_index][class_representatives[column_index]]) {
+                add_closure(node.next_state, false, false, next_states);
+            }
+        }
+        if (!line_end_column) {
+            add_closure(program_start, false, false, next_states);
+        }
+
+        // You only record the edge if interning did not flush the state it starts from
+        unsigned flushes_before = cache_flush_count;
+        int next_state = intern_state(next_states);
+        int next_edge = static_cast<int>((static_cast<size_t>(next_state) * row_stride) << 1) | state_matched[next_state];
+        if (cache_flush_count == flushes_before) {
+            transition_cache[current_row + column_index] = next_edge;
+        }
+        return next_edge;
+    }
+
+    inline int line_end_edge(size_t current_row) const {
+        int next_edge = transition_cache[current_row + class_count];
+        return next_edge >= 0 ? next_edge : compute_transition(current_row, class_count);
+    }
+
+    std::string pattern_text;
+    size_t parse_position = 0;
+    std::vector<syntax_node> syntax_nodes;
+    std::vector<program_node> program_nodes;
+    std::vector<byte_membership> byte_sets;
+    int root_node = -1;
+    int program_start = 0;
+    bool syntax_too_deep = false;
+    bool empty_line_matches = false;
+
+    unsigned char byte_classes[256] = {};
+    unsigned char class_representatives[256] = {};
+    size_t class_count = 1;
+    size_t row_stride = 2;
+
+    mutable std::vector<std::vector<int>> state_sets;
+    mutable std::map<std::vector<int>, int> state_index;
+    mutable std::vector<unsigned char> state_matched;
+    mutable std::vector<int> transition_cache;
+    mutable std::vector<unsigned> closure_marks;
+    mutable unsigned closure_generation = 0;
+    mutable unsigned cache_flush_count = 0;
+    mutable std::vector<int> closure_stack;
+    mutable size_t line_start_row = 0;
+};
+
+// Regular expression search that skips to required literals before running the DFA
+class prefiltered_regex_matcher {
+public:
+    // You compile the expression and pick a literal, multi-literal or no prefilter for it
+    bool compile(const std::string& pattern, std::string& error_message) {
+        if (!regex_engine.compile(pattern, error_message)) {
+            return false;
+        }
+
+        std::vector<std::string> required_literals = regex_engine.required_literals();
+        prefilter = no_prefilter;
+        if (required_literals.size() == 1) {
+            literal_prefilter.folded_term = required_literals[0];
+            prefilter = single_literal;
+        } else if (required_literals.size() > 1) {
+            literal_set_prefilter.build(required_literals);
+            prefilter = literal_set;
+        }
+        return true;
+    }
+
+    // You jump between literal candidates and run the DFA only on the lines that contain one
+    const char* find(const char* range_begin, const char* range_end) const {
+        if (prefilter == no_prefilter) {
+            return regex_engine.find(range_begin, range_end);
+        }
+
+        const char* scan_cursor = range_begin;
+        while (scan_cursor < range_end) {
+            const char* candidate = prefilter == single_literal ? literal_prefilter.find(scan_cursor, range_end)
+                                                                : literal_set_prefilter.find(scan_cursor, range_end);
+            if (candidate == nullptr) {
+                return nullptr;
+            }
+
+            const char* line_end = find_line_end(candidate, range_end);
+            if (regex_engine.line_matches(find_line_begin(scan_cursor, candidate), line_end)) {
+                return candidate;
+            }
+            if (line_end == range_end) {
+                return nullptr;
+            }
+            scan_cursor = line_end + 1;
+        }
+        return nullptr;
+    }
+
+    std::string describe_line_matches(const char*, const char*) const { return std::string(); }
+
+    void locate_line_match(const char* line_begin, const char* line_end, size_t& match_column,
+                           size_t& match_length) const {
+        regex_engine.locate_line_match(line_begin, line_end, match_column, match_length);
+    }
+
+    trigram_plan index_plan() const { return regex_engine.index_plan(); }
+
+    // You describe the chosen prefilter for diagnostics and benchmarks
+    std::string prefilter_description() const {
+        if (prefilter == single_literal) {
+            return "literal \"" + literal_prefilter.folded_term + "\"";
+        }
+        if (prefilter == literal_set) {
+            return std::to_string(literal_set_prefilter.pattern_count()) + " alternative literals";
+        }
+        return "none";
+    }
+
+private:
+    enum prefilter_kind { no_prefilter, single_literal, literal_set };
+
+    lazy_dfa_regex regex_engine;
+    prefilter_kind prefilter = no_prefilter;
+    literal_term_matcher literal_prefilter;
+    aho_corasick_automaton literal_set_prefilter;
+};
+
+// Longest term the bit-parallel fuzzy matcher can hold in one machine word
+const size_t MAX_FUZZY_TERM_LENGTH = 64;
+
+// Shortest exact piece worth using as a fuzzy prefilter
+const size_t MIN_FUZZY_PREFILTER_PIECE = 3;
+
+// Approximate term search within a bounded edit distance using Myers' bit-parallel algorithm
+class fuzzy_term_matcher {
+public:
+    // You build the per-byte match masks and, when the pieces are long enough, a pigeonhole prefilter
+    bool compile(const std::string& search_term, size_t maximum_distance, std::string& error_message) {
+        const std::string folded_term = fold_search_term(search_term);
+        if (folded_term.empty() || folded_term.size() > MAX_FUZZY_TERM_LENGTH) {
+            error_message = "Fuzzy terms must be 1 to " + std::to_string(MAX_FUZZY_TERM_LENGTH) + " characters long";
+            return false;
+        }
+        if (maximum_distance >= folded_term.size()) {
+            error_message = "Edit distance must be smaller than the term length";
+            return false;
+        }
+
+        term_length = folded_term.size();
+        distance_limit = maximum_distance;
+        last_row_bit = 1ULL << (term_length - 1);
+        row_mask = term_length == 64 ? ~0ULL : (1ULL << term_length) - 1;
+        std::fill(std::begin(match_masks), std::end(match_masks), 0ULL);
+        for (size_t term_index = 0; term_index < term_length; term_index++) {
+            unsigned char term_byte = static_cast<unsigned char>(folded_term[term_index]);
+            match_masks[term_byte] |= 1ULL << term_index;
+            if (term_byte >= 'a' && term_byte <= 'z') {
+                match_masks[term_byte - 'a' + 'A'] |= 1ULL << term_index;
+            }
+        }
+
+        // You split the term into k + 1 pieces; any match within k edits contains one of them exactly
+        size_t piece_count = maximum_distance + 1;
+        size_t piece_length = term_length / piece_count;
+        use_prefilter = piece_length >= MIN_FUZZY_PREFILTER_PIECE;
+        exact_pieces.clear();
+        if (use_prefilter) {
+            std::vector<std::string> term_pieces;
+            for (size_t piece_index = 0; piece_index < piece_count; piece_index++) {
+                size_t piece_begin = piece_index * piece_length;
+                size_t piece_end = piece_index + 1 == piece_count ? term_length : piece_begin + piece_length;
+                term_pieces.push_back(folded_term.substr(piece_begin, piece_end - piece_begin));
+            }
+            piece_prefilter.build(term_pieces);
+            exact_pieces = term_pieces;
+        }
+        return true;
+    }
+
+    // You return a position inside the first line holding the term within the edit distance
+    const char* find(const char* range_begin, const char* range_end) const {
+        if (!use_prefilter) {
+            return scan_for_approximate_match(range_begin, range_end);
+        }
+
+        const char* scan_cursor = range_begin;
+        while (scan_cursor < range_end) {
+            const char* candidate = piece_prefilter.find(scan_cursor, range_end);
+            if (candidate == nullptr) {
+                return nullptr;
+            }
+
+            const char* line_end = find_line_end(candidate, range_end);
+            const char* line_match = scan_for_approximate_match(find_line_begin(scan_cursor, candidate), line_end);
+            if (line_match != nullptr) {
+                return line_match;
+            }
+            if (line_end == range_end) {
+                return nullptr;
+            }
+            scan_cursor = line_end + 1;
+        }
+        return nullptr;
+    }
+
+    // You label each matching line with the smallest edit distance found on it
+    std::string describe_line_matches(const char* line_begin, const char* line_end) const {
+        return "distance " + std::to_string(smallest_line_distance(line_begin, line_end));
+    }
+
+    // You take the first position where the term fits and pick the start with the fewest edits
+    // Starts further back win ties so the reported span covers the whole approximate match
+    void locate_line_match(const char* line_begin, const char* line_end, size_t& match_column,
+                           size_t& match_length) const {
+        match_column = 0;
+        match_length = 0;
+        const char* match_last = scan_for_approximate_match(line_begin, line_end);
+        if (match_last == nullptr) {
+            return;
+        }
+
+        size_t match_end = static_cast<size_t>(match_last - line_begin) + 1;
+        size_t earliest_start = match_end > term_length + distance_limit ? match_end - term_length - distance_limit : 0;
+        size_t latest_start = match_end + distance_limit > term_length ? match_end + distance_limit - term_length : 0;
+        latest_start = std::min(latest_start, match_end - 1);
+
+        size_t best_distance = term_length + distance_limit + 1;
+        std::vector<size_t> previous_row(term_length + 1);
+        std::vector<size_t> current_row(term_length + 1);
+        for (size_t match_start = earliest_start; match_start <= latest_start; match_start++) {
+            // You compute the plain edit distance between the term and this candidate span
+            for (size_t term_index = 0; term_index <= term_length; term_index++) {
+                previous_row[term_index] = term_index;
+            }
+            for (size_t text_index = match_start; text_index < match_end; text_index++) {
+                unsigned long long text_matches = match_masks[static_cast<unsigned char>(line_begin[text_index])];
+                current_row[0] = text_index + 1 - match_start;
+                for (size_t term_index = 1; term_index <= term_length; term_index++) {
+                    size_t substitution = previous_row[term_index - 1] + ((text_matches >> (term_index - 1)) & 1 ? 0 : 1);
+                    current_row[term_index] = std::min(substitution,
+                                                       std::min(previous_row[term_index], current_row[term_index - 1]) + 1);
+                }
+                previous_row.swap(current_row);
+            }
+
+            if (previous_row[term_length] < best_distance) {
+                best_distance = previous_row[term_length];
+                match_column = match_start;
+                match_length = match_end - match_start;
+            }
+        }
+    }
+
+    // You require one of the exact pigeonhole pieces, or nothing when the pieces are too short to index
+    trigram_plan index_plan() const { return plan_for_any_literal(exact_pieces); }
+
+private:
+    // You advance the Myers column by one text byte and return the new distance for the full term
+    inline size_t advance_column(unsigned char text_byte, unsigned long long& positive_vertical,
+                                 unsigned long long& negative_vertical, size_t current_distance) const {
+        const unsigned long long byte_matches = match_masks[text_byte];
+        const unsigned long long vertical_changes = byte_matches | negative_vertical;
+        const unsigned long long horizontal_changes =
+            (((byte_matches & positive_vertical) + positive_vertical) ^ positive_vertical) | byte_matches;
+        unsigned long long positive_horizontal = negative_vertical | ~(horizontal_changes | positive_vertical);
+        unsigned long long negative_horizontal = positive_vertical & horizontal_changes;
+
+        if (positive_horizontal & last_row_bit) {
+            current_distance++;
+        } else if (negative_horizontal & last_row_bit) {
+            current_distance--;
+        }
+
+        // You shift in zero because a match may start at any text position
+        positive_horizontal <<= 1;
+        negative_horizontal <<= 1;
+        positive_vertical = (negative_horizontal | ~(vertical_changes | positive_horizontal)) & row_mask;
+        negative_vertical = positive_horizontal & vertical_changes & row_mask;
+        return current_distance;
+    }
+
+    // You scan line by line, restarting the bit vectors at every newline
+    const char* scan_for_approximate_match(const char* range_begin, const char* range_end) const {
+        unsigned long long positive_vertical = row_mask;
+        unsigned long long negative_vertical = 0;
+        size_t current_distance = term_length;
+
+        for (const char* position = range_begin; position < range_end; ++position) {
+            unsigned char text_byte = static_cast<unsigned char>(*position);
+            if (text_byte == '\n') {
+                positive_vertical = row_mask;
+                negative_vertical = 0;
+                current_distance = term_length;
+                continue;
+            }
+
+            current_distance = advance_column(text_byte, positive_vertical, negative_vertical, current_distance);
+            if (current_distance <= distance_limit) {
+                return position;
+            }
+        }
+        return nullptr;
+    }
+
+    // You find the best distance anywhere on a line for reporting
+    size_t smallest_line_distance(const char* line_begin, const char* line_end) const {
+        unsigned long long positive_vertical = row_mask;
+        unsigned long long negative_vertical = 0;
+        size_t current_distance = term_length;
+        size_t smallest_distance = term_length;
+
+        for (const char* position = line_begin; position < line_end; ++position) {
+            current_distance = advance_column(static_cast<unsigned char>(*position), positive_vertical,
+                                              negative_vertical, current_distance);
+            smallest_distance = std::min(smallest_distance, current_distance);
+        }
+        return smallest_distance;
+    }
+
+    unsigned long long match_masks[256] = {};
+    unsigned long long last_row_bit = 1;
+    unsigned long long row_mask = 1;
+    size_t term_length = 0;
+    size_t distance_limit = 0;
+    bool use_prefilter = false;
+    aho_corasick_automaton piece_prefilter;
+    std::vector<std::string> exact_pieces;
+};
+
+// Largest before/after context a search may request
+const size_t MAX_CONTEXT_LINES = 1000;
+
+// Number of context lines to print around each match
+struct context_window_options {
+    size_t lines_before = 0;
+    size_t lines_after = 0;
+
+    bool enabled() const { return lines_before > 0 || lines_after > 0; }
+};
+
+// Fixed-capacity ring of the most recent lines that reuses each slot's storage
+class line_ring_buffer {
+public:
+    explicit line_ring_buffer(size_t line_capacity) : line_slots(line_capacity) {}
+
+    // You overwrite the oldest line once the ring is full
+    void push(std::string_view line_text) {
+        if (line_slots.empty()) {
+            return;
+        }
+        line_slots[next_slot].assign(line_text.data(), line_text.size());
+        next_slot = (next_slot + 1) % line_slots.size();
+        if (stored_lines < line_slots.size()) {
+            stored_lines++;
+        }
+    }
+
+    size_t size() const { return stored_lines; }
+
+    // You index lines from the oldest (zero) to the most recent (size - 1)
+    const std::string& line(size_t line_index) const {
+        return line_slots[(next_slot + line_slots.size() - stored_lines + line_index) % line_slots.size()];
+    }
+
+private:
+    std::vector<std::string> line_slots;
+    size_t next_slot = 0;
+    size_t stored_lines = 0;
+};
+
+// Function to collect up to the requested number of lines preceding a line, oldest first
+inline void collect_lines_before(const char* range_begin, const char* line_begin, size_t requested_lines,
+                          std::vector<std::string_view>& preceding_lines) {
+    preceding_lines.clear();
+    const char* cursor = line_begin;
+    while (preceding_lines.size() < requested_lines && cursor > range_begin) {
+        const char* previous_begin = find_line_begin(range_begin, cursor - 1);
+        preceding_lines.push_back(std::string_view(previous_begin, static_cast<size_t>(cursor - 1 - previous_begin)));
+        cursor = previous_begin;
+    }
+    std::reverse(preceding_lines.begin(), preceding_lines.end());
+}
+
+// Function to collect up to the requested number of lines following a line end
+inline void collect_lines_after(const char* line_end, const char* range_end, size_t requested_lines,
+                         std::vector<std::string_view>& following_lines) {
+    following_lines.clear();
+    const char* cursor = line_end;
+    while (following_lines.size() < requested_lines && cursor < range_end && cursor + 1 < range_end) {
+        const char* next_end = find_line_end(cursor + 1, range_end);
+        following_lines.push_back(std::string_view(cursor + 1, static_cast<size_t>(next_end - cursor - 1)));
+        cursor = next_end;
+    }
+}
+
+// Matches of one search as a contiguous array of records, plus the content needed to display them
+// Mapped files stay mapped; streamed input keeps copies of the matching lines and their context
+class search_match_set {
+public:
+    std::vector<match_record> match_records;
+
+    // You keep a mapped file alive so matches can be displayed straight from it
+    void attach_mapped_content(std::shared_ptr<const mapped_file_region> mapped_file) {
+        mapped_content = std::move(mapped_file);
+    }
+
+    // You copy a streamed line that a match or its context needs, once and in line order
+    void retain_line(size_t line_number, std::string_view line_text) {
+        if (!retained_lines.empty() && retained_lines.back().line_number >= line_number) {
+            return;
+        }
+        retained_lines.push_back({line_number, retained_text.size(), line_text.size()});
+        retained_text.append(line_text.data(), line_text.size());
+    }
+
+    // You return the text of a matching line without its newline
+    std::string_view line_text(const match_record& record) const {
+        if (mapped_content) {
+            const char* content_end = mapped_content->data() + mapped_content->size();
+            const char* line_begin = mapped_content->data() + record.line_offset;
+            return std::string_view(line_begin, static_cast<size_t>(find_line_end(line_begin, content_end) - line_begin));
+        }
+        std::string_view matching_line;
+        retained_line_text(record.line_number, matching_line);
+        return matching_line;
+    }
+
+    // You gather up to the requested context lines on each side of a match, oldest first
+    void context_lines(const match_record& record, const context_window_options& context_window,
+                       std::vector<std::string_view>& lines_before, std::vector<std::string_view>& lines_after) const {
+        if (mapped_content) {
+            const char* content_begin = mapped_content->data();
+            const char* content_end = content_begin + mapped_content->size();
+            const char* line_begin = content_begin + record.line_offset;
+            collect_lines_before(content_begin, line_begin, context_window.lines_before, lines_before);
+            collect_lines_after(find_line_end(line_begin, content_end), content_end, context_window.lines_after,
+                                lines_after);
+            return;
+        }
+
+        lines_before.clear();
+        lines_after.clear();
+        std::string_view context_line;
+        for (size_t distance = std::min(context_window.lines_before, record.line_number - 1); distance > 0; distance--) {
+            if (retained_line_text(record.line_number - distance, context_line)) {
+                lines_before.push_back(context_line);
+            }
+        }
+        for (size_t distance = 1; distance <= context_window.lines_after &&
+                                  retained_line_text(record.line_number + distance, context_line); distance++) {
+            lines_after.push_back(context_line);
+        }
+    }
+
+    // You estimate the memory held so buffered result sets can be capped
+    size_t footprint_bytes() const {
+        return match_records.size() * sizeof(match_record) + retained_lines.size() * sizeof(retained_line) +
+               retained_text.size();
+    }
+
+private:
+    // Streamed line kept for display, stored inside retained_text
+    struct retained_line {
+        size_t line_number;
+        size_t text_offset;
+        size_t text_length;
+    };
+
+    bool retained_line_text(size_t line_number, std::string_view& line_text) const {
+        auto found_line = std::lower_bound(retained_lines.begin(), retained_lines.end(), line_number,
+                                           [](const retained_line& stored_line, size_t wanted_line) {
+                                               return stored_line.line_number < wanted_line;
+                                           });
+        if (found_line == retained_lines.end() || found_line->line_number != line_number) {
+            return false;
+        }
+        line_text = std::string_view(retained_text.data() + found_line->text_offset, found_line->text_length);
+        return true;
+    }
+
+    std::shared_ptr<const mapped_file_region> mapped_content;
+    std::string retained_text;
+    std::vector<retained_line> retained_lines;
+};
+
+// Function to write an unsigned integer in decimal into a caller buffer of at least 20 bytes
+// Returns the number of digits written
+inline size_t format_decimal(size_t value, char* digit_buffer) {
+    char reversed_digits[20];
+    size_t digit_count = 0;
+    do {
+        reversed_digits[digit_count++] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    for (size_t digit_index = 0; digit_index < digit_count; digit_index++) {
+        digit_buffer[digit_index] = reversed_digits[digit_count - 1 - digit_index];
+    }
+    return digit_count;
+}
+
+// Function to build the record of a matching line found inside scanned content
+template <typename LineMatcher>
+match_record make_match_record(const char* content_begin, size_t line_number, const char* line_begin,
+                               const char* line_end, const LineMatcher& line_matcher) {
+    match_record record{line_number, static_cast<size_t>(line_begin - content_begin), 0, 0};
+    line_matcher.locate_line_match(line_begin, line_end, record.match_column, record.match_length);
+    return record;
+}
+
+// Function to scan a line-aligned range of mapped bytes in cache-sized blocks
+// Returns the line number that follows the last newline of the range
+template <typename LineMatcher, typename MatchVisitor>
+size_t scan_mapped_range(const char* range_begin, const char* range_end, size_t first_line_number,
+                         const LineMatcher& line_matcher, file_content_statistics* file_statistics,
+                         MatchVisitor&& on_match) {
+    size_t next_line_number = first_line_number;
+
+    // You walk the range in line-aligned blocks so statistics and matching share each block
+    const char* block_begin = range_begin;
+    while (block_begin < range_end) {
+        const char* block_end = range_end;
+        if (static_cast<size_t>(range_end - block_begin) > SCAN_BLOCK_SIZE) {
+            block_end = find_line_end(block_begin + SCAN_BLOCK_SIZE, range_end);
+            if (block_end < range_end) {
+                block_end++;
+            }
+        }
+
+        if (file_statistics != nullptr) {
+            accumulate_content_statistics(block_begin, block_end, *file_statistics);
+        }
+        next_line_number = scan_lines_for_matches(block_begin, block_end, next_line_number, line_matcher, on_match);
+        block_begin = block_end;
+    }
+    return next_line_number;
+}
+
+// Function to search a memory-mapped file directly over the mapped bytes
+// Context is not copied here because the mapping outlives the search
+template <typename LineMatcher>
+std::vector<match_record> search_mapped_content(std::string_view content, const LineMatcher& line_matcher,
+                                                file_content_statistics* file_statistics = nullptr) {
+    std::vector<match_record> match_records;
+    const char* content_begin = content.data();
+
+    scan_mapped_range(content_begin, content_begin + content.size(), 1, line_matcher, file_statistics,
+                      [&](size_t line_number, const char* line_begin, const char* line_end) {
+        match_records.push_back(make_match_record(content_begin, line_number, line_begin, line_end, line_matcher));
+    });
+
+    if (file_statistics != nullptr) {
+        finish_content_statistics(*file_statistics);
+    }
+    return match_records;
+}
+
+// Smallest mapped file worth splitting across threads
+const size_t PARALLEL_SCAN_MIN_SIZE = 32 << 20;
+
+// Bytes each parallel scan task covers before its end moves forward to a newline
+const size_t PARALLEL_CHUNK_SIZE = 8 << 20;
+
+// Number of threads a search may use, all cores unless overridden
+inline size_t& search_thread_count() {
+    static size_t thread_count = std::max(1u, std::thread::hardware_concurrency());
+    return thread_count;
+}
+
+// Function to run numbered tasks on a fixed set of threads that each claim the next task when idle
+// The task function receives the worker index so it can use per-thread state
+template <typename TaskFunction>
+void run_parallel_tasks(size_t task_count, size_t worker_count, TaskFunction&& run_task) {
+    std::atomic<size_t> next_task(0);
+    auto worker_loop = [&](size_t worker_index) {
+        for (size_t task_index = next_task++; task_index < task_count; task_index = next_task++) {
+            run_task(worker_index, task_index);
+        }
+    };
+
+    // You let the calling thread act as the first worker
+    std::vector<std::thread> worker_threads;
+    for (size_t worker_index = 1; worker_index < worker_count; worker_index++) {
+        worker_threads.emplace_back(worker_loop, worker_index);
+    }
+    worker_loop(0);
+    for (std::thread& worker_thread : worker_threads) {
+        worker_thread.join();
+    }
+}
+
+// Thread pool where each worker keeps its own task deque and idle workers steal from the others
+// A shared queue hands out tasks oldest first; workers check it once their own deque is empty
+// Tasks may submit further tasks, and run returns once all of them have finished
+class work_stealing_pool {
+public:
+    typedef std::function<void(size_t)> pool_task;
+
+    explicit work_stealing_pool(size_t worker_count) {
+        for (size_t worker_index = 0; worker_index < std::max<size_t>(1, worker_count); worker_index++) {
+            worker_queues.emplace_back(new worker_queue);
+        }
+    }
+
+    size_t worker_count() const { return worker_queues.size(); }
+
+    // You queue a task on the submitting worker's deque so related work stays on one core
+    void submit(size_t worker_index, pool_task task) {
+        unfinished_tasks++;
+        {
+            std::lock_guard<std::mutex> queue_lock(worker_queues[worker_index]->queue_mutex);
+            worker_queues[worker_index]->tasks.push_back(std::move(task));
+        }
+        idle_signal.notify_one();
+    }
+
+    // You queue a task that any worker should pick up in submission order
+    void submit_shared(pool_task task) {
+        unfinished_tasks++;
+        {
+            std::lock_guard<std::mutex> queue_lock(shared_queue.queue_mutex);
+            shared_queue.tasks.push_back(std::move(task));
+        }
+        idle_signal.notify_one();
+    }
+
+    // You run queued tasks on every worker, with the calling thread as worker zero
+    void run() {
+        std::vector<std::thread> worker_threads;
+        for (size_t worker_index = 1; worker_index < worker_queues.size(); worker_index++) {
+            worker_threads.emplace_back([this, worker_index]() { worker_loop(worker_index); });
+        }
+        worker_loop(0);
+        for (std::thread& worker_thread : worker_threads) {
+            worker_thread.join();
+        }
+    }
+
+private:
+    struct worker_queue {
+        std::mutex queue_mutex;
+        std::deque<pool_task> tasks;
+    };
+
+    // You take the newest local task first, then the oldest shared one, and otherwise steal from another worker
+    bool take_task(size_t worker_index, pool_task& task) {
+        {
+            worker_queue& own_queue = *worker_queues[worker_index];
+            std::lock_guard<std::mutex> queue_lock(own_queue.queue_mutex);
+            if (!own_queue.tasks.empty()) {
+                task = std::move(own_queue.tasks.back());
+                own_queue.tasks.pop_back();
+                return true;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> queue_lock(shared_queue.queue_mutex);
+            if (!shared_queue.tasks.empty()) {
+                task = std::move(shared_queue.tasks.front());
+                shared_queue.tasks.pop_front();
+                return true;
+            }
+        }
+
+        for (size_t offset = 1; offset < worker_queues.size(); offset++) {
+            worker_queue& victim_queue = *worker_queues[(worker_index + offset) % worker_queues.size()];
+            std::lock_guard<std::mutex> queue_lock(victim_queue.queue_mutex);
+            if (!victim_queue.tasks.empty()) {
+                task = std::move(victim_queue.tasks.front());
+                victim_queue.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // You keep working until no task is queued or running anywhere in the pool
+    void worker_loop(size_t worker_index) {
+        pool_task task;
+        while (true) {
+            if (take_task(worker_index, task)) {
+                task(worker_index);
+                task = nullptr;
+                if (--unfinished_tasks == 0) {
+                    idle_signal.notify_all();
+                }
+                continue;
+            }
+
+            // You sleep briefly while running tasks may still submit more work
+            std::unique_lock<std::mutex> idle_lock(idle_mutex);
+            if (unfinished_tasks == 0) {
+                return;
+            }
+            idle_signal.wait_for(idle_lock, std::chrono::milliseconds(1));
+        }
+    }
+
+    std::vector<std::unique_ptr<worker_queue>> worker_queues;
+    worker_queue shared_queue;
+    std::atomic<size_t> unfinished_tasks{0};
+    std::mutex idle_mutex;
+    std::condition_variable idle_signal;
+};
+
+// Everything one parallel scan task learns about its chunk
+struct chunk_scan_result {
+    const char* chunk_begin = nullptr;
+    const char* chunk_end = nullptr;
+    size_t newline_count = 0;
+    std::vector<match_record> match_records; // Line numbers relative to the chunk until merged
+    file_content_statistics chunk_statistics;
+};
+
+// Function to cut mapped content into chunks that each start at a line start
+inline std::vector<chunk_scan_result> split_content_into_chunks(std::string_view content) {
+    const char* content_begin = content.data();
+    const char* content_end = content_begin + content.size();
+    std::vector<chunk_scan_result> chunk_results;
+
+    for (const char* chunk_begin = content_begin; chunk_begin < content_end;) {
+        const char* chunk_end = content_end;
+        if (static_cast<size_t>(content_end - chunk_begin) > PARALLEL_CHUNK_SIZE) {
+            chunk_end = find_line_end(chunk_begin + PARALLEL_CHUNK_SIZE, content_end);
+            if (chunk_end < content_end) {
+                chunk_end++;
+            }
+        }
+        chunk_results.emplace_back();
+        chunk_results.back().chunk_begin = chunk_begin;
+        chunk_results.back().chunk_end = chunk_end;
+        chunk_begin = chunk_end;
+    }
+    return chunk_results;
+}
+
+// Function to scan one chunk, recording matches relative to its first line
+template <typename LineMatcher>
+void scan_content_chunk(chunk_scan_result& chunk_result, const char* content_begin, const LineMatcher& line_matcher,
+                        bool gather_statistics) {
+    chunk_result.newline_count = scan_mapped_range(
+        chunk_result.chunk_begin, chunk_result.chunk_end, 0, line_matcher,
+        gather_statistics ? &chunk_result.chunk_statistics : nullptr,
+        [&](size_t line_number, const char* line_begin, const char* line_end) {
+            chunk_result.match_records.push_back(
+                make_match_record(content_begin, line_number, line_begin, line_end, line_matcher));
+        });
+}
+
+// Function to join the chunks' records in file order, fixing up line numbers from per-chunk newline counts
+inline std::vector<match_record> merge_chunk_results(std::vector<chunk_scan_result>& chunk_results,
+                                              file_content_statistics* file_statistics) {
+    size_t result_count = 0;
+    for (const chunk_scan_result& chunk_result : chunk_results) {
+        result_count += chunk_result.match_records.size();
+    }
+
+    std::vector<match_record> match_records;
+    match_records.reserve(result_count);
+    size_t first_line_number = 1;
+    for (chunk_scan_result& chunk_result : chunk_results) {
+        for (match_record record : chunk_result.match_records) {
+            record.line_number += first_line_number;
+            match_records.push_back(record);
+        }
+        first_line_number += chunk_result.newline_count;
+        std::vector<match_record>().swap(chunk_result.match_records);
+
+        // You can add chunk statistics because every chunk starts just after a newline
+        if (file_statistics != nullptr) {
+            file_statistics->line_count += chunk_result.chunk_statistics.line_count;
+            file_statistics->word_count += chunk_result.chunk_statistics.word_count;
+            file_statistics->character_count += chunk_result.chunk_statistics.character_count;
+            file_statistics->inside_word = chunk_result.chunk_statistics.inside_word;
+            file_statistics->inside_line = chunk_result.chunk_statistics.inside_line;
+        }
+    }
+    if (file_statistics != nullptr) {
+        finish_content_statistics(*file_statistics);
+    }
+    return match_records;
+}
+
+// Function to search a large mapped file by scanning newline-aligned chunks on every core
+// Line numbers are fixed up from per-chunk newline counts and records keep file order
+template <typename LineMatcher>
+std::vector<match_record> search_mapped_content_parallel(std::string_view content, const LineMatcher& line_matcher,
+                                                         file_content_statistics* file_statistics = nullptr) {
+    std::vector<chunk_scan_result> chunk_results = split_content_into_chunks(content);
+
+    // You give every worker its own matcher because the regex engine caches states as it runs
+    size_t worker_count = std::min(search_thread_count(), chunk_results.size());
+    std::vector<LineMatcher> worker_matchers(worker_count, line_matcher);
+
+    run_parallel_tasks(chunk_results.size(), worker_count, [&](size_t worker_index, size_t chunk_index) {
+        scan_content_chunk(chunk_results[chunk_index], content.data(), worker_matchers[worker_index],
+                           file_statistics != nullptr);
+    });
+    return merge_chunk_results(chunk_results, file_statistics);
+}
+
+// Function to search a file that cannot be mapped by streaming it through a fixed buffer
+// Matching lines and the context lines they need are copied into the match set for display
+template <typename LineMatcher>
+search_match_set search_streamed_content(input_file_handle& input_file, const LineMatcher& line_matcher,
+                                         const context_window_options& context_window,
+                                         file_content_statistics* file_statistics = nullptr) {
+    search_match_set match_set;
+    std::vector<char> stream_buffer;
+    std::vector<std::string_view> preceding_lines;
+    line_ring_buffer earlier_lines(context_window.lines_before);
+    size_t carried_bytes = 0;
+    size_t next_line_number = 1;
+    size_t buffer_file_offset = 0;
+    size_t retain_through_line = 0; // Last line an earlier match still needs as after-context
+
+    // You keep only the current chunk, the partial line and the context ring resident
+    while (true) {
+        stream_buffer.resize(carried_bytes + SCAN_BLOCK_SIZE);
+        size_t bytes_read = input_file.read_some(stream_buffer.data() + carried_bytes, SCAN_BLOCK_SIZE);
+        size_t buffered_bytes = carried_bytes + bytes_read;
+        bool reached_end = bytes_read == 0;
+
+        const char* buffer_begin = stream_buffer.data();
+        const char* buffer_end = buffer_begin + buffered_bytes;
+
+        // You hand over only complete lines unless the stream has ended
+        const char* block_end = buffer_end;
+        if (!reached_end) {
+            const char* last_line_begin = find_line_begin(buffer_begin, buffer_end);
+            if (last_line_begin == buffer_begin) {
+                carried_bytes = buffered_bytes; // You grow the buffer for a line longer than one chunk
+                continue;
+            }
+            block_end = last_line_begin;
+        }
+
+        if (file_statistics != nullptr) {
+            accumulate_content_statistics(buffer_begin, block_end, *file_statistics);
+        }
+
+        // You keep the lines that start this block when earlier matches need them as after-context
+        const char* cursor = buffer_begin;
+        for (size_t line_number = next_line_number; line_number <= retain_through_line && cursor < block_end;
+             line_number++) {
+            const char* next_end = find_line_end(cursor, block_end);
+            match_set.retain_line(line_number, std::string_view(cursor, static_cast<size_t>(next_end - cursor)));
+            cursor = next_end + 1;
+        }
+
+        next_line_number = scan_lines_for_matches(buffer_begin, block_end, next_line_number, line_matcher,
+                                                  [&](size_t line_number, const char* line_begin, const char* line_end) {
+            match_record record = make_match_record(buffer_begin, line_number, line_begin, line_end, line_matcher);
+            record.line_offset += buffer_file_offset;
+            match_set.match_records.push_back(record);
+
+            // You take before-context from the ring first and this block for the rest
+            if (context_window.lines_before > 0) {
+                collect_lines_before(buffer_begin, line_begin, context_window.lines_before, preceding_lines);
+                size_t ring_lines = std::min(context_window.lines_before - preceding_lines.size(), earlier_lines.size());
+                size_t context_line_number = line_number - preceding_lines.size() - ring_lines;
+                for (size_t ring_index = earlier_lines.size() - ring_lines; ring_index < earlier_lines.size(); ring_index++) {
+                    match_set.retain_line(context_line_number++, earlier_lines.line(ring_index));
+                }
+                for (std::string_view preceding_line : preceding_lines) {
+                    match_set.retain_line(context_line_number++, preceding_line);
+                }
+            }
+            match_set.retain_line(line_number, std::string_view(line_begin, static_cast<size_t>(line_end - line_begin)));
+
+            // You keep the after-context inside this block now and the rest as later blocks arrive
+            retain_through_line = std::max(retain_through_line, line_number + context_window.lines_after);
+            const char* after_cursor = line_end;
+            for (size_t after_line = line_number + 1;
+                 after_line <= retain_through_line && after_cursor < block_end && after_cursor + 1 < block_end;
+                 after_line++) {
+                const char* next_end = find_line_end(after_cursor + 1, block_end);
+                match_set.retain_line(after_line, std::string_view(after_cursor + 1,
+                                                                   static_cast<size_t>(next_end - after_cursor - 1)));
+                after_cursor = next_end;
+            }
+        });
+
+        if (reached_end) {
+            break;
+        }
+
+        // You remember the block's final lines for before-context and carry the partial line forward
+        if (context_window.lines_before > 0) {
+            collect_lines_before(buffer_begin, block_end, context_window.lines_before, preceding_lines);
+            for (std::string_view preceding_line : preceding_lines) {
+                earlier_lines.push(preceding_line);
+            }
+        }
+        buffer_file_offset += static_cast<size_t>(block_end - buffer_begin);
+        carried_bytes = static_cast<size_t>(buffer_end - block_end);
+        std::memmove(stream_buffer.data(), block_end, carried_bytes);
+    }
+
+    if (file_statistics != nullptr) {
+        finish_content_statistics(*file_statistics);
+    }
+    return match_set;
+}
+
+// Compiled form of what the user typed at the search prompt
+struct compiled_query {
+    enum query_kind { literal_term, all_terms, pattern_list, regular_expression, fuzzy_term };
+
+    query_kind kind = literal_term;
+    std::string normalized_text; // Spelling shared by every query that matches the same lines, for cache keys
+    literal_term_matcher term_matcher;
+    all_terms_matcher terms_matcher;
+    aho_corasick_automaton pattern_matcher;
+    prefiltered_regex_matcher regex_matcher;
+    fuzzy_term_matcher fuzzy_matcher;
+};
+
+// Function to read one search term per line from a pattern list file
+inline bool load_pattern_list(const std::string& list_path, std::vector<std::string>& search_terms) {
+    std::ifstream list_file(list_path);
+    if (!list_file.is_open()) {
+        return false;
+    }
+
+    // You skip blank lines and strip Windows line endings from each term
+    std::string list_line;
+    while (std::getline(list_file, list_line)) {
+        if (!list_line.empty() && list_line.back() == '\r') {
+            list_line.pop_back();
+        }
+        if (list_line.find_first_not_of(" \t") != std::string::npos) {
+            search_terms.push_back(list_line);
+        }
+    }
+    return true;
+}
+
+// Function to split plain search input into its words at spaces and tabs
+inline std::vector<std::string> split_search_words(const std::string& search_input) {
+    std::vector<std::string> search_words;
+    size_t word_begin = search_input.find_first_not_of(" \t");
+    while (word_begin != std::string::npos) {
+        size_t word_end = search_input.find_first_of(" \t", word_begin);
+        search_words.push_back(search_input.substr(word_begin, word_end - word_begin));
+        word_begin = word_end == std::string::npos ? word_end : search_input.find_first_not_of(" \t", word_end);
+    }
+    return search_words;
+}
+
+// Function to compile the search input into a query
+// "@file" loads a list of terms for one-pass search, "re:" introduces a regular expression
+// and "~k:term" finds the term within k edits
+// Other input separated by spaces finds lines holding every word, and a "quoted phrase" is matched as typed
+inline bool prepare_search_query(const std::string& search_term, compiled_query& query, std::string& error_message) {
+    size_t fuzzy_separator = search_term.find(':');
+    if (search_term.size() > 1 && search_term[0] == '~' && fuzzy_separator != std::string::npos &&
+        fuzzy_separator > 1 && fuzzy_separator <= 3 &&
+        search_term.find_first_not_of("0123456789", 1) == fuzzy_separator) {
+        size_t maximum_distance = static_cast<size_t>(std::stoul(search_term.substr(1, fuzzy_separator - 1)));
+        if (!query.fuzzy_matcher.compile(search_term.substr(fuzzy_separator + 1), maximum_distance, error_message)) {
+            return false;
+        }
+        query.kind = compiled_query::fuzzy_term;
+        query.normalized_text = "~" + std::to_string(maximum_distance) + ":" +
+                                fold_search_term(search_term.substr(fuzzy_separator + 1));
+        return true;
+    }
+
+    if (search_term.compare(0, 3, "re:") == 0) {
+        if (!query.regex_matcher.compile(search_term.substr(3), error_message)) {
+            return false;
+        }
+        query.kind = compiled_query::regular_expression;
+        query.normalized_text = search_term;
+        return true;
+    }
+
+    if (search_term.size() > 1 && search_term[0] == '@') {
+        std::vector<std::string> search_terms;
+        if (!load_pattern_list(search_term.substr(1), search_terms)) {
+            error_message = "Cannot read pattern list '" + search_term.substr(1) + "'";
+            return false;
+        }
+
+        query.pattern_matcher.build(search_terms);
+        if (query.pattern_matcher.pattern_count() == 0) {
+            error_message = "Pattern list '" + search_term.substr(1) + "' contains no search terms";
+            return false;
+        }
+        query.kind = compiled_query::pattern_list;
+
+        // You key the list by its terms rather than its file name, so editing the list changes the key
+        query.normalized_text = "@";
+        for (const std::string& listed_term : search_terms) {
+            query.normalized_text += "\n" + fold_search_term(listed_term);
+        }
+        return true;
+    }
+
+    // You split plain input into words; several words must all appear on a line, in any order
+    std::string literal_text = search_term;
+    if (search_term.size() >= 2 && search_term.front() == '"' && search_term.back() == '"') {
+        literal_text = search_term.substr(1, search_term.size() - 2);
+        if (literal_text.empty()) {
+            error_message = "Quoted phrase is empty";
+            return false;
+        }
+    } else {
+        std::vector<std::string> search_words = split_search_words(search_term);
+        if (search_words.size() > 1) {
+            query.terms_matcher.compile(search_words);
+        }
+        if (query.terms_matcher.term_count() > 1) {
+            // You key the terms in sorted order, since their order on the command line does not matter
+            std::vector<std::string> sorted_terms;
+            for (size_t term_index = 0; term_index < query.terms_matcher.term_count(); term_index++) {
+                sorted_terms.push_back(query.terms_matcher.folded_term(term_index));
+            }
+            std::sort(sorted_terms.begin(), sorted_terms.end());
+            query.kind = compiled_query::all_terms;
+            query.normalized_text = "&";
+            for (const std::string& sorted_term : sorted_terms) {
+                query.normalized_text += "\n" + sorted_term;
+            }
+            return true;
+        }
+        if (!search_words.empty()) {
+            literal_text = search_words[0]; // You search a single word, or one word repeated, as a plain term
+        }
+    }
+
+    // You lowercase the search term a single time for the whole scan
+    query.kind = compiled_query::literal_term;
+    query.term_matcher.folded_term = fold_search_term(literal_text);
+    query.normalized_text = "=" + query.term_matcher.folded_term;
+    return true;
+}
+
+// Function to derive the trigram condition every line matching a query satisfies, for index lookups
+inline trigram_plan query_index_plan(const compiled_query& query) {
+    switch (query.kind) {
+        case compiled_query::pattern_list: {
+            std::vector<std::string> folded_terms;
+            for (size_t pattern_index = 0; pattern_index < query.pattern_matcher.pattern_count(); pattern_index++) {
+                folded_terms.push_back(fold_search_term(query.pattern_matcher.pattern_text(pattern_index)));
+            }
+            return plan_for_any_literal(folded_terms);
+        }
+        case compiled_query::all_terms: {
+            std::vector<trigram_plan> term_plans;
+            for (size_t term_index = 0; term_index < query.terms_matcher.term_count(); term_index++) {
+                term_plans.push_back(plan_for_literal(query.terms_matcher.folded_term(term_index)));
+            }
+            return plan_all_of(std::move(term_plans));
+        }
+        case compiled_query::regular_expression:
+            return query.regex_matcher.index_plan();
+        case compiled_query::fuzzy_term:
+            return query.fuzzy_matcher.index_plan();
+        default:
+            return plan_for_literal(query.term_matcher.folded_term);
+    }
+}
+
+// Function to run a visitor with the concrete matcher a query compiled to
+template <typename MatcherVisitor>
+auto visit_query_matcher(const compiled_query& query, MatcherVisitor&& matcher_visitor) {
+    if (query.kind == compiled_query::all_terms) {
+        return matcher_visitor(query.terms_matcher);
+    }
+    if (query.kind == compiled_query::pattern_list) {
+        return matcher_visitor(query.pattern_matcher);
+    }
+    if (query.kind == compiled_query::regular_expression) {
+        return matcher_visitor(query.regex_matcher);
+    }
+    if (query.kind == compiled_query::fuzzy_term) {
+        return matcher_visitor(query.fuzzy_matcher);
+    }
+    return matcher_visitor(query.term_matcher);
+}
+
+// Function to search a file that is already mapped; the match set keeps the mapping alive for display
+inline search_match_set search_mapped_file(std::shared_ptr<const mapped_file_region> mapped_file,
+                                           const compiled_query& query,
+                                           file_content_statistics* file_statistics = nullptr) {
+    return visit_query_matcher(query, [&](const auto& line_matcher) {
+        search_match_set match_set;
+
+        // You split large files across cores and keep small ones on this thread
+        if (search_thread_count() > 1 && mapped_file->size() >= PARALLEL_SCAN_MIN_SIZE) {
+            match_set.match_records = search_mapped_content_parallel(mapped_file->content(), line_matcher,
+                                                                     file_statistics);
+        } else {
+            match_set.match_records = search_mapped_content(mapped_file->content(), line_matcher,
+                                                            file_statistics);
+        }
+        match_set.attach_mapped_content(std::move(mapped_file));
+        return match_set;
+    });
+}
+
+// Function to search an already opened file, optionally gathering statistics in the same pass
+// The context window only matters for streamed input, whose context lines must be kept while reading
+inline search_match_set search_opened_file(input_file_handle& input_file, const compiled_query& query,
+                                    const context_window_options& context_window,
+                                    file_content_statistics* file_statistics = nullptr) {
+    // You scan the mapped bytes in place whenever the file can be memory-mapped
+    std::shared_ptr<mapped_file_region> mapped_file = std::make_shared<mapped_file_region>();
+    if (mapped_file->map(input_file)) {
+        return search_mapped_file(std::move(mapped_file), query, file_statistics);
+    }
+
+    // You fall back to buffered streaming for pipes and files that cannot be mapped
+    return visit_query_matcher(query, [&](const auto& line_matcher) {
+        return search_streamed_content(input_file, line_matcher, context_window, file_statistics);
+    });
+}
+
+// Bytes inspected for NUL characters before a directory search treats a file as binary
+const size_t BINARY_SNIFF_SIZE = 8192;
+
+// Finished results a reorder buffer may hold per worker before new work stops being admitted
+const size_t REORDER_WINDOW_PER_WORKER = 8;
+
+// Bytes of finished results a reorder buffer may hold before only the blocking result is awaited
+const size_t REORDER_BUFFER_BYTE_LIMIT = 64 << 20;
+
+// How long and how much finished work waited behind an unfinished earlier result
+struct reorder_buffer_statistics {
+    size_t delayed_results = 0;
+    size_t peak_held_results = 0;
+    size_t peak_held_bytes = 0;
+    double blocked_seconds = 0.0;
+};
+
+// Bounded buffer that takes results in any order and emits them in sequence order
+// Producers ask admission_limit before starting new work so memory stays capped
+template <typename ResultType>
+class reorder_buffer {
+public:
+    typedef std::function<void(ResultType&)> result_emitter;
+
+    reorder_buffer(size_t window_size, size_t byte_limit, result_emitter emitter)
+        : window_size(std::max<size_t>(1, window_size)), byte_limit(byte_limit), emit_result(std::move(emitter)) {}
+
+    // You emit a result at once when it is next in order and hold it otherwise
+    void publish(size_t sequence_number, ResultType result, size_t result_bytes) {
+        std::lock_guard<std::mutex> buffer_lock(buffer_mutex);
+        if (sequence_number != next_sequence) {
+            if (held_results.empty()) {
+                blocked_since = std::chrono::steady_clock::now();
+            }
+            held_results.emplace(sequence_number, held_result{std::move(result), result_bytes});
+            held_bytes += result_bytes;
+            buffer_statistics.delayed_results++;
+            buffer_statistics.peak_held_results = std::max(buffer_statistics.peak_held_results, held_results.size());
+            buffer_statistics.peak_held_bytes = std::max(buffer_statistics.peak_held_bytes, held_bytes);
+            return;
+        }
+
+        emit_result(result);
+        next_sequence++;
+
+        // You release every held result the new arrival was blocking
+        bool was_blocking = !held_results.empty();
+        while (!held_results.empty() && held_results.begin()->first == next_sequence) {
+            emit_result(held_results.begin()->second.result);
+            held_bytes -= held_results.begin()->second.result_bytes;
+            held_results.erase(held_results.begin());
+            next_sequence++;
+        }
+        if (was_blocking && held_results.empty()) {
+            buffer_statistics.blocked_seconds +=
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - blocked_since).count();
+        }
+    }
+
+    // You allow work up to one window past the oldest unfinished result, or none beyond it once memory is full
+    size_t admission_limit() {
+        std::lock_guard<std::mutex> buffer_lock(buffer_mutex);
+        return next_sequence + (held_bytes > byte_limit ? 1 : window_size);
+    }
+
+    reorder_buffer_statistics statistics() {
+        std::lock_guard<std::mutex> buffer_lock(buffer_mutex);
+        return buffer_statistics;
+    }
+
+private:
+    struct held_result {
+        ResultType result;
+        size_t result_bytes;
+    };
+
+    size_t window_size;
+    size_t byte_limit;
+    result_emitter emit_result;
+    std::mutex buffer_mutex;
+    std::map<size_t, held_result> held_results;
+    size_t held_bytes = 0;
+    size_t next_sequence = 0;
+    std::chrono::steady_clock::time_point blocked_since;
+    reorder_buffer_statistics buffer_statistics;
+};
+
+// Matches found in one file of a directory search
+struct directory_file_result {
+    std::string file_path;
+    search_match_set file_matches;
+    file_content_statistics file_statistics; // Gathered in the same scan, only when the search asks for it
+};
+
+// Totals reported at the end of a directory search
+struct directory_search_summary {
+    size_t files_searched = 0;
+    size_t files_skipped = 0;
+    size_t unreadable_entries = 0;
+    size_t admission_throttles = 0;
+    reorder_buffer_statistics ordering_statistics;
+};
+
+// Directory of a search whose sorted entries fix where its files fall in the output order
+// A subdirectory sorts under its name plus '/', so walking the entries in order lists the files in full-path order
+struct ordered_directory {
+    struct directory_entry {
+        std::string sort_key;
+        std::string entry_path;
+        std::shared_ptr<ordered_directory> subdirectory; // Set for directories, which are listed by their own task
+    };
+
+    bool listed = false;
+    std::vector<directory_entry> entries;
+    size_t next_entry = 0;
+};
+
+// Shared state of one recursive directory search
+struct directory_search_job {
+    directory_search_job(const compiled_query& query, const context_window_options& context, size_t worker_count,
+                         reorder_buffer<directory_file_result>::result_emitter emitter)
+        : worker_queries(worker_count, query), context_window(context), search_pool(worker_count),
+          ordered_results(worker_count * REORDER_WINDOW_PER_WORKER, REORDER_BUFFER_BYTE_LIMIT, std::move(emitter)) {}
+
+    std::vector<compiled_query> worker_queries; // One copy per worker for the regex engine's state cache
+    context_window_options context_window;
+    bool gather_statistics = false;
+    work_stealing_pool search_pool;
+    reorder_buffer<directory_file_result> ordered_results;
+
+    // You number files in path order as soon as every directory before them is listed, guarded by admission_mutex
+    std::mutex admission_mutex;
+    std::vector<std::shared_ptr<ordered_directory>> ordering_stack; // Directories the walk is inside, innermost last
+    std::deque<std::string> ordered_files;                          // Numbered but not yet submitted
+    size_t ordered_file_count = 0;
+    size_t next_file_to_submit = 0;
+
+    std::atomic<size_t> files_searched{0};
+    std::atomic<size_t> files_skipped{0};
+    std::atomic<size_t> unreadable_entries{0};
+    std::atomic<size_t> admission_throttles{0};
+};
+
+// Large file of a directory search split into chunk tasks that share its mapping
+struct large_file_search {
+    size_t file_sequence = 0;
+    std::string file_path;
+    input_file_handle input_file;
+    std::shared_ptr<mapped_file_region> mapped_file = std::make_shared<mapped_file_region>();
+    std::vector<chunk_scan_result> chunk_results;
+    std::atomic<size_t> chunks_remaining{0};
+};
+
+inline void search_directory_file(directory_search_job& search_job, size_t file_sequence, std::string file_path,
+                                  size_t worker_index);
+
+// Function to number the files of every listed directory in path order, stopping at the first unlisted one
+// Must be called with admission_mutex held
+inline void advance_file_order(directory_search_job& search_job) {
+    while (!search_job.ordering_stack.empty() && search_job.ordering_stack.back()->listed) {
+        ordered_directory& current_directory = *search_job.ordering_stack.back();
+        if (current_directory.next_entry == current_directory.entries.size()) {
+            search_job.ordering_stack.pop_back(); // You release a directory once all its files are numbered
+            continue;
+        }
+        ordered_directory::directory_entry& next_entry = current_directory.entries[current_directory.next_entry++];
+        if (next_entry.subdirectory) {
+            search_job.ordering_stack.push_back(std::move(next_entry.subdirectory));
+        } else {
+            search_job.ordered_files.push_back(std::move(next_entry.entry_path));
+            search_job.ordered_file_count++;
+        }
+    }
+}
+
+// Function to queue as many of the numbered files as the reorder window admits
+// Files go through the pool's shared queue so they start in path order
+inline void submit_admitted_files(directory_search_job& search_job) {
+    std::lock_guard<std::mutex> admission_lock(search_job.admission_mutex);
+    advance_file_order(search_job);
+    size_t admission_limit = search_job.ordered_results.admission_limit();
+    while (search_job.next_file_to_submit < search_job.ordered_file_count &&
+           search_job.next_file_to_submit < admission_limit) {
+        size_t file_sequence = search_job.next_file_to_submit++;
+        std::string file_path = std::move(search_job.ordered_files.front());
+        search_job.ordered_files.pop_front();
+        search_job.search_pool.submit_shared([&search_job, file_sequence, file_path](size_t search_worker) {
+            search_directory_file(search_job, file_sequence, file_path, search_worker);
+        });
+    }
+
+    // You count the times fast workers were held back so they could not run too far ahead
+    if (search_job.next_file_to_submit < search_job.ordered_file_count) {
+        search_job.admission_throttles++;
+    }
+}
+
+// Function to hand one file's matches to the reorder buffer and admit the files it was holding back
+// Every admitted file must be recorded exactly once, even when it is skipped
+inline void record_directory_file_result(directory_search_job& search_job, size_t file_sequence, std::string file_path,
+                                  search_match_set file_matches,
+                                  const file_content_statistics& file_statistics = file_content_statistics()) {
+    size_t result_bytes = file_matches.footprint_bytes();
+    search_job.ordered_results.publish(
+        file_sequence, directory_file_result{std::move(file_path), std::move(file_matches), file_statistics},
+        result_bytes);
+    submit_admitted_files(search_job);
+}
+
+// Function to split a large mapped file into chunk scan tasks in the directory search pool
+inline void submit_large_file_search(directory_search_job& search_job, std::shared_ptr<large_file_search> large_file,
+                              size_t worker_index) {
+    large_file->chunk_results = split_content_into_chunks(large_file->mapped_file->content());
+    large_file->chunks_remaining = large_file->chunk_results.size();
+
+    for (size_t chunk_index = 0; chunk_index < large_file->chunk_results.size(); chunk_index++) {
+        search_job.search_pool.submit(worker_index, [&search_job, large_file, chunk_index](size_t scan_worker) {
+            visit_query_matcher(search_job.worker_queries[scan_worker], [&](const auto& line_matcher) {
+                scan_content_chunk(large_file->chunk_results[chunk_index], large_file->mapped_file->data(),
+                                   line_matcher, search_job.gather_statistics);
+            });
+
+            // You let the last chunk to finish merge the records in file order
+            if (--large_file->chunks_remaining == 0) {
+                search_match_set file_matches;
+                file_content_statistics file_statistics;
+                file_matches.match_records = merge_chunk_results(
+                    large_file->chunk_results, search_job.gather_statistics ? &file_statistics : nullptr);
+                file_matches.attach_mapped_content(large_file->mapped_file);
+                search_job.files_searched++;
+                record_directory_file_result(search_job, large_file->file_sequence, large_file->file_path,
+                                             std::move(file_matches), file_statistics);
+            }
+        });
+    }
+}
+
+// Function to search one file found during a directory search
+inline void search_directory_file(directory_search_job& search_job, size_t file_sequence, std::string file_path,
+                                  size_t worker_index) {
+    std::shared_ptr<large_file_search> large_file = std::make_shared<large_file_search>();
+    large_file->file_sequence = file_sequence;
+    large_file->file_path = std::move(file_path);
+    if (!large_file->input_file.open(large_file->file_path)) {
+        search_job.unreadable_entries++;
+        record_directory_file_result(search_job, file_sequence, large_file->file_path, search_match_set());
+        return;
+    }
+
+    // You skip content that looks binary before spending a full scan on it
+    if (large_file->mapped_file->map(large_file->input_file)) {
+        std::string_view content = large_file->mapped_file->content();
+        if (std::memchr(content.data(), '\0', std::min(content.size(), BINARY_SNIFF_SIZE)) != nullptr) {
+            search_job.files_skipped++;
+            record_directory_file_result(search_job, file_sequence, large_file->file_path, search_match_set());
+            return;
+        }
+
+        // You split big files into chunk tasks so one huge log cannot keep a single core busy
+        if (content.size() >= PARALLEL_SCAN_MIN_SIZE && search_job.search_pool.worker_count() > 1) {
+            submit_large_file_search(search_job, large_file, worker_index);
+            return;
+        }
+    }
+
+    file_content_statistics file_statistics;
+    file_content_statistics* gathered_statistics = search_job.gather_statistics ? &file_statistics : nullptr;
+    search_match_set file_matches = visit_query_matcher(
+        search_job.worker_queries[worker_index], [&](const auto& line_matcher) {
+            if (large_file->mapped_file->mapped()) {
+                search_match_set mapped_matches;
+                mapped_matches.match_records = search_mapped_content(large_file->mapped_file->content(), line_matcher,
+                                                                     gathered_statistics);
+                mapped_matches.attach_mapped_content(large_file->mapped_file);
+                return mapped_matches;
+            }
+            return search_streamed_content(large_file->input_file, line_matcher, search_job.context_window,
+                                           gathered_statistics);
+        });
+    search_job.files_searched++;
+    record_directory_file_result(search_job, file_sequence, large_file->file_path, std::move(file_matches),
+                                 file_statistics);
+}
+
+// Function to list one directory, queueing a task for every subdirectory and sorting its candidate text files
+// The listing is published to the file order at once, so its files can be searched while deeper directories are read
+inline void traverse_search_directory(directory_search_job& search_job, const std::filesystem::path& directory_path,
+                               std::shared_ptr<ordered_directory> listed_directory, size_t worker_index) {
+    std::error_code iteration_error;
+    std::filesystem::directory_iterator directory_entries(
+        directory_path, std::filesystem::directory_options::skip_permission_denied, iteration_error);
+
+    std::vector<ordered_directory::directory_entry> listed_entries;
+    for (; !iteration_error && directory_entries != std::filesystem::directory_iterator();
+         directory_entries.increment(iteration_error)) {
+        // You do not follow symbolic links, so the traversal cannot loop
+        std::error_code status_error;
+        std::filesystem::file_status entry_status = directory_entries->symlink_status(status_error);
+        std::filesystem::path entry_path = directory_entries->path();
+
+        if (std::filesystem::is_directory(entry_status)) {
+            std::shared_ptr<ordered_directory> subdirectory = std::make_shared<ordered_directory>();
+            listed_entries.push_back({entry_path.filename().string() + "/", entry_path.string(), subdirectory});
+            search_job.search_pool.submit(worker_index, [&search_job, entry_path, subdirectory](size_t traversal_worker) {
+                traverse_search_directory(search_job, entry_path, subdirectory, traversal_worker);
+            });
+        } else if (std::filesystem::is_regular_file(entry_status)) {
+            // You use the quiet format check as a cheap filter before any file is opened
+            std::string file_path = entry_path.string();
+            if (!is_supported_text_format(file_path)) {
+                search_job.files_skipped++;
+                continue;
+            }
+            listed_entries.push_back({entry_path.filename().string(), std::move(file_path), nullptr});
+        }
+    }
+
+    if (iteration_error) {
+        search_job.unreadable_entries++;
+    }
+
+    std::sort(listed_entries.begin(), listed_entries.end(),
+              [](const ordered_directory::directory_entry& left, const ordered_directory::directory_entry& right) {
+                  return left.sort_key < right.sort_key;
+              });
+    {
+        std::lock_guard<std::mutex> admission_lock(search_job.admission_mutex);
+        listed_directory->entries = std::move(listed_entries);
+        listed_directory->listed = true;
+    }
+    submit_admitted_files(search_job);
+}
+
+// Function to search every text file below a directory on all cores
+// Listing and searching share the pool: a file is numbered and admitted as soon as every directory ahead of it
+// in path order has been listed, and files are emitted in that order through a bounded reorder buffer
+inline directory_search_summary search_directory_tree(const std::string& directory_path, const compiled_query& query,
+                                               const context_window_options& context_window,
+                                               reorder_buffer<directory_file_result>::result_emitter on_file_result,
+                                               bool gather_statistics = false) {
+    directory_search_job search_job(query, context_window, search_thread_count(), std::move(on_file_result));
+    search_job.gather_statistics = gather_statistics;
+
+    std::shared_ptr<ordered_directory> root_directory = std::make_shared<ordered_directory>();
+    search_job.ordering_stack.push_back(root_directory);
+    search_job.search_pool.submit(0, [&search_job, directory_path, root_directory](size_t worker_index) {
+        traverse_search_directory(search_job, directory_path, root_directory, worker_index);
+    });
+    search_job.search_pool.run();
+
+    directory_search_summary search_summary;
+    search_summary.files_searched = search_job.files_searched;
+    search_summary.files_skipped = search_job.files_skipped;
+    search_summary.unreadable_entries = search_job.unreadable_entries;
+    search_summary.admission_throttles = search_job.admission_throttles;
+    search_summary.ordering_statistics = search_job.ordered_results.statistics();
+    return search_summary;
+}
+
+// BM25 parameters at their customary values: how quickly repeated terms stop adding weight,
+// and how strongly a long document is discounted against the average length
+const double BM25_TERM_SATURATION = 1.2;
+const double BM25_LENGTH_WEIGHT = 0.75;
+
+// One file kept by a relevance ranking
+struct ranked_file {
+    std::string file_path;
+    double relevance_score = 0;
+    size_t matching_lines = 0;
+    size_t word_count = 0;
+};
+
+// One matching line of a file, ranked by its own relevance
+struct ranked_line {
+    size_t record_index; // Position among the file's match records
+    double relevance_score;
+};
+
+// Function to list the folded terms whose frequencies rank a query's results
+// Regex and fuzzy queries have no fixed terms and are ranked by how many lines match instead
+inline std::vector<std::string> query_ranking_terms(const compiled_query& query) {
+    std::vector<std::string> ranking_terms;
+    switch (query.kind) {
+        case compiled_query::literal_term:
+            ranking_terms.push_back(query.term_matcher.folded_term);
+            break;
+        case compiled_query::all_terms:
+            for (size_t term_index = 0; term_index < query.terms_matcher.term_count(); term_index++) {
+                ranking_terms.push_back(query.terms_matcher.folded_term(term_index));
+            }
+            break;
+        case compiled_query::pattern_list:
+            for (size_t pattern_index = 0; pattern_index < query.pattern_matcher.pattern_count(); pattern_index++) {
+                ranking_terms.push_back(fold_search_term(query.pattern_matcher.pattern_text(pattern_index)));
+            }
+            break;
+        default:
+            break;
+    }
+    return ranking_terms;
+}
+
+// Function to count the non-overlapping occurrences of a folded term within a line
+inline uint32_t count_term_occurrences(const char* line_begin, const char* line_end, const std::string& folded_term) {
+    uint32_t occurrence_count = 0;
+    for (const char* match_position = find_case_insensitive(line_begin, line_end, folded_term);
+         match_position != nullptr;
+         match_position = find_case_insensitive(match_position + folded_term.size(), line_end, folded_term)) {
+        occurrence_count++;
+    }
+    return occurrence_count;
+}
+
+// Function to count the words of one line with the separators file statistics use
+inline size_t count_line_words(std::string_view line_text) {
+    size_t word_count = 0;
+    bool inside_word = false;
+    for (unsigned char byte_value : line_text) {
+        bool separator = is_word_separator(byte_value);
+        word_count += (!separator && !inside_word) ? 1 : 0;
+        inside_word = !separator;
+    }
+    return word_count;
+}
+
+// Function to weigh one term's frequency in a document against the document's length, as BM25 does
+inline double bm25_term_weight(double term_frequency, double document_length, double average_length) {
+    double length_ratio = average_length > 0 ? document_length / average_length : 1;
+    return term_frequency * (BM25_TERM_SATURATION + 1) /
+           (term_frequency + BM25_TERM_SATURATION * (1 - BM25_LENGTH_WEIGHT + BM25_LENGTH_WEIGHT * length_ratio));
+}
+
+// Function to weigh a term by how few documents hold it; never negative, even for terms in every document
+inline double bm25_inverse_frequency(size_t document_count, size_t documents_with_term) {
+    double holding_documents = static_cast<double>(documents_with_term);
+    return std::log(1 + (static_cast<double>(document_count) - holding_documents + 0.5) / (holding_documents + 0.5));
+}
+
+// BM25 ranking of searched files, fed one file at a time in the order a search emits them
+// Only a compact entry per matching file is kept; match sets are dropped as soon as they are counted
+class relevance_ranker {
+public:
+    explicit relevance_ranker(const compiled_query& query)
+        : ranking_terms(query_ranking_terms(query)),
+          counted_terms(std::max<size_t>(1, ranking_terms.size())),
+          documents_with_term(counted_terms, 0) {}
+
+    // You count every searched file toward the corpus size and average length
+    // Word counts come from the statistics gathered in the search's own scan
+    void add_file(const std::string& file_path, const search_match_set& match_set,
+                  const file_content_statistics& file_statistics) {
+        searched_documents++;
+        total_words += file_statistics.word_count;
+        if (match_set.match_records.empty()) {
+            return;
+        }
+
+        std::vector<uint32_t> file_frequencies(counted_terms, 0);
+        for (const match_record& record : match_set.match_records) {
+            add_line_frequencies(match_set.line_text(record), file_frequencies);
+        }
+        for (size_t term_index = 0; term_index < counted_terms; term_index++) {
+            documents_with_term[term_index] += file_frequencies[term_index] > 0 ? 1 : 0;
+        }
+        term_frequencies.insert(term_frequencies.end(), file_frequencies.begin(), file_frequencies.end());
+        path_offsets.push_back(path_bytes.size());
+        path_bytes += file_path;
+        document_words.push_back(file_statistics.word_count);
+        matching_lines.push_back(match_set.match_records.size());
+    }
+
+    // You score every matching file and keep the best in a min-heap bounded by the limit; ties go to the earlier path
+    std::vector<ranked_file> top_files(size_t result_limit) const {
+        std::vector<double> term_weights = inverse_frequencies();
+        double average_length = searched_documents > 0 ? static_cast<double>(total_words) / searched_documents : 0;
+        auto ranks_higher = [](const std::pair<double, size_t>& left, const std::pair<double, size_t>& right) {
+            return left.first > right.first || (left.first == right.first && left.second < right.second);
+        };
+        std::vector<std::pair<double, size_t>> best_files; // Heap whose front is the weakest file kept
+
+        for (size_t file_index = 0; file_index < document_words.size() && result_limit > 0; file_index++) {
+            double relevance_score = 0;
+            for (size_t term_index = 0; term_index < counted_terms; term_index++) {
+                relevance_score += term_weights[term_index] *
+                                   bm25_term_weight(term_frequencies[file_index * counted_terms + term_index],
+                                                    static_cast<double>(document_words[file_index]), average_length);
+            }
+            std::pair<double, size_t> scored_file(relevance_score, file_index);
+            if (best_files.size() < result_limit) {
+                best_files.push_back(scored_file);
+                std::push_heap(best_files.begin(), best_files.end(), ranks_higher);
+            } else if (ranks_higher(scored_file, best_files.front())) {
+                std::pop_heap(best_files.begin(), best_files.end(), ranks_higher);
+                best_files.back() = scored_file;
+                std::push_heap(best_files.begin(), best_files.end(), ranks_higher);
+            }
+        }
+
+        std::sort_heap(best_files.begin(), best_files.end(), ranks_higher);
+        std::vector<ranked_file> ranked_files;
+        for (const std::pair<double, size_t>& scored_file : best_files) {
+            size_t file_index = scored_file.second;
+            size_t path_end = file_index + 1 < path_offsets.size() ? path_offsets[file_index + 1] : path_bytes.size();
+            ranked_files.push_back(ranked_file{path_bytes.substr(path_offsets[file_index], path_end - path_offsets[file_index]),
+                                               scored_file.first, matching_lines[file_index], document_words[file_index]});
+        }
+        return ranked_files;
+    }
+
+    // You rank the matching lines of one file by the same formula, each line taken as a short document
+    // Term weights come from the whole ranking, and lengths are measured against the file's matching lines
+    std::vector<ranked_line> top_lines(const search_match_set& match_set, size_t result_limit) const {
+        std::vector<double> term_weights = inverse_frequencies();
+        std::vector<size_t> line_words;
+        size_t total_line_words = 0;
+        for (const match_record& record : match_set.match_records) {
+            line_words.push_back(count_line_words(match_set.line_text(record)));
+            total_line_words += line_words.back();
+        }
+        double average_length = line_words.empty() ? 0 : static_cast<double>(total_line_words) / line_words.size();
+
+        std::vector<ranked_line> ranked_lines;
+        std::vector<uint32_t> line_frequencies(counted_terms);
+        for (size_t record_index = 0; record_index < match_set.match_records.size(); record_index++) {
+            std::fill(line_frequencies.begin(), line_frequencies.end(), 0);
+            add_line_frequencies(match_set.line_text(match_set.match_records[record_index]), line_frequencies);
+            double relevance_score = 0;
+            for (size_t term_index = 0; term_index < counted_terms; term_index++) {
+                relevance_score += term_weights[term_index] * bm25_term_weight(line_frequencies[term_index],
+                                                                               static_cast<double>(line_words[record_index]),
+                                                                               average_length);
+            }
+            ranked_lines.push_back(ranked_line{record_index, relevance_score});
+        }
+
+        // You keep only the best lines, in score order, with earlier lines first on ties
+        auto ranks_higher = [](const ranked_line& left, const ranked_line& right) {
+            return left.relevance_score > right.relevance_score ||
+                   (left.relevance_score == right.relevance_score && left.record_index < right.record_index);
+        };
+        size_t kept_lines = std::min(result_limit, ranked_lines.size());
+        std::partial_sort(ranked_lines.begin(), ranked_lines.begin() + kept_lines, ranked_lines.end(), ranks_higher);
+        ranked_lines.resize(kept_lines);
+        return ranked_lines;
+    }
+
+    size_t document_count() const { return searched_documents; }
+    size_t matching_document_count() const { return document_words.size(); }
+
+private:
+    // You add one line's term counts; without fixed terms, the line itself counts once
+    void add_line_frequencies(std::string_view line_text, std::vector<uint32_t>& frequencies) const {
+        if (ranking_terms.empty()) {
+            frequencies[0]++;
+            return;
+        }
+        for (size_t term_index = 0; term_index < ranking_terms.size(); term_index++) {
+            frequencies[term_index] +=
+                count_term_occurrences(line_text.data(), line_text.data() + line_text.size(), ranking_terms[term_index]);
+        }
+    }
+
+    std::vector<double> inverse_frequencies() const {
+        std::vector<double> term_weights;
+        for (size_t term_index = 0; term_index < counted_terms; term_index++) {
+            term_weights.push_back(bm25_inverse_frequency(searched_documents, documents_with_term[term_index]));
+        }
+        return term_weights;
+    }
+
+    std::vector<std::string> ranking_terms;
+    size_t counted_terms;
+    std::vector<size_t> documents_with_term;
+    size_t searched_documents = 0;
+    size_t total_words = 0;
+
+    // You store matching files column by column, with all paths in one buffer, to keep each entry small
+    std::string path_bytes;
+    std::vector<size_t> path_offsets;
+    std::vector<size_t> document_words;
+    std::vector<size_t> matching_lines;
+    std::vector<uint32_t> term_frequencies; // counted_terms entries per matching file
+};
+
+// Bytes of file content each trigram index block covers before its end moves forward to a newline
+// Blocks end on line boundaries, so a matching line always lies inside a single block
+const size_t INDEX_BLOCK_SIZE = 64 << 10;
+
+// Files read together while building or searching an index, which bounds memory between merges
+const size_t INDEX_BATCH_FILES = 256;
+
+// Tag at the start of a saved trigram index, followed by the format version
+const uint32_t TRIGRAM_INDEX_MAGIC = 0x58495354; // "TSIX" in little-endian byte order
+const uint32_t TRIGRAM_INDEX_VERSION = 3;
+
+// Fixed header of an index image; every table it locates starts on an 8-byte boundary
+// The image is little-endian and used in place, so opening an index costs the same at any size
+struct index_image_header {
+    uint32_t index_magic;
+    uint32_t index_version;
+    uint32_t header_size;
+    uint32_t reserved;
+    uint64_t file_count;
+    uint64_t block_count;
+    uint64_t trigram_count;
+    uint64_t posting_count;
+    uint64_t skip_count;
+    uint64_t files_offset;           // index_file_entry[file_count]
+    uint64_t paths_offset;           // Path bytes the file entries point into
+    uint64_t paths_size;
+    uint64_t blocks_offset;          // index_block_entry[block_count]
+    uint64_t keys_offset;            // uint32_t[trigram_count], ascending
+    uint64_t lists_offset;           // index_posting_list[trigram_count], one per key
+    uint64_t skips_offset;           // index_posting_skip[skip_count], one per packed group
+    uint64_t packed_offset;          // Bit-packed groups and varint tails of block number gaps
+    uint64_t packed_size;
+    uint64_t image_size;
+    uint64_t content_checksum;       // Covers every byte after the header
+    uint64_t header_checksum;        // Covers the header with this field zeroed
+};
+
+// One indexed file: its path, its blocks and the identity it had when indexed
+struct index_file_entry {
+    uint64_t path_offset;
+    uint64_t path_length;
+    uint64_t first_block;
+    uint64_t block_count;
+    uint64_t device_id;
+    uint64_t inode_number;
+    uint64_t file_size;
+    int64_t modified_nanoseconds;
+};
+
+// One line-aligned block of an indexed file
+struct index_block_entry {
+    uint64_t block_offset;
+    uint64_t block_size;
+    uint64_t first_line_number;
+};
+
+static_assert(sizeof(index_image_header) == 152, "index header layout must not depend on the compiler");
+static_assert(sizeof(index_file_entry) == 64, "index file entry layout must not depend on the compiler");
+static_assert(sizeof(index_block_entry) == 24, "index block entry layout must not depend on the compiler");
+
+// Function to tell whether this machine stores integers little-endian, as index images do
+inline bool host_is_little_endian() {
+    const uint32_t probe_value = 1;
+    unsigned char first_byte = 0;
+    std::memcpy(&first_byte, &probe_value, 1);
+    return first_byte == 1;
+}
+
+// Function to checksum index bytes eight at a time, fast enough to verify a large index at disk speed
+inline uint64_t checksum_index_bytes(const char* data, size_t size, uint64_t checksum = 0x9E3779B97F4A7C15ULL) {
+    size_t word_count = size / 8;
+    for (size_t word_index = 0; word_index < word_count; word_index++) {
+        uint64_t word_value;
+        std::memcpy(&word_value, data + word_index * 8, 8);
+        checksum ^= word_value;
+        checksum = ((checksum << 29) | (checksum >> 35)) * 0xBF58476D1CE4E5B9ULL;
+    }
+    for (size_t byte_index = word_count * 8; byte_index < size; byte_index++) {
+        checksum = (checksum ^ static_cast<unsigned char>(data[byte_index])) * 1099511628211ULL;
+    }
+    return checksum;
+}
+
+// Function to checksum an index header as stored, with its own checksum field taken as zero
+inline uint64_t checksum_index_header(const index_image_header& image_header) {
+    index_image_header zeroed_header = image_header;
+    zeroed_header.header_checksum = 0;
+    return checksum_index_bytes(reinterpret_cast<const char*>(&zeroed_header), sizeof(zeroed_header));
+}
+
+// Function to write an index or sidecar image exactly as it will later be mapped
+inline bool write_image_file(const std::string& image_path, const char* image_data, size_t image_size) {
+    std::ofstream image_file(image_path, std::ios::binary | std::ios::trunc);
+    image_file.write(image_data, static_cast<std::streamsize>(image_size));
+    image_file.close();
+    return static_cast<bool>(image_file);
+}
+
+// Function to map a saved image, copying it into 8-byte-aligned words only where it cannot be mapped
+inline bool read_image_file(const std::string& image_path, std::shared_ptr<const mapped_file_region>& image_mapping,
+                            std::vector<uint64_t>& owned_image, const char*& image_data, size_t& image_size) {
+    input_file_handle input_file;
+    if (!input_file.open(image_path)) {
+        return false;
+    }
+    std::shared_ptr<mapped_file_region> mapped_file = std::make_shared<mapped_file_region>();
+    if (mapped_file->map(input_file)) {
+        image_data = mapped_file->data();
+        image_size = mapped_file->size();
+        image_mapping = std::move(mapped_file);
+        return true;
+    }
+
+    std::ifstream image_file(image_path, std::ios::binary);
+    std::string file_bytes((std::istreambuf_iterator<char>(image_file)), std::istreambuf_iterator<char>());
+    owned_image.resize((file_bytes.size() + 7) / 8);
+    std::memcpy(owned_image.data(), file_bytes.data(), file_bytes.size());
+    image_data = reinterpret_cast<const char*>(owned_image.data());
+    image_size = file_bytes.size();
+    return true;
+}
+
+// Postings per bit-packed group; shorter tails are stored as variable-length bytes
+const size_t POSTING_GROUP_SIZE = 128;
+
+// One trigram's posting list: its bit-packed groups start at first_skip, and the varint tail follows
+struct index_posting_list {
+    uint64_t first_skip;
+    uint64_t tail_offset;
+    uint32_t posting_count;
+    uint32_t tail_length;
+};
+
+// Skip entry of one bit-packed group: its last block number lets a search pass the group undecoded
+struct index_posting_skip {
+    uint32_t last_block;
+    uint32_t bit_width;
+    uint64_t data_offset;
+};
+
+static_assert(sizeof(index_posting_list) == 24, "index posting list layout must not depend on the compiler");
+static_assert(sizeof(index_posting_skip) == 16, "index posting skip layout must not depend on the compiler");
+
+// Function to bit-pack one group of 128 gaps in four interleaved 32-bit lanes
+// Gap i sits in lane i % 4, so one 128-bit load and shift extracts four consecutive gaps
+inline void pack_posting_group(const uint32_t* gaps, uint32_t bit_width, std::string& packed_bytes) {
+    if (bit_width == 0) {
+        return; // You store nothing for a group of zero gaps, which unpack_posting_group fills from its base
+    }
+    std::vector<uint32_t> lane_words(bit_width * 4, 0);
+    for (size_t gap_index = 0; gap_index < POSTING_GROUP_SIZE; gap_index++) {
+        size_t lane_index = gap_index % 4;
+        size_t bit_position = (gap_index / 4) * bit_width;
+        size_t word_index = bit_position / 32;
+        size_t bit_shift = bit_position % 32;
+        lane_words[word_index * 4 + lane_index] |= gaps[gap_index] << bit_shift;
+        if (bit_shift + bit_width > 32) {
+            lane_words[(word_index + 1) * 4 + lane_index] |= gaps[gap_index] >> (32 - bit_shift);
+        }
+    }
+    packed_bytes.append(reinterpret_cast<const char*>(lane_words.data()), lane_words.size() * sizeof(uint32_t));
+}
+
+// Function to decode one packed group into block numbers, adding each gap to the running total
+inline void unpack_posting_group_scalar(const char* packed_data, uint32_t bit_width, uint32_t base_value,
+                                        uint32_t* block_ids) {
+    uint32_t value_mask = bit_width == 32 ? 0xFFFFFFFFu : (1u << bit_width) - 1;
+    for (size_t gap_index = 0; gap_index < POSTING_GROUP_SIZE; gap_index++) {
+        size_t bit_position = (gap_index / 4) * bit_width;
+        size_t word_index = bit_position / 32;
+        size_t bit_shift = bit_position % 32;
+        uint32_t low_word;
+        std::memcpy(&low_word, packed_data + (word_index * 4 + gap_index % 4) * 4, 4);
+        uint32_t gap_value = low_word >> bit_shift;
+        if (bit_shift + bit_width > 32) {
+            uint32_t high_word;
+            std::memcpy(&high_word, packed_data + ((word_index + 1) * 4 + gap_index % 4) * 4, 4);
+            gap_value |= high_word << (32 - bit_shift);
+        }
+        base_value += gap_value & value_mask;
+        block_ids[gap_index] = base_value;
+    }
+}
+
+#if TEXT_SEARCH_HAS_SSE2
+// Function to decode one packed group four gaps at a time, turning gaps into block numbers with a prefix sum
+inline void unpack_posting_group_sse2(const char* packed_data, uint32_t bit_width, uint32_t base_value,
+                                      uint32_t* block_ids) {
+    const __m128i value_mask = _mm_set1_epi32(bit_width == 32 ? -1 : static_cast<int>((1u << bit_width) - 1));
+    __m128i running_total = _mm_set1_epi32(static_cast<int>(base_value));
+    for (size_t row_index = 0; row_index < POSTING_GROUP_SIZE / 4; row_index++) {
+        size_t bit_position = row_index * bit_width;
+        size_t word_index = bit_position / 32;
+        int bit_shift = static_cast<int>(bit_position % 32);
+        __m128i gaps = _mm_srl_epi32(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(packed_data + word_index * 16)),
+            _mm_cvtsi32_si128(bit_shift));
+        if (bit_shift + bit_width > 32) {
+            __m128i high_words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(packed_data + word_index * 16 + 16));
+            gaps = _mm_or_si128(gaps, _mm_sll_epi32(high_words, _mm_cvtsi32_si128(32 - bit_shift)));
+        }
+        gaps = _mm_and_si128(gaps, value_mask);
+
+        // You sum the four gaps in place and add the last block number of the previous row
+        gaps = _mm_add_epi32(gaps, _mm_slli_si128(gaps, 4));
+        gaps = _mm_add_epi32(gaps, _mm_slli_si128(gaps, 8));
+        running_total = _mm_add_epi32(running_total, gaps);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(block_ids + row_index * 4), running_total);
+        running_total = _mm_shuffle_epi32(running_total, 0xFF);
+    }
+}
+#endif
+
+// Function to decode one packed group with the fastest routine this build has
+inline void unpack_posting_group(const char* packed_data, uint32_t bit_width, uint32_t base_value,
+                                 uint32_t* block_ids) {
+    if (bit_width == 0) {
+        std::fill(block_ids, block_ids + POSTING_GROUP_SIZE, base_value);
+        return;
+    }
+#if TEXT_SEARCH_HAS_SSE2
+    unpack_posting_group_sse2(packed_data, bit_width, base_value, block_ids);
+#else
+    unpack_posting_group_scalar(packed_data, bit_width, base_value, block_ids);
+#endif
+}
+
+// Function to encode a sorted posting list as gaps: bit-packed groups of 128 with skip entries, then a varint tail
+inline index_posting_list encode_posting_list(const std::vector<uint32_t>& block_ids,
+                                              std::vector<index_posting_skip>& skip_entries,
+                                              std::string& packed_bytes) {
+    index_posting_list posting_list{skip_entries.size(), 0, static_cast<uint32_t>(block_ids.size()), 0};
+    size_t full_groups = block_ids.size() / POSTING_GROUP_SIZE;
+    uint32_t previous_block = 0;
+    uint32_t gaps[POSTING_GROUP_SIZE];
+    for (size_t group_index = 0; group_index < full_groups; group_index++) {
+        uint32_t widest_gap = 0;
+        for (size_t gap_index = 0; gap_index < POSTING_GROUP_SIZE; gap_index++) {
+            uint32_t block_id = block_ids[group_index * POSTING_GROUP_SIZE + gap_index];
+            gaps[gap_index] = block_id - previous_block;
+            widest_gap |= gaps[gap_index];
+            previous_block = block_id;
+        }
+        uint32_t bit_width = 0;
+        while (bit_width < 32 && (widest_gap >> bit_width) != 0) {
+            bit_width++;
+        }
+        skip_entries.push_back(index_posting_skip{previous_block, bit_width, packed_bytes.size()});
+        pack_posting_group(gaps, bit_width, packed_bytes);
+    }
+
+    posting_list.tail_offset = packed_bytes.size();
+    for (size_t block_index = full_groups * POSTING_GROUP_SIZE; block_index < block_ids.size(); block_index++) {
+        uint32_t gap_value = block_ids[block_index] - previous_block;
+        previous_block = block_ids[block_index];
+        while (gap_value >= 0x80) {
+            packed_bytes.push_back(static_cast<char>((gap_value & 0x7F) | 0x80));
+            gap_value >>= 7;
+        }
+        packed_bytes.push_back(static_cast<char>(gap_value));
+    }
+    posting_list.tail_length = static_cast<uint32_t>(packed_bytes.size() - posting_list.tail_offset);
+    return posting_list;
+}
+
+// Function to intersect two sorted block lists, appending the common block numbers
+// Each block of the short list gallops through the long one in runs of four, whose last entries are probed
+// at doubling distances; the run that may hold it is then compared whole with one SIMD instruction
+inline void intersect_sorted_blocks(const uint32_t* short_begin, const uint32_t* short_end, const uint32_t* long_begin,
+                                    const uint32_t* long_end, std::vector<uint32_t>& common_blocks) {
+    const uint32_t* long_cursor = long_begin;
+    for (const uint32_t* short_cursor = short_begin; short_cursor < short_end; ++short_cursor) {
+        uint32_t block_id = *short_cursor;
+        size_t run_count = static_cast<size_t>(long_end - long_cursor) / 4;
+
+        // You skip whole runs ending below the block, so the cursor only ever moves forward
+        if (run_count > 0 && long_cursor[3] < block_id) {
+            size_t lower_run = 0;
+            size_t upper_run = 1;
+            while (upper_run < run_count && long_cursor[upper_run * 4 + 3] < block_id) {
+                lower_run = upper_run;
+                upper_run *= 2;
+            }
+            upper_run = std::min(upper_run, run_count);
+            while (lower_run + 1 < upper_run) {
+                size_t middle_run = (lower_run + upper_run) / 2;
+                if (long_cursor[middle_run * 4 + 3] < block_id) {
+                    lower_run = middle_run;
+                } else {
+                    upper_run = middle_run;
+                }
+            }
+            long_cursor += upper_run * 4;
+            run_count -= upper_run;
+        }
+
+        if (run_count > 0) {
+#if TEXT_SEARCH_HAS_SSE2
+            __m128i run_blocks = _mm_loadu_si128(reinterpret_cast<const __m128i*>(long_cursor));
+            bool found = _mm_movemask_epi8(_mm_cmpeq_epi32(run_blocks, _mm_set1_epi32(static_cast<int>(block_id)))) != 0;
+#else
+            bool found = long_cursor[0] == block_id || long_cursor[1] == block_id || long_cursor[2] == block_id ||
+                         long_cursor[3] == block_id;
+#endif
+            if (found) {
+                common_blocks.push_back(block_id);
+            }
+            continue;
+        }
+
+        // You finish the last few entries of the long list one at a time
+        while (long_cursor < long_end && *long_cursor < block_id) {
+            ++long_cursor;
+        }
+        if (long_cursor < long_end && *long_cursor == block_id) {
+            common_blocks.push_back(block_id);
+        }
+    }
+}
+
+// Function to intersect two sorted block lists, galloping through whichever is longer
+inline std::vector<uint32_t> intersect_sorted_blocks(const std::vector<uint32_t>& first_blocks,
+                                                     const std::vector<uint32_t>& second_blocks) {
+    const std::vector<uint32_t>& short_blocks = first_blocks.size() <= second_blocks.size() ? first_blocks : second_blocks;
+    const std::vector<uint32_t>& long_blocks = first_blocks.size() <= second_blocks.size() ? second_blocks : first_blocks;
+    std::vector<uint32_t> common_blocks;
+    intersect_sorted_blocks(short_blocks.data(), short_blocks.data() + short_blocks.size(), long_blocks.data(),
+                            long_blocks.data() + long_blocks.size(), common_blocks);
+    return common_blocks;
+}
+
+// Totals reported after a search through a trigram index
+struct index_search_summary {
+    size_t files_indexed = 0;
+    size_t blocks_indexed = 0;
+    size_t candidate_blocks = 0;
+    size_t scanned_bytes = 0;
+    size_t changed_files = 0;  // Searched whole because they changed after the index was built
+    size_t missing_files = 0;  // Indexed files that no longer exist
+    size_t damaged_entries = 0; // File or block entries pointing outside the index or the file
+};
+
+// Function to find the end of a block starting at a line start, moved forward past the next newline
+// A block outgrows block_size only to finish its last line
+inline const char* line_aligned_block_end(const char* block_begin, const char* content_end, size_t block_size) {
+    if (static_cast<size_t>(content_end - block_begin) <= block_size) {
+        return content_end;
+    }
+    const char* block_end = find_line_end(block_begin + block_size, content_end);
+    return block_end < content_end ? block_end + 1 : block_end;
+}
+
+// Function to collect the distinct folded trigrams of a block, returning how many newlines it holds
+// The bitmap has one bit per trigram and is cleared again before returning
+inline size_t collect_block_trigrams(const char* block_begin, const char* block_end,
+                                     std::vector<uint64_t>& seen_trigrams, std::vector<uint32_t>& block_trigrams) {
+    // You skip trigrams holding a newline, since no match ever spans lines
+    uint32_t rolling_trigram = 0;
+    size_t bytes_since_newline = 0;
+    size_t newline_count = 0;
+    for (const char* position = block_begin; position < block_end; ++position) {
+        unsigned char byte_value = static_cast<unsigned char>(*position);
+        if (byte_value == '\n') {
+            bytes_since_newline = 0;
+            newline_count++;
+            continue;
+        }
+        rolling_trigram = ((rolling_trigram << 8) | fold_ascii_case(byte_value)) & 0xFFFFFF;
+        if (++bytes_since_newline >= 3) {
+            uint64_t& seen_word = seen_trigrams[rolling_trigram >> 6];
+            uint64_t seen_bit = 1ULL << (rolling_trigram & 63);
+            if ((seen_word & seen_bit) == 0) {
+                seen_word |= seen_bit;
+                block_trigrams.push_back(rolling_trigram);
+            }
+        }
+    }
+    for (uint32_t trigram : block_trigrams) {
+        seen_trigrams[trigram >> 6] = 0;
+    }
+    return newline_count;
+}
+
+// Trigram inverted index over the text files of a directory tree
+// Files are cut into line-aligned blocks, and each folded trigram lists the blocks containing it in order
+// The tables are always read from one image, either built in memory or mapped from a saved index
+class trigram_index {
+public:
+    // You move an index but never copy it, since its tables point into the image it owns
+    trigram_index() = default;
+    trigram_index(const trigram_index&) = delete;
+    trigram_index& operator=(const trigram_index&) = delete;
+    trigram_index(trigram_index&&) = default;
+    trigram_index& operator=(trigram_index&&) = default;
+
+    // You index every text file below a directory, reading batches of files on all cores
+    bool build(const std::string& directory_path, std::string& error_message) {
+        std::error_code status_error;
+        if (!std::filesystem::is_directory(directory_path, status_error)) {
+            error_message = "Cannot index '" + directory_path + "': not a directory";
+            return false;
+        }
+
+        std::vector<std::string> file_paths = list_indexable_files(directory_path);
+        size_t worker_count = std::min(search_thread_count(), std::max<size_t>(1, file_paths.size()));
+        std::vector<std::vector<uint64_t>> seen_trigrams(worker_count, std::vector<uint64_t>((1 << 24) / 64, 0));
+        std::map<uint32_t, std::vector<uint32_t>> trigram_postings;
+        std::vector<index_file_entry> file_entries;
+        std::vector<index_block_entry> block_entries;
+        std::string path_bytes;
+
+        for (size_t batch_begin = 0; batch_begin < file_paths.size(); batch_begin += INDEX_BATCH_FILES) {
+            size_t batch_size = std::min(INDEX_BATCH_FILES, file_paths.size() - batch_begin);
+            std::vector<file_index_result> batch_results(batch_size);
+            run_parallel_tasks(batch_size, worker_count, [&](size_t worker_index, size_t task_index) {
+                index_file(file_paths[batch_begin + task_index], seen_trigrams[worker_index], batch_results[task_index]);
+            });
+
+            // You number blocks in path order, so every posting list comes out sorted
+            for (size_t task_index = 0; task_index < batch_size; task_index++) {
+                file_index_result& file_result = batch_results[task_index];
+                if (!file_result.indexed) {
+                    continue;
+                }
+                const std::string& file_path = file_paths[batch_begin + task_index];
+                const file_identity& identity = file_result.indexed_identity;
+                file_entries.push_back(index_file_entry{path_bytes.size(), file_path.size(), block_entries.size(),
+                                                        file_result.blocks.size(), identity.device_id,
+                                                        identity.inode_number, identity.file_size,
+                                                        identity.modified_nanoseconds});
+                path_bytes += file_path;
+                for (size_t block_index = 0; block_index < file_result.blocks.size(); block_index++) {
+                    uint32_t block_id = static_cast<uint32_t>(block_entries.size());
+                    block_entries.push_back(file_result.blocks[block_index]);
+                    for (uint32_t trigram : file_result.block_trigrams[block_index]) {
+                        trigram_postings[trigram].push_back(block_id);
+                    }
+                }
+            }
+        }
+
+        build_image(file_entries, path_bytes, block_entries, trigram_postings);
+        return true;
+    }
+
+    // You write the index image exactly as it will later be mapped
+    bool save(const std::string& index_path, std::string& error_message) const {
+        if (!host_is_little_endian()) {
+            error_message = "Index files can only be written on little-endian machines";
+            return false;
+        }
+        if (!write_image_file(index_path, image_data, image_size)) {
+            error_message = "Cannot write index '" + index_path + "'";
+            return false;
+        }
+        return true;
+    }
+
+    // You map a saved index and check only its header, so opening takes the same time at any index size
+    // Entries are bounds-checked as searches reach them; verify_checksum reads the whole image
+    bool load(const std::string& index_path, std::string& error_message) {
+        *this = trigram_index();
+        if (!host_is_little_endian()) {
+            error_message = "Index files can only be read on little-endian machines";
+            return false;
+        }
+
+        if (!read_image_file(index_path, image_mapping, owned_image, image_data, image_size)) {
+            error_message = "Cannot open index '" + index_path + "'";
+            return false;
+        }
+
+        if (!attach_image(error_message)) {
+            error_message = "Index '" + index_path + "' " + error_message;
+            *this = trigram_index();
+            return false;
+        }
+        return true;
+    }
+
+    // You read every byte after the header and compare it with the checksum stored at build time
+    bool verify_checksum(std::string& error_message) const {
+        if (checksum_index_bytes(image_data + sizeof(index_image_header), image_size - sizeof(index_image_header)) !=
+            image_header->content_checksum) {
+            error_message = "Index content does not match its checksum";
+            return false;
+        }
+        return true;
+    }
+
+    // You resolve a plan to the sorted blocks that may hold a match; a plan matching everything yields all blocks
+    // A damaged posting list also yields all blocks, so damage never hides a match
+    std::vector<uint32_t> candidate_blocks(const trigram_plan& plan) const {
+        std::vector<uint32_t> block_ids;
+        switch (plan.kind) {
+            case trigram_plan::match_all:
+                return all_blocks();
+            case trigram_plan::trigram_leaf: {
+                size_t key_index = find_trigram(plan.trigram);
+                if (key_index != trigram_count() && !decode_postings(key_index, block_ids)) {
+                    return all_blocks();
+                }
+                break;
+            }
+            case trigram_plan::all_of: {
+                // You decode the shortest posting list and filter it through the longer ones by their skip entries,
+                // so groups of a long list that no candidate falls into are never decoded
+                std::vector<size_t> leaf_keys;
+                std::vector<std::vector<uint32_t>> child_blocks;
+                for (const trigram_plan& child_plan : plan.children) {
+                    if (child_plan.kind != trigram_plan::trigram_leaf) {
+                        child_blocks.push_back(candidate_blocks(child_plan));
+                        continue;
+                    }
+                    size_t key_index = find_trigram(child_plan.trigram);
+                    if (key_index == trigram_count()) {
+                        return block_ids; // You know no block holds a trigram the index never saw
+                    }
+                    leaf_keys.push_back(key_index);
+                }
+                std::sort(leaf_keys.begin(), leaf_keys.end(), [this](size_t left_key, size_t right_key) {
+                    return posting_lists[left_key].posting_count < posting_lists[right_key].posting_count;
+                });
+                std::sort(child_blocks.begin(), child_blocks.end(),
+                          [](const std::vector<uint32_t>& left, const std::vector<uint32_t>& right) {
+                              return left.size() < right.size();
+                          });
+
+                size_t next_leaf = 0;
+                size_t next_child = 0;
+                if (!leaf_keys.empty() &&
+                    (child_blocks.empty() || posting_lists[leaf_keys[0]].posting_count <= child_blocks[0].size())) {
+                    if (!decode_postings(leaf_keys[next_leaf++], block_ids)) {
+                        block_ids = all_blocks();
+                    }
+                } else if (!child_blocks.empty()) {
+                    block_ids = std::move(child_blocks[next_child++]);
+                } else {
+                    return all_blocks();
+                }
+
+                // You keep the candidates unfiltered by a damaged list, so damage never hides a match
+                for (; next_leaf < leaf_keys.size() && !block_ids.empty(); next_leaf++) {
+                    intersect_postings(leaf_keys[next_leaf], block_ids);
+                }
+                for (; next_child < child_blocks.size() && !block_ids.empty(); next_child++) {
+                    block_ids = intersect_sorted_blocks(block_ids, child_blocks[next_child]);
+                }
+                break;
+            }
+            case trigram_plan::any_of:
+                for (const trigram_plan& child_plan : plan.children) {
+                    std::vector<uint32_t> child_blocks = candidate_blocks(child_plan);
+                    std::vector<uint32_t> either_blocks;
+                    std::set_union(block_ids.begin(), block_ids.end(), child_blocks.begin(), child_blocks.end(),
+                                   std::back_inserter(either_blocks));
+                    block_ids.swap(either_blocks);
+                }
+                break;
+        }
+        return block_ids;
+    }
+
+    // You search the indexed files in path order, scanning only candidate blocks of unchanged files
+    // Files changed since the build are searched whole and vanished files are skipped; files added since are not seen
+    index_search_summary search(const compiled_query& query, const trigram_plan& plan,
+                                 const context_window_options& context_window,
+                                 const std::function<void(directory_file_result&)>& on_file_result) const {
+        index_search_summary search_summary;
+        search_summary.files_indexed = file_count();
+        search_summary.blocks_indexed = block_count();
+        std::vector<uint32_t> block_ids = candidate_blocks(plan);
+        search_summary.candidate_blocks = block_ids.size();
+
+        // You give every worker its own copy of the query, since regex matchers cache state while scanning
+        size_t worker_count = std::min(search_thread_count(), std::max<size_t>(1, file_count()));
+        std::vector<compiled_query> worker_queries(worker_count, query);
+        std::atomic<size_t> scanned_bytes(0);
+        std::atomic<size_t> changed_files(0);
+        std::atomic<size_t> missing_files(0);
+        std::atomic<size_t> damaged_entries(0);
+
+        for (size_t batch_begin = 0; batch_begin < file_count(); batch_begin += INDEX_BATCH_FILES) {
+            size_t batch_size = std::min(INDEX_BATCH_FILES, file_count() - batch_begin);
+            std::vector<directory_file_result> batch_results(batch_size);
+            run_parallel_tasks(batch_size, worker_count, [&](size_t worker_index, size_t task_index) {
+                const index_file_entry& file_entry = file_entries[batch_begin + task_index];
+                directory_file_result& file_result = batch_results[task_index];
+                if (file_entry.path_offset > image_header->paths_size ||
+                    file_entry.path_length > image_header->paths_size - file_entry.path_offset ||
+                    file_entry.first_block > block_count() ||
+                    file_entry.block_count > block_count() - file_entry.first_block) {
+                    damaged_entries++;
+                    return;
+                }
+                std::string file_path(path_bytes + file_entry.path_offset, static_cast<size_t>(file_entry.path_length));
+
+                // You find this file's candidates among the sorted block numbers
+                auto candidates_begin = std::lower_bound(block_ids.begin(), block_ids.end(), file_entry.first_block);
+                auto candidates_end = std::lower_bound(candidates_begin, block_ids.end(),
+                                                       file_entry.first_block + file_entry.block_count);
+
+                input_file_handle input_file;
+                if (!input_file.open(file_path)) {
+                    missing_files++;
+                    return;
+                }
+                file_result.file_path = std::move(file_path);
+                if (input_file.identity() != indexed_identity(file_entry)) {
+                    changed_files++;
+                    scanned_bytes += input_file.file_size();
+                    file_result.file_matches = search_opened_file(input_file, worker_queries[worker_index],
+                                                                  context_window);
+                    return;
+                }
+                if (candidates_begin == candidates_end) {
+                    return;
+                }
+
+                std::shared_ptr<mapped_file_region> mapped_file = std::make_shared<mapped_file_region>();
+                if (!mapped_file->map(input_file)) {
+                    missing_files++;
+                    return;
+                }
+                const char* content_begin = mapped_file->data();
+                visit_query_matcher(worker_queries[worker_index], [&](const auto& line_matcher) {
+                    for (auto candidate = candidates_begin; candidate != candidates_end; ++candidate) {
+                        const index_block_entry& block_entry = block_entries[*candidate];
+                        if (block_entry.block_offset > mapped_file->size() ||
+                            block_entry.block_size > mapped_file->size() - block_entry.block_offset) {
+                            damaged_entries++;
+                            continue;
+                        }
+                        const char* block_begin = content_begin + block_entry.block_offset;
+                        scanned_bytes += block_entry.block_size;
+                        scan_mapped_range(block_begin, block_begin + block_entry.block_size,
+                                          block_entry.first_line_number, line_matcher, nullptr,
+                                          [&](size_t line_number, const char* line_begin, const char* line_end) {
+                            file_result.file_matches.match_records.push_back(
+                                make_match_record(content_begin, line_number, line_begin, line_end, line_matcher));
+                        });
+                    }
+                });
+                file_result.file_matches.attach_mapped_content(mapped_file);
+            });
+
+            // You report every indexed file still present, including those without matches, as a directory search does
+            for (directory_file_result& file_result : batch_results) {
+                if (!file_result.file_path.empty()) {
+                    on_file_result(file_result);
+                }
+            }
+        }
+
+        search_summary.scanned_bytes = scanned_bytes;
+        search_summary.changed_files = changed_files;
+        search_summary.missing_files = missing_files;
+        search_summary.damaged_entries = damaged_entries;
+        return search_summary;
+    }
+
+    size_t file_count() const { return image_header ? static_cast<size_t>(image_header->file_count) : 0; }
+    size_t block_count() const { return image_header ? static_cast<size_t>(image_header->block_count) : 0; }
+    size_t trigram_count() const { return image_header ? static_cast<size_t>(image_header->trigram_count) : 0; }
+    size_t posting_count() const { return image_header ? static_cast<size_t>(image_header->posting_count) : 0; }
+    size_t packed_posting_bytes() const { return image_header ? static_cast<size_t>(image_header->packed_size) : 0; }
+    size_t image_bytes() const { return image_size; }
+
+private:
+    struct file_index_result {
+        bool indexed = false;
+        file_identity indexed_identity;
+        std::vector<index_block_entry> blocks;
+        std::vector<std::vector<uint32_t>> block_trigrams;
+    };
+
+    static file_identity indexed_identity(const index_file_entry& file_entry) {
+        file_identity identity;
+        identity.device_id = file_entry.device_id;
+        identity.inode_number = file_entry.inode_number;
+        identity.file_size = file_entry.file_size;
+        identity.modified_nanoseconds = file_entry.modified_nanoseconds;
+        return identity;
+    }
+
+    // You list every block, for plans that cannot narrow a search and for damaged posting lists
+    std::vector<uint32_t> all_blocks() const {
+        std::vector<uint32_t> block_ids(block_count());
+        for (size_t block_index = 0; block_index < block_ids.size(); block_index++) {
+            block_ids[block_index] = static_cast<uint32_t>(block_index);
+        }
+        return block_ids;
+    }
+
+    // You return the position of a trigram among the sorted keys, or trigram_count() when it was never seen
+    size_t find_trigram(uint32_t trigram) const {
+        const uint32_t* key_position = std::lower_bound(trigram_keys, trigram_keys + trigram_count(), trigram);
+        if (key_position == trigram_keys + trigram_count() || *key_position != trigram) {
+            return trigram_count();
+        }
+        return static_cast<size_t>(key_position - trigram_keys);
+    }
+
+    // You check that a list's skip entries and tail lie inside the image before any of it is decoded
+    bool posting_list_intact(const index_posting_list& posting_list) const {
+        uint64_t group_count = posting_list.posting_count / POSTING_GROUP_SIZE;
+        return posting_list.first_skip <= image_header->skip_count &&
+               group_count <= image_header->skip_count - posting_list.first_skip &&
+               posting_list.tail_offset <= image_header->packed_size &&
+               posting_list.tail_length <= image_header->packed_size - posting_list.tail_offset;
+    }
+
+    // You decode one packed group after checking its bytes lie inside the image
+    bool unpack_group(const index_posting_skip& skip_entry, uint32_t base_value, uint32_t* block_ids) const {
+        if (skip_entry.bit_width > 32 || skip_entry.data_offset > image_header->packed_size ||
+            skip_entry.bit_width * 16 > image_header->packed_size - skip_entry.data_offset) {
+            return false;
+        }
+        unpack_posting_group(packed_postings + skip_entry.data_offset, skip_entry.bit_width, base_value, block_ids);
+        return true;
+    }
+
+    // You decode the varint gaps after a list's last full group
+    bool decode_posting_tail(const index_posting_list& posting_list, uint32_t previous_block,
+                             std::vector<uint32_t>& block_ids) const {
+        const unsigned char* tail_position =
+            reinterpret_cast<const unsigned char*>(packed_postings + posting_list.tail_offset);
+        const unsigned char* tail_end = tail_position + posting_list.tail_length;
+        for (size_t tail_index = 0; tail_index < posting_list.posting_count % POSTING_GROUP_SIZE; tail_index++) {
+            uint32_t gap_value = 0;
+            unsigned char gap_byte = 0;
+            for (int bit_shift = 0; bit_shift == 0 || (gap_byte & 0x80) != 0; bit_shift += 7) {
+                if (tail_position == tail_end || bit_shift > 28) {
+                    return false;
+                }
+                gap_byte = *tail_position++;
+                gap_value |= static_cast<uint32_t>(gap_byte & 0x7F) << bit_shift;
+            }
+            previous_block += gap_value;
+            block_ids.push_back(previous_block);
+        }
+        return true;
+    }
+
+    // You decode a whole posting list; returns false when it is damaged
+    bool decode_postings(size_t key_index, std::vector<uint32_t>& block_ids) const {
+        const index_posting_list& posting_list = posting_lists[key_index];
+        if (!posting_list_intact(posting_list)) {
+            return false;
+        }
+        size_t group_count = posting_list.posting_count / POSTING_GROUP_SIZE;
+        block_ids.resize(group_count * POSTING_GROUP_SIZE);
+        uint32_t previous_block = 0;
+        for (size_t group_index = 0; group_index < group_count; group_index++) {
+            const index_posting_skip& skip_entry = posting_skips[posting_list.first_skip + group_index];
+            if (!unpack_group(skip_entry, previous_block, block_ids.data() + group_index * POSTING_GROUP_SIZE)) {
+                return false;
+            }
+            previous_block = skip_entry.last_block;
+        }
+        return decode_posting_tail(posting_list, previous_block, block_ids);
+    }
+
+    // You keep the sorted candidates that also appear in a posting list
+    // Skip entries pass over groups holding no candidate; each group is decoded once and intersected with the
+    // candidates it can hold in one galloping pass
+    // Returns false and leaves the candidates alone when the list is damaged
+    bool intersect_postings(size_t key_index, std::vector<uint32_t>& block_ids) const {
+        const index_posting_list& posting_list = posting_lists[key_index];
+        if (!posting_list_intact(posting_list)) {
+            return false;
+        }
+        const index_posting_skip* group_skips = posting_skips + posting_list.first_skip;
+        size_t group_count = posting_list.posting_count / POSTING_GROUP_SIZE;
+        const uint32_t* candidate = block_ids.data();
+        const uint32_t* candidates_end = block_ids.data() + block_ids.size();
+        uint32_t decoded_blocks[POSTING_GROUP_SIZE];
+        std::vector<uint32_t> common_blocks;
+
+        for (size_t group_index = 0; group_index < group_count && candidate < candidates_end; group_index++) {
+            if (group_skips[group_index].last_block < *candidate) {
+                continue;
+            }
+            const uint32_t* group_candidates_end =
+                std::upper_bound(candidate, candidates_end, group_skips[group_index].last_block);
+            uint32_t base_value = group_index > 0 ? group_skips[group_index - 1].last_block : 0;
+            if (!unpack_group(group_skips[group_index], base_value, decoded_blocks)) {
+                return false;
+            }
+            intersect_sorted_blocks(candidate, group_candidates_end, decoded_blocks,
+                                    decoded_blocks + POSTING_GROUP_SIZE, common_blocks);
+            candidate = group_candidates_end;
+        }
+
+        if (candidate < candidates_end) {
+            std::vector<uint32_t> tail_blocks;
+            uint32_t base_value = group_count > 0 ? group_skips[group_count - 1].last_block : 0;
+            if (!decode_posting_tail(posting_list, base_value, tail_blocks)) {
+                return false;
+            }
+            intersect_sorted_blocks(candidate, candidates_end, tail_blocks.data(),
+                                    tail_blocks.data() + tail_blocks.size(), common_blocks);
+        }
+        block_ids.swap(common_blocks);
+        return true;
+    }
+
+    // You round section offsets up so every table can be read in place
+    static uint64_t align_section(uint64_t section_offset) { return (section_offset + 7) & ~static_cast<uint64_t>(7); }
+
+    // You lay the tables out in one 8-byte-aligned image with a checksummed header
+    void build_image(const std::vector<index_file_entry>& file_table, const std::string& path_table,
+                     const std::vector<index_block_entry>& block_table,
+                     const std::map<uint32_t, std::vector<uint32_t>>& trigram_postings) {
+        // You encode every posting list first, since the packed sizes decide where later tables start
+        std::vector<index_posting_list> list_table;
+        std::vector<index_posting_skip> skip_table;
+        std::string packed_table;
+        size_t total_postings = 0;
+        for (const auto& trigram_entry : trigram_postings) {
+            list_table.push_back(encode_posting_list(trigram_entry.second, skip_table, packed_table));
+            total_postings += trigram_entry.second.size();
+        }
+
+        index_image_header built_header;
+        std::memset(&built_header, 0, sizeof(built_header));
+        built_header.index_magic = TRIGRAM_INDEX_MAGIC;
+        built_header.index_version = TRIGRAM_INDEX_VERSION;
+        built_header.header_size = sizeof(index_image_header);
+        built_header.file_count = file_table.size();
+        built_header.block_count = block_table.size();
+        built_header.trigram_count = trigram_postings.size();
+        built_header.posting_count = total_postings;
+        built_header.skip_count = skip_table.size();
+        built_header.files_offset = sizeof(index_image_header);
+        built_header.paths_offset = built_header.files_offset + file_table.size() * sizeof(index_file_entry);
+        built_header.paths_size = path_table.size();
+        built_header.blocks_offset = align_section(built_header.paths_offset + path_table.size());
+        built_header.keys_offset = built_header.blocks_offset + block_table.size() * sizeof(index_block_entry);
+        built_header.lists_offset = align_section(built_header.keys_offset + trigram_postings.size() * sizeof(uint32_t));
+        built_header.skips_offset = built_header.lists_offset + list_table.size() * sizeof(index_posting_list);
+        built_header.packed_offset = built_header.skips_offset + skip_table.size() * sizeof(index_posting_skip);
+        built_header.packed_size = packed_table.size();
+        built_header.image_size = align_section(built_header.packed_offset + packed_table.size());
+
+        *this = trigram_index();
+        owned_image.assign(static_cast<size_t>(built_header.image_size / 8), 0);
+        char* image_begin = reinterpret_cast<char*>(owned_image.data());
+        std::memcpy(image_begin + built_header.files_offset, file_table.data(),
+                    file_table.size() * sizeof(index_file_entry));
+        std::memcpy(image_begin + built_header.paths_offset, path_table.data(), path_table.size());
+        std::memcpy(image_begin + built_header.blocks_offset, block_table.data(),
+                    block_table.size() * sizeof(index_block_entry));
+        uint32_t* key_table = reinterpret_cast<uint32_t*>(image_begin + built_header.keys_offset);
+        for (const auto& trigram_entry : trigram_postings) {
+            *key_table++ = trigram_entry.first;
+        }
+        std::memcpy(image_begin + built_header.lists_offset, list_table.data(),
+                    list_table.size() * sizeof(index_posting_list));
+        std::memcpy(image_begin + built_header.skips_offset, skip_table.data(),
+                    skip_table.size() * sizeof(index_posting_skip));
+        std::memcpy(image_begin + built_header.packed_offset, packed_table.data(), packed_table.size());
+
+        built_header.content_checksum = checksum_index_bytes(image_begin + sizeof(index_image_header),
+                                                             built_header.image_size - sizeof(index_image_header));
+        built_header.header_checksum = checksum_index_header(built_header);
+        std::memcpy(image_begin, &built_header, sizeof(built_header));
+
+        std::string error_message;
+        image_data = image_begin;
+        image_size = static_cast<size_t>(built_header.image_size);
+        attach_image(error_message);
+    }
+
+    // You check the header and that every section lies inside the image, then point the tables into it
+    bool attach_image(std::string& error_message) {
+        if (image_size < sizeof(index_image_header)) {
+            error_message = "is too short to be a trigram index";
+            return false;
+        }
+        const index_image_header* candidate_header = reinterpret_cast<const index_image_header*>(image_data);
+        if (candidate_header->index_magic != TRIGRAM_INDEX_MAGIC) {
+            error_message = "is not a trigram index";
+            return false;
+        }
+        if (candidate_header->index_version != TRIGRAM_INDEX_VERSION) {
+            error_message = "has unsupported version " + std::to_string(candidate_header->index_version) +
+                            "; rebuild it with --build-index";
+            return false;
+        }
+        if (candidate_header->header_size != sizeof(index_image_header) ||
+            checksum_index_header(*candidate_header) != candidate_header->header_checksum) {
+            error_message = "has a damaged header";
+            return false;
+        }
+
+        // You check each section with divisions, so damaged counts cannot overflow the arithmetic
+        auto section_fits = [this, candidate_header](uint64_t section_offset, uint64_t item_count, uint64_t item_size) {
+            return section_offset % 8 == 0 && section_offset >= sizeof(index_image_header) &&
+                   section_offset <= image_size && item_count <= (image_size - section_offset) / item_size;
+        };
+        if (candidate_header->image_size != image_size ||
+            !section_fits(candidate_header->files_offset, candidate_header->file_count, sizeof(index_file_entry)) ||
+            !section_fits(candidate_header->paths_offset, candidate_header->paths_size, 1) ||
+            !section_fits(candidate_header->blocks_offset, candidate_header->block_count, sizeof(index_block_entry)) ||
+            !section_fits(candidate_header->keys_offset, candidate_header->trigram_count, sizeof(uint32_t)) ||
+            !section_fits(candidate_header->lists_offset, candidate_header->trigram_count, sizeof(index_posting_list)) ||
+            !section_fits(candidate_header->skips_offset, candidate_header->skip_count, sizeof(index_posting_skip)) ||
+            !section_fits(candidate_header->packed_offset, candidate_header->packed_size, 1)) {
+            error_message = "is truncated or has damaged section offsets";
+            return false;
+        }
+
+        image_header = candidate_header;
+        file_entries = reinterpret_cast<const index_file_entry*>(image_data + image_header->files_offset);
+        path_bytes = image_data + image_header->paths_offset;
+        block_entries = reinterpret_cast<const index_block_entry*>(image_data + image_header->blocks_offset);
+        trigram_keys = reinterpret_cast<const uint32_t*>(image_data + image_header->keys_offset);
+        posting_lists = reinterpret_cast<const index_posting_list*>(image_data + image_header->lists_offset);
+        posting_skips = reinterpret_cast<const index_posting_skip*>(image_data + image_header->skips_offset);
+        packed_postings = image_data + image_header->packed_offset;
+        return true;
+    }
+
+    // You list regular text files without following symbolic links, in path order
+    static std::vector<std::string> list_indexable_files(const std::string& directory_path) {
+        std::vector<std::string> file_paths;
+        std::error_code iteration_error;
+        for (std::filesystem::recursive_directory_iterator directory_entries(
+                 directory_path, std::filesystem::directory_options::skip_permission_denied, iteration_error);
+             !iteration_error && directory_entries != std::filesystem::recursive_directory_iterator();
+             directory_entries.increment(iteration_error)) {
+            std::error_code status_error;
+            std::string file_path = directory_entries->path().string();
+            if (std::filesystem::is_regular_file(directory_entries->symlink_status(status_error)) &&
+                is_supported_text_format(file_path)) {
+                file_paths.push_back(std::move(file_path));
+            }
+        }
+        std::sort(file_paths.begin(), file_paths.end());
+        return file_paths;
+    }
+
+    // You cut one file into line-aligned blocks and collect each block's distinct folded trigrams
+    static void index_file(const std::string& file_path, std::vector<uint64_t>& seen_trigrams,
+                           file_index_result& file_result) {
+        input_file_handle input_file;
+        mapped_file_region mapped_file;
+        if (!input_file.open(file_path) || !mapped_file.map(input_file)) {
+            return;
+        }
+        file_result.indexed = true;
+        file_result.indexed_identity = input_file.identity();
+
+        // You list binary content without blocks, so it is reported empty as a directory search reports it
+        std::string_view content = mapped_file.content();
+        if (std::memchr(content.data(), '\0', std::min(content.size(), BINARY_SNIFF_SIZE)) != nullptr) {
+            return;
+        }
+
+        const char* content_end = content.data() + content.size();
+        const char* block_begin = content.data();
+        uint64_t first_line_number = 1;
+        while (block_begin < content_end) {
+            const char* block_end = line_aligned_block_end(block_begin, content_end, INDEX_BLOCK_SIZE);
+            std::vector<uint32_t> block_trigrams;
+            size_t newline_count = collect_block_trigrams(block_begin, block_end, seen_trigrams, block_trigrams);
+            file_result.blocks.push_back(index_block_entry{static_cast<uint64_t>(block_begin - content.data()),
+                                                       static_cast<uint64_t>(block_end - block_begin),
+                                                       first_line_number});
+            file_result.block_trigrams.push_back(std::move(block_trigrams));
+            first_line_number += newline_count;
+            block_begin = block_end;
+        }
+    }
+
+    // You keep the image alive through the mapping of a loaded index or the words of a built one
+    std::shared_ptr<const mapped_file_region> image_mapping;
+    std::vector<uint64_t> owned_image;
+    const char* image_data = nullptr;
+    size_t image_size = 0;
+
+    // You read the tables in place; trigram_keys[i] has its blocks encoded as described by posting_lists[i]
+    const index_image_header* image_header = nullptr;
+    const index_file_entry* file_entries = nullptr;
+    const char* path_bytes = nullptr;
+    const index_block_entry* block_entries = nullptr;
+    const uint32_t* trigram_keys = nullptr;
+    const index_posting_list* posting_lists = nullptr;
+    const index_posting_skip* posting_skips = nullptr;
+    const char* packed_postings = nullptr;
+};
+
+// Bytes of file mappings a long-running process may keep open between searches
+const size_t MAPPED_FILE_CACHE_BYTE_LIMIT = size_t(1) << 30;
+
+// Number of file mappings a long-running process may keep open between searches
+const size_t MAPPED_FILE_CACHE_ENTRY_LIMIT = 256;
+
+// Mappings kept open across searches so unchanged files skip the open, the mmap and the page faults
+// A mapping is reused only while the file's device, inode, size and modification time are unchanged
+class mapped_file_cache {
+public:
+    // You return the warm mapping of an unchanged file, or map it afresh and remember it
+    // Returns nullptr for anything that cannot be mapped, such as pipes, devices and missing files
+    std::shared_ptr<const mapped_file_region> acquire(const std::string& file_path) {
+        file_identity current_identity;
+        if (!read_file_identity(file_path, current_identity)) {
+            return nullptr;
+        }
+
+        // You key entries by absolute path so relative names from different directories never collide
+        std::error_code path_error;
+        std::string cache_key = std::filesystem::absolute(file_path, path_error).string();
+        auto cached_entry = cached_mappings.find(cache_key);
+        if (cached_entry != cached_mappings.end()) {
+            if (cached_entry->second.mapped_identity == current_identity) {
+                cached_entry->second.last_use = ++use_clock;
+                return cached_entry->second.mapped_file;
+            }
+            forget_mapping(cached_entry);
+        }
+
+        input_file_handle input_file;
+        std::shared_ptr<mapped_file_region> mapped_file = std::make_shared<mapped_file_region>();
+        if (!input_file.open(file_path) || !mapped_file->map(input_file)) {
+            return nullptr;
+        }
+
+        // You key the entry by the opened descriptor's identity, since that is the file that was mapped
+        if (mapped_file->size() <= MAPPED_FILE_CACHE_BYTE_LIMIT) {
+            while (!cached_mappings.empty() && (cached_mappings.size() >= MAPPED_FILE_CACHE_ENTRY_LIMIT ||
+                                                cached_bytes + mapped_file->size() > MAPPED_FILE_CACHE_BYTE_LIMIT)) {
+                forget_least_recent_mapping();
+            }
+            cached_mappings[cache_key] = cached_mapping{input_file.identity(), mapped_file, ++use_clock};
+            cached_bytes += mapped_file->size();
+        }
+        return mapped_file;
+    }
+
+    size_t mapping_count() const { return cached_mappings.size(); }
+    size_t mapped_bytes() const { return cached_bytes; }
+
+private:
+    struct cached_mapping {
+        file_identity mapped_identity;
+        std::shared_ptr<const mapped_file_region> mapped_file;
+        unsigned long long last_use;
+    };
+
+    void forget_mapping(std::map<std::string, cached_mapping>::iterator cached_entry) {
+        cached_bytes -= cached_entry->second.mapped_file->size();
+        cached_mappings.erase(cached_entry);
+    }
+
+    // You scan for the oldest entry; the cache is small enough that a linear pass costs nothing
+    void forget_least_recent_mapping() {
+        auto oldest_entry = cached_mappings.begin();
+        for (auto cached_entry = cached_mappings.begin(); cached_entry != cached_mappings.end(); ++cached_entry) {
+            if (cached_entry->second.last_use < oldest_entry->second.last_use) {
+                oldest_entry = cached_entry;
+            }
+        }
+        forget_mapping(oldest_entry);
+    }
+
+    std::map<std::string, cached_mapping> cached_mappings;
+    size_t cached_bytes = 0;
+    unsigned long long use_clock = 0;
+};
+
+// Memory the result cache may spend on remembered match records
+const size_t RESULT_CACHE_BYTE_LIMIT = 64 << 20;
+
+// Bytes at each end of a file's old content that must be unchanged for growth to count as an append
+const size_t APPEND_FINGERPRINT_SIZE = 4096;
+
+// Function to hash the first and last bytes of a content prefix so the prefix can be recognised after an append
+inline unsigned long long fingerprint_content_prefix(std::string_view content, size_t prefix_size) {
+    unsigned long long fingerprint = 14695981039346656037ULL;
+    auto mix_bytes = [&fingerprint](const char* range_begin, const char* range_end) {
+        for (const char* position = range_begin; position < range_end; ++position) {
+            fingerprint = (fingerprint ^ static_cast<unsigned char>(*position)) * 1099511628211ULL;
+        }
+    };
+
+    size_t edge_size = std::min(prefix_size, APPEND_FINGERPRINT_SIZE);
+    mix_bytes(content.data(), content.data() + edge_size);
+    mix_bytes(content.data() + prefix_size - edge_size, content.data() + prefix_size);
+    return fingerprint;
+}
+
+// Function to search mapped content from a line start onwards, numbering lines and offsets as in the whole file
+// The statistics cover only the searched part
+inline std::vector<match_record> search_content_from(std::string_view content, size_t scan_offset,
+                                                     size_t first_line_number, const compiled_query& query,
+                                                     file_content_statistics& scanned_statistics) {
+    std::string_view scanned_content = content.substr(scan_offset);
+    std::vector<match_record> match_records = visit_query_matcher(query, [&](const auto& line_matcher) {
+        if (search_thread_count() > 1 && scanned_content.size() >= PARALLEL_SCAN_MIN_SIZE) {
+            return search_mapped_content_parallel(scanned_content, line_matcher, &scanned_statistics);
+        }
+        return search_mapped_content(scanned_content, line_matcher, &scanned_statistics);
+    });
+
+    for (match_record& record : match_records) {
+        record.line_number += first_line_number - 1;
+        record.line_offset += scan_offset;
+    }
+    return match_records;
+}
+
+// How the result cache answered one search
+struct result_cache_lookup {
+    enum lookup_kind { full_scan, cached_result, appended_tail };
+
+    lookup_kind kind = full_scan;
+    size_t rescanned_bytes = 0;
+};
+
+// Match records of earlier searches, reused while a file is unchanged and extended when it has only grown
+// Entries are found by device, inode and normalized query, then checked against the file's size and modification time
+class search_result_cache {
+public:
+    // You answer from the cache when the file is unchanged, rescan only the tail after an append, or scan it all
+    // Statistics are always filled in, because the cache keeps them to extend later appends
+    search_match_set search(std::shared_ptr<const mapped_file_region> mapped_file, const file_identity& identity,
+                            const compiled_query& query, file_content_statistics* file_statistics = nullptr,
+                            result_cache_lookup* lookup = nullptr) {
+        result_cache_lookup search_lookup;
+        std::string_view content = mapped_file->content();
+        cache_key search_key{identity.device_id, identity.inode_number, query.normalized_text};
+        std::vector<match_record> match_records;
+        file_content_statistics content_statistics;
+
+        auto cached_entry = cached_results.find(search_key);
+        if (cached_entry != cached_results.end() && cached_entry->second.scanned_identity == identity) {
+            cached_entry->second.last_use = ++use_clock;
+            match_records = cached_entry->second.match_records;
+            content_statistics = cached_entry->second.final_statistics;
+            search_lookup.kind = result_cache_lookup::cached_result;
+        } else if (cached_entry != cached_results.end() &&
+                   content.size() > cached_entry->second.scanned_identity.file_size &&
+                   fingerprint_content_prefix(content, cached_entry->second.scanned_identity.file_size) ==
+                       cached_entry->second.content_fingerprint) {
+            // You keep every match before the old last line, which an append can only have lengthened
+            cached_result& previous_result = cached_entry->second;
+            match_records = std::move(previous_result.match_records);
+            while (!match_records.empty() && match_records.back().line_offset >= previous_result.resume_offset) {
+                match_records.pop_back();
+            }
+
+            file_content_statistics tail_statistics;
+            std::vector<match_record> tail_records = search_content_from(
+                content, previous_result.resume_offset, previous_result.prefix_statistics.line_count + 1, query,
+                tail_statistics);
+            match_records.insert(match_records.end(), tail_records.begin(), tail_records.end());
+
+            content_statistics = previous_result.prefix_statistics;
+            content_statistics.line_count += tail_statistics.line_count;
+            content_statistics.word_count += tail_statistics.word_count;
+            content_statistics.character_count += tail_statistics.character_count;
+            search_lookup.kind = result_cache_lookup::appended_tail;
+            search_lookup.rescanned_bytes = content.size() - previous_result.resume_offset;
+            remember_result(search_key, identity, content, match_records, content_statistics);
+        } else {
+            match_records = search_content_from(content, 0, 1, query, content_statistics);
+            search_lookup.rescanned_bytes = content.size();
+            remember_result(search_key, identity, content, match_records, content_statistics);
+        }
+
+        if (file_statistics != nullptr) {
+            *file_statistics = content_statistics;
+        }
+        if (lookup != nullptr) {
+            *lookup = search_lookup;
+        }
+        search_match_set match_set;
+        match_set.match_records = std::move(match_records);
+        match_set.attach_mapped_content(std::move(mapped_file));
+        return match_set;
+    }
+
+    size_t entry_count() const { return cached_results.size(); }
+    size_t cached_bytes() const { return used_bytes; }
+
+private:
+    struct cache_key {
+        unsigned long long device_id;
+        unsigned long long inode_number;
+        std::string normalized_query;
+
+        bool operator<(const cache_key& other) const {
+            if (device_id != other.device_id) {
+                return device_id < other.device_id;
+            }
+            if (inode_number != other.inode_number) {
+                return inode_number < other.inode_number;
+            }
+            return normalized_query < other.normalized_query;
+        }
+    };
+
+    struct cached_result {
+        file_identity scanned_identity;
+        std::vector<match_record> match_records;
+        file_content_statistics final_statistics;
+        file_content_statistics prefix_statistics; // Totals for the bytes before resume_offset
+        size_t resume_offset;                      // Start of the last line, where a rescan after an append begins
+        unsigned long long content_fingerprint;
+        size_t entry_bytes;
+        unsigned long long last_use;
+    };
+
+    // You store a finished search, first evicting the least recently used entries until it fits the budget
+    void remember_result(const cache_key& search_key, const file_identity& identity, std::string_view content,
+                         const std::vector<match_record>& match_records,
+                         const file_content_statistics& final_statistics) {
+        auto cached_entry = cached_results.find(search_key);
+        if (cached_entry != cached_results.end()) {
+            forget_result(cached_entry);
+        }
+
+        size_t entry_bytes = sizeof(cached_result) + search_key.normalized_query.size() +
+                             match_records.size() * sizeof(match_record);
+        if (identity.inode_number == 0 || entry_bytes > RESULT_CACHE_BYTE_LIMIT) {
+            return; // You cannot recognise a file without an identity, and a result this large would evict everything
+        }
+        while (!cached_results.empty() && used_bytes + entry_bytes > RESULT_CACHE_BYTE_LIMIT) {
+            forget_least_recent_result();
+        }
+
+        // You derive the totals up to the last line start by removing that line's own contribution
+        size_t resume_offset = content.size();
+        while (resume_offset > 0 && content[resume_offset - 1] != '\n') {
+            resume_offset--;
+        }
+        file_content_statistics last_line_statistics;
+        accumulate_content_statistics(content.data() + resume_offset, content.data() + content.size(),
+                                      last_line_statistics);
+        finish_content_statistics(last_line_statistics);
+        file_content_statistics prefix_statistics;
+        prefix_statistics.line_count = final_statistics.line_count - last_line_statistics.line_count;
+        prefix_statistics.word_count = final_statistics.word_count - last_line_statistics.word_count;
+        prefix_statistics.character_count = final_statistics.character_count - last_line_statistics.character_count;
+
+        cached_results[search_key] = cached_result{identity, match_records, final_statistics, prefix_statistics,
+                                                   resume_offset, fingerprint_content_prefix(content, content.size()),
+                                                   entry_bytes, ++use_clock};
+        used_bytes += entry_bytes;
+    }
+
+    void forget_result(std::map<cache_key, cached_result>::iterator cached_entry) {
+        used_bytes -= cached_entry->second.entry_bytes;
+        cached_results.erase(cached_entry);
+    }
+
+    void forget_least_recent_result() {
+        auto oldest_entry = cached_results.begin();
+        for (auto cached_entry = cached_results.begin(); cached_entry != cached_results.end(); ++cached_entry) {
+            if (cached_entry->second.last_use < oldest_entry->second.last_use) {
+                oldest_entry = cached_entry;
+            }
+        }
+        forget_result(oldest_entry);
+    }
+
+    std::map<cache_key, cached_result> cached_results;
+    size_t used_bytes = 0;
+    unsigned long long use_clock = 0;
+};
+
+// Bytes of a file each block filter covers before its end moves forward to a newline
+const size_t FILTER_BLOCK_SIZE = 1 << 20;
+
+// Name added to a file's path to find the sidecar holding its block filters
+const char* const BLOCK_FILTER_SUFFIX = ".tsbf";
+
+// Tag at the start of a block filter sidecar, followed by the format version
+const uint32_t BLOCK_FILTER_MAGIC = 0x46425354; // "TSBF" in little-endian byte order
+const uint32_t BLOCK_FILTER_VERSION = 2;
+
+// Bits each filter sets per trigram, and bits it spends per distinct trigram of its block
+// Ten bits and three probes let about one absent trigram in sixty through
+const uint32_t FILTER_PROBE_COUNT = 3;
+const size_t FILTER_BITS_PER_TRIGRAM = 10;
+
+// Smallest and largest filter of one block in bits; every filter size is a power of two between them
+const size_t MIN_FILTER_BITS = 1 << 12;
+const size_t MAX_FILTER_BITS = 1 << 20;
+
+// Fixed header of a block filter sidecar; like an index image it is little-endian and used in place
+struct block_filter_header {
+    uint32_t filter_magic;
+    uint32_t filter_version;
+    uint32_t header_size;
+    uint32_t probe_count;
+    uint64_t block_count;
+    uint64_t device_id;              // Identity of the filtered file; its size and time may change as it grows
+    uint64_t inode_number;
+    uint64_t built_file_size;        // Size and modification time of the whole file at build time
+    int64_t built_modified_nanoseconds;
+    uint64_t covered_size;           // Bytes up to the last newline at build time
+    uint64_t covered_fingerprint;    // fingerprint_content_prefix of the covered bytes
+    uint64_t covered_line_count;     // Statistics of the covered bytes, so skipped blocks still count
+    uint64_t covered_word_count;
+    uint64_t covered_character_count;
+    uint64_t blocks_offset;          // filter_block_entry[block_count]
+    uint64_t filters_offset;         // Bloom filter bits of every block
+    uint64_t filters_size;
+    uint64_t image_size;
+    uint64_t content_checksum;       // Covers every byte after the header
+    uint64_t header_checksum;        // Covers the header with this field zeroed
+};
+
+// One line-aligned block of the filtered file and the Bloom filter over its folded trigrams
+struct filter_block_entry {
+    uint64_t block_offset;
+    uint64_t block_size;
+    uint64_t first_line_number;
+    uint64_t filter_offset;          // Into the filter bytes
+    uint64_t filter_bits;
+    uint64_t filter_checksum;        // Checked before the filter is trusted, so a damaged one never hides a match
+};
+
+static_assert(sizeof(block_filter_header) == 144, "filter header layout must not depend on the compiler");
+static_assert(sizeof(filter_block_entry) == 48, "filter block entry layout must not depend on the compiler");
+
+// Totals reported after a search through block filters
+struct block_filter_summary {
+    size_t filtered_blocks = 0;   // Blocks the sidecar covers
+    size_t candidate_blocks = 0;  // Blocks whose filter could not rule out a match
+    size_t scanned_bytes = 0;     // Candidate blocks plus the bytes appended since the sidecar was built
+};
+
+// Per-block Bloom filters over the folded trigrams of one large file, kept in a sidecar beside it
+// The sidecar covers the file up to its last newline when built; bytes appended later are scanned whole,
+// so an append-only log stays searchable through its sidecar and only needs rebuilding to filter its new part
+class block_filter_sidecar {
+public:
+    // You move a sidecar but never copy it, since its tables point into the image it owns
+    block_filter_sidecar() = default;
+    block_filter_sidecar(const block_filter_sidecar&) = delete;
+    block_filter_sidecar& operator=(const block_filter_sidecar&) = delete;
+    block_filter_sidecar(block_filter_sidecar&&) = default;
+    block_filter_sidecar& operator=(block_filter_sidecar&&) = default;
+
+    // You cut a file into blocks of about a megabyte and size each block's filter to its distinct trigrams
+    bool build(const std::string& file_path, std::string& error_message) {
+        input_file_handle input_file;
+        mapped_file_region mapped_file;
+        if (!input_file.open(file_path) || !mapped_file.map(input_file)) {
+            error_message = "Cannot map file '" + file_path + "'";
+            return false;
+        }
+
+        // You stop at the last newline, since an append may still lengthen the final line
+        std::string_view content = mapped_file.content();
+        size_t covered_size = content.size();
+        while (covered_size > 0 && content[covered_size - 1] != '\n') {
+            covered_size--;
+        }
+
+        std::vector<uint64_t> seen_trigrams((1 << 24) / 64, 0);
+        std::vector<filter_block_entry> block_table;
+        std::string filter_table;
+        file_content_statistics covered_statistics;
+        const char* covered_end = content.data() + covered_size;
+        const char* block_begin = content.data();
+        uint64_t first_line_number = 1;
+        while (block_begin < covered_end) {
+            const char* block_end = line_aligned_block_end(block_begin, covered_end, FILTER_BLOCK_SIZE);
+            std::vector<uint32_t> block_trigrams;
+            size_t newline_count = collect_block_trigrams(block_begin, block_end, seen_trigrams, block_trigrams);
+            accumulate_content_statistics(block_begin, block_end, covered_statistics);
+
+            size_t filter_bits = MIN_FILTER_BITS;
+            while (filter_bits < MAX_FILTER_BITS && filter_bits < block_trigrams.size() * FILTER_BITS_PER_TRIGRAM) {
+                filter_bits <<= 1;
+            }
+            size_t filter_offset = filter_table.size();
+            filter_table.resize(filter_offset + filter_bits / 8, '\0');
+            unsigned char* filter_bytes = reinterpret_cast<unsigned char*>(&filter_table[filter_offset]);
+            for (uint32_t trigram : block_trigrams) {
+                add_filter_trigram(filter_bytes, filter_bits, FILTER_PROBE_COUNT, trigram);
+            }
+
+            block_table.push_back(filter_block_entry{static_cast<uint64_t>(block_begin - content.data()),
+                                                     static_cast<uint64_t>(block_end - block_begin),
+                                                     first_line_number, filter_offset, filter_bits,
+                                                     checksum_index_bytes(&filter_table[filter_offset],
+                                                                          filter_bits / 8)});
+            first_line_number += newline_count;
+            block_begin = block_end;
+        }
+
+        block_filter_header built_header;
+        std::memset(&built_header, 0, sizeof(built_header));
+        built_header.device_id = input_file.identity().device_id;
+        built_header.inode_number = input_file.identity().inode_number;
+        built_header.built_file_size = input_file.identity().file_size;
+        built_header.built_modified_nanoseconds = input_file.identity().modified_nanoseconds;
+        built_header.covered_size = covered_size;
+        built_header.covered_fingerprint = fingerprint_content_prefix(content, covered_size);
+        built_header.covered_line_count = covered_statistics.line_count;
+        built_header.covered_word_count = covered_statistics.word_count;
+        built_header.covered_character_count = covered_statistics.character_count;
+        build_image(built_header, block_table, filter_table);
+        return true;
+    }
+
+    // You write the sidecar image exactly as it will later be mapped
+    bool save(const std::string& sidecar_path, std::string& error_message) const {
+        if (!host_is_little_endian()) {
+            error_message = "Block filters can only be written on little-endian machines";
+            return false;
+        }
+        if (!write_image_file(sidecar_path, image_data, image_size)) {
+            error_message = "Cannot write block filters '" + sidecar_path + "'";
+            return false;
+        }
+        return true;
+    }
+
+    // You map a saved sidecar and check its header and block table, which are small next to the file they filter
+    bool load(const std::string& sidecar_path, std::string& error_message) {
+        *this = block_filter_sidecar();
+        if (!host_is_little_endian()) {
+            error_message = "Block filters can only be read on little-endian machines";
+            return false;
+        }
+
+        if (!read_image_file(sidecar_path, image_mapping, owned_image, image_data, image_size)) {
+            error_message = "Cannot open block filters '" + sidecar_path + "'";
+            return false;
+        }
+
+        if (!attach_image(error_message)) {
+            error_message = "Block filters '" + sidecar_path + "' " + error_message;
+            *this = block_filter_sidecar();
+            return false;
+        }
+        return true;
+    }
+
+    // You read every byte after the header and compare it with the checksum stored at build time
+    bool verify_checksum(std::string& error_message) const {
+        if (checksum_index_bytes(image_data + sizeof(block_filter_header), image_size - sizeof(block_filter_header)) !=
+            image_header->content_checksum) {
+            error_message = "Block filter content does not match its checksum";
+            return false;
+        }
+        return true;
+    }
+
+    // You accept the same file either untouched since the build or grown by an append
+    // An edit that keeps the size only moves the modification time, and the fingerprint sees just the edges of the
+    // covered bytes, so a changed time counts as an append only when the file also grew past its built size
+    bool describes(const file_identity& identity, std::string_view content) const {
+        if (image_header == nullptr || identity.inode_number == 0 || identity.device_id != image_header->device_id ||
+            identity.inode_number != image_header->inode_number || content.size() < image_header->covered_size) {
+            return false;
+        }
+        bool unchanged = identity.modified_nanoseconds == image_header->built_modified_nanoseconds &&
+                         identity.file_size == image_header->built_file_size;
+        bool appended = identity.modified_nanoseconds != image_header->built_modified_nanoseconds &&
+                        identity.file_size > image_header->built_file_size;
+        return (unchanged || appended) &&
+               fingerprint_content_prefix(content, static_cast<size_t>(image_header->covered_size)) ==
+                   image_header->covered_fingerprint;
+    }
+
+    // You list the blocks whose filters hold every trigram the plan needs, in file order
+    // A block whose filter fails its checksum is always listed
+    std::vector<size_t> candidate_blocks(const trigram_plan& plan) const {
+        std::vector<size_t> block_indexes;
+        for (size_t block_index = 0; block_index < block_count(); block_index++) {
+            const filter_block_entry& block_entry = block_entries[block_index];
+            if (checksum_index_bytes(reinterpret_cast<const char*>(filter_table + block_entry.filter_offset),
+                                     static_cast<size_t>(block_entry.filter_bits / 8)) != block_entry.filter_checksum ||
+                filter_admits(plan, block_entry)) {
+                block_indexes.push_back(block_index);
+            }
+        }
+        return block_indexes;
+    }
+
+    // You scan the candidate blocks of a file the sidecar describes, then every byte appended after it was built
+    // Statistics come from the sidecar for the covered bytes, so blocks that were skipped still count
+    search_match_set search(std::shared_ptr<mapped_file_region> mapped_file, const compiled_query& query,
+                            const std::vector<size_t>& block_indexes, file_content_statistics* file_statistics = nullptr,
+                            block_filter_summary* filter_summary = nullptr) const {
+        std::string_view content = mapped_file->content();
+        const char* content_begin = content.data();
+        size_t covered_size = static_cast<size_t>(image_header->covered_size);
+        size_t scanned_bytes = content.size() - covered_size;
+
+        // You leave read-ahead to the advice given for each candidate, so skipped blocks are never read
+        mapped_file->advise_random_access();
+        std::vector<match_record> match_records = visit_query_matcher(query, [&](const auto& line_matcher) {
+            std::vector<match_record> block_records;
+            for (size_t block_index : block_indexes) {
+                const filter_block_entry& block_entry = block_entries[block_index];
+                const char* block_begin = content_begin + block_entry.block_offset;
+                mapped_file->advise_range_needed(static_cast<size_t>(block_entry.block_offset),
+                                                 static_cast<size_t>(block_entry.block_size));
+                scanned_bytes += static_cast<size_t>(block_entry.block_size);
+                scan_mapped_range(block_begin, block_begin + block_entry.block_size, block_entry.first_line_number,
+                                  line_matcher, nullptr,
+                                  [&](size_t line_number, const char* line_begin, const char* line_end) {
+                    block_records.push_back(
+                        make_match_record(content_begin, line_number, line_begin, line_end, line_matcher));
+                });
+            }
+            return block_records;
+        });
+
+        file_content_statistics tail_statistics;
+        mapped_file->advise_range_needed(covered_size, content.size() - covered_size);
+        std::vector<match_record> tail_records = search_content_from(
+            content, covered_size, static_cast<size_t>(image_header->covered_line_count) + 1, query, tail_statistics);
+        match_records.insert(match_records.end(), tail_records.begin(), tail_records.end());
+
+        if (file_statistics != nullptr) {
+            file_statistics->line_count = static_cast<size_t>(image_header->covered_line_count) +
+                                          tail_statistics.line_count;
+            file_statistics->word_count = static_cast<size_t>(image_header->covered_word_count) +
+                                          tail_statistics.word_count;
+            file_statistics->character_count = static_cast<size_t>(image_header->covered_character_count) +
+                                               tail_statistics.character_count;
+        }
+        if (filter_summary != nullptr) {
+            filter_summary->filtered_blocks = block_count();
+            filter_summary->candidate_blocks = block_indexes.size();
+            filter_summary->scanned_bytes = scanned_bytes;
+        }
+        search_match_set match_set;
+        match_set.match_records = std::move(match_records);
+        match_set.attach_mapped_content(std::move(mapped_file));
+        return match_set;
+    }
+
+    size_t block_count() const { return image_header ? static_cast<size_t>(image_header->block_count) : 0; }
+    size_t covered_bytes() const { return image_header ? static_cast<size_t>(image_header->covered_size) : 0; }
+    size_t filter_bytes() const { return image_header ? static_cast<size_t>(image_header->filters_size) : 0; }
+    size_t image_bytes() const { return image_size; }
+
+    // You add up the bytes of the given blocks, to judge how much of the file they cover
+    size_t block_bytes(const std::vector<size_t>& block_indexes) const {
+        size_t total_bytes = 0;
+        for (size_t block_index : block_indexes) {
+            total_bytes += static_cast<size_t>(block_entries[block_index].block_size);
+        }
+        return total_bytes;
+    }
+
+private:
+    // You derive every probe from one mixed hash of the trigram, stepping by its odd upper half
+    static uint64_t filter_probe_hash(uint32_t trigram) {
+        uint64_t trigram_hash = (static_cast<uint64_t>(trigram) + 1) * 0x9E3779B97F4A7C15ULL;
+        trigram_hash ^= trigram_hash >> 31;
+        return trigram_hash * 0xBF58476D1CE4E5B9ULL;
+    }
+
+    static void add_filter_trigram(unsigned char* filter_bytes, uint64_t filter_bits, uint32_t probe_count,
+                                   uint32_t trigram) {
+        uint64_t trigram_hash = filter_probe_hash(trigram);
+        uint64_t probe_step = (trigram_hash >> 32) | 1;
+        for (uint32_t probe_index = 0; probe_index < probe_count; probe_index++) {
+            uint64_t bit_index = (trigram_hash + probe_index * probe_step) & (filter_bits - 1);
+            filter_bytes[bit_index >> 3] |= static_cast<unsigned char>(1u << (bit_index & 7));
+        }
+    }
+
+    static bool filter_holds_trigram(const unsigned char* filter_bytes, uint64_t filter_bits, uint32_t probe_count,
+                                     uint32_t trigram) {
+        uint64_t trigram_hash = filter_probe_hash(trigram);
+        uint64_t probe_step = (trigram_hash >> 32) | 1;
+        for (uint32_t probe_index = 0; probe_index < probe_count; probe_index++) {
+            uint64_t bit_index = (trigram_hash + probe_index * probe_step) & (filter_bits - 1);
+            if ((filter_bytes[bit_index >> 3] & (1u << (bit_index & 7))) == 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // You evaluate a plan against one block's filter; false means no line of the block can match
+    bool filter_admits(const trigram_plan& plan, const filter_block_entry& block_entry) const {
+        switch (plan.kind) {
+            case trigram_plan::trigram_leaf:
+                return filter_holds_trigram(filter_table + block_entry.filter_offset, block_entry.filter_bits,
+                                            image_header->probe_count, plan.trigram);
+            case trigram_plan::all_of:
+                for (const trigram_plan& child_plan : plan.children) {
+                    if (!filter_admits(child_plan, block_entry)) {
+                        return false;
+                    }
+                }
+                return true;
+            case trigram_plan::any_of:
+                for (const trigram_plan& child_plan : plan.children) {
+                    if (filter_admits(child_plan, block_entry)) {
+                        return true;
+                    }
+                }
+                return false;
+            default:
+                return true;
+        }
+    }
+
+    // You lay the header, block table and filters out in one 8-byte-aligned image
+    void build_image(block_filter_header built_header, const std::vector<filter_block_entry>& block_table,
+                     const std::string& filter_table_bytes) {
+        built_header.filter_magic = BLOCK_FILTER_MAGIC;
+        built_header.filter_version = BLOCK_FILTER_VERSION;
+        built_header.header_size = sizeof(block_filter_header);
+        built_header.probe_count = FILTER_PROBE_COUNT;
+        built_header.block_count = block_table.size();
+        built_header.blocks_offset = sizeof(block_filter_header);
+        built_header.filters_offset = built_header.blocks_offset + block_table.size() * sizeof(filter_block_entry);
+        built_header.filters_size = filter_table_bytes.size();
+        built_header.image_size = built_header.filters_offset + filter_table_bytes.size();
+
+        *this = block_filter_sidecar();
+        owned_image.assign(static_cast<size_t>(built_header.image_size / 8), 0);
+        char* image_begin = reinterpret_cast<char*>(owned_image.data());
+        std::memcpy(image_begin + built_header.blocks_offset, block_table.data(),
+                    block_table.size() * sizeof(filter_block_entry));
+        std::memcpy(image_begin + built_header.filters_offset, filter_table_bytes.data(), filter_table_bytes.size());
+
+        built_header.content_checksum = checksum_index_bytes(image_begin + sizeof(block_filter_header),
+                                                             built_header.image_size - sizeof(block_filter_header));
+        built_header.header_checksum = checksum_filter_header(built_header);
+        std::memcpy(image_begin, &built_header, sizeof(built_header));
+
+        std::string error_message;
+        image_data = image_begin;
+        image_size = static_cast<size_t>(built_header.image_size);
+        attach_image(error_message);
+    }
+
+    // You checksum a header as stored, with its own checksum field taken as zero
+    static uint64_t checksum_filter_header(const block_filter_header& filter_header) {
+        block_filter_header zeroed_header = filter_header;
+        zeroed_header.header_checksum = 0;
+        return checksum_index_bytes(reinterpret_cast<const char*>(&zeroed_header), sizeof(zeroed_header));
+    }
+
+    // You check the header, the sections and every block entry, then point the tables into the image
+    // Blocks must tile the covered bytes in order, so a search through them numbers lines exactly as a full scan
+    bool attach_image(std::string& error_message) {
+        if (image_size < sizeof(block_filter_header)) {
+            error_message = "is too short to be a block filter sidecar";
+            return false;
+        }
+        const block_filter_header* candidate_header = reinterpret_cast<const block_filter_header*>(image_data);
+        if (candidate_header->filter_magic != BLOCK_FILTER_MAGIC) {
+            error_message = "is not a block filter sidecar";
+            return false;
+        }
+        if (candidate_header->filter_version != BLOCK_FILTER_VERSION) {
+            error_message = "has unsupported version " + std::to_string(candidate_header->filter_version) +
+                            "; rebuild it with --build-filter";
+            return false;
+        }
+        if (candidate_header->header_size != sizeof(block_filter_header) ||
+            checksum_filter_header(*candidate_header) != candidate_header->header_checksum ||
+            candidate_header->probe_count == 0 || candidate_header->probe_count > 16) {
+            error_message = "has a damaged header";
+            return false;
+        }
+        if (candidate_header->image_size != image_size || candidate_header->blocks_offset != sizeof(block_filter_header) ||
+            candidate_header->block_count > (image_size - sizeof(block_filter_header)) / sizeof(filter_block_entry) ||
+            candidate_header->filters_offset !=
+                candidate_header->blocks_offset + candidate_header->block_count * sizeof(filter_block_entry) ||
+            candidate_header->filters_size != image_size - candidate_header->filters_offset) {
+            error_message = "is truncated or has damaged section offsets";
+            return false;
+        }
+
+        const filter_block_entry* candidate_blocks =
+            reinterpret_cast<const filter_block_entry*>(image_data + candidate_header->blocks_offset);
+        uint64_t next_offset = 0;
+        uint64_t next_line_number = 1;
+        for (size_t block_index = 0; block_index < candidate_header->block_count; block_index++) {
+            const filter_block_entry& block_entry = candidate_blocks[block_index];
+            bool bits_valid = block_entry.filter_bits >= MIN_FILTER_BITS && block_entry.filter_bits <= MAX_FILTER_BITS &&
+                              (block_entry.filter_bits & (block_entry.filter_bits - 1)) == 0;
+            if (block_entry.block_offset != next_offset || block_entry.block_size == 0 ||
+                block_entry.block_size > candidate_header->covered_size - next_offset ||
+                block_entry.first_line_number < next_line_number || !bits_valid ||
+                block_entry.filter_offset > candidate_header->filters_size ||
+                block_entry.filter_bits / 8 > candidate_header->filters_size - block_entry.filter_offset) {
+                error_message = "has a damaged block table";
+                return false;
+            }
+            next_offset += block_entry.block_size;
+            next_line_number = block_entry.first_line_number + 1; // You find at least one newline in every block
+        }
+        if (next_offset != candidate_header->covered_size) {
+            error_message = "has a damaged block table";
+            return false;
+        }
+
+        image_header = candidate_header;
+        block_entries = candidate_blocks;
+        filter_table = reinterpret_cast<const unsigned char*>(image_data + image_header->filters_offset);
+        return true;
+    }
+
+    // You keep the image alive through the mapping of a loaded sidecar or the words of a built one
+    std::shared_ptr<const mapped_file_region> image_mapping;
+    std::vector<uint64_t> owned_image;
+    const char* image_data = nullptr;
+    size_t image_size = 0;
+
+    const block_filter_header* image_header = nullptr;
+    const filter_block_entry* block_entries = nullptr;
+    const unsigned char* filter_table = nullptr;
+};
+
+// Function to search a file through the block filter sidecar beside it, reading only blocks that may match
+// Returns false without searching when there is no sidecar describing the file, or when its filters would rule
+// out less than half of the file; the ordinary scan is faster then, since it reads sequentially on every core
+inline bool search_filtered_file(const std::string& file_path, input_file_handle& input_file,
+                                 const compiled_query& query, search_match_set& match_set,
+                                 file_content_statistics* file_statistics = nullptr,
+                                 block_filter_summary* filter_summary = nullptr) {
+    trigram_plan plan = query_index_plan(query);
+    if (plan.kind == trigram_plan::match_all || !input_file.is_regular_file()) {
+        return false;
+    }
+    block_filter_sidecar block_filters;
+    std::string error_message;
+    if (!block_filters.load(file_path + BLOCK_FILTER_SUFFIX, error_message)) {
+        return false;
+    }
+
+    std::shared_ptr<mapped_file_region> mapped_file = std::make_shared<mapped_file_region>();
+    if (!mapped_file->map(input_file) || !block_filters.describes(input_file.identity(), mapped_file->content())) {
+        return false;
+    }
+    std::vector<size_t> block_indexes = block_filters.candidate_blocks(plan);
+    if (block_filters.block_bytes(block_indexes) * 2 > block_filters.covered_bytes()) {
+        return false;
+    }
+    match_set = block_filters.search(std::move(mapped_file), query, block_indexes, file_statistics, filter_summary);
+    return true;
+}
+
+// Lines between the recorded starts of a line table; a lookup walks at most this many lines from a start
+const size_t LINE_SAMPLE_INTERVAL = 64;
+
+// Name added to a file's path to find the sidecar holding its line table
+const char* const LINE_TABLE_SUFFIX = ".tslx";
+
+// Tag at the start of a line table sidecar, followed by the format version
+const uint32_t LINE_TABLE_MAGIC = 0x584C5354; // "TSLX" in little-endian byte order
+const uint32_t LINE_TABLE_VERSION = 2;
+
+// Bytes appended after a line table was built before a lookup rebuilds it instead of walking them
+const size_t LINE_TABLE_REBUILD_BYTES = 16 << 20;
+
+// Fixed header of a line table sidecar, followed by the recorded line starts as uint64_t offsets
+struct line_table_header {
+    uint32_t table_magic;
+    uint32_t table_version;
+    uint32_t header_size;
+    uint32_t sample_interval;
+    uint64_t device_id;              // Identity of the file; its size and time may change as it grows
+    uint64_t inode_number;
+    uint64_t built_file_size;        // Size and modification time of the whole file at build time
+    int64_t built_modified_nanoseconds;
+    uint64_t covered_size;           // Bytes up to the last newline at build time
+    uint64_t covered_fingerprint;    // fingerprint_content_prefix of the covered bytes
+    uint64_t covered_line_count;     // Newlines in the covered bytes
+    uint64_t sample_count;           // Start of line k * sample_interval + 1 for every k up to the covered end
+    uint64_t image_size;
+    uint64_t content_checksum;       // Covers every byte after the header
+    uint64_t header_checksum;        // Covers the header with this field zeroed
+};
+
+static_assert(sizeof(line_table_header) == 104, "line table header layout must not depend on the compiler");
+
+// Function to count the newlines in a byte range, sixteen bytes at a time where SSE2 is available
+inline size_t count_newlines(const char* range_begin, const char* range_end) {
+    size_t newline_count = 0;
+    const char* position = range_begin;
+#if TEXT_SEARCH_HAS_SSE2
+    const __m128i newline_bytes = _mm_set1_epi8('\n');
+    for (; range_end - position >= 16; position += 16) {
+        __m128i byte_block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(position));
+        unsigned newline_mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(byte_block, newline_bytes)));
+        for (; newline_mask != 0; newline_mask &= newline_mask - 1) {
+            newline_count++;
+        }
+    }
+#endif
+    for (; position < range_end; ++position) {
+        newline_count += *position == '\n' ? 1 : 0;
+    }
+    return newline_count;
+}
+
+// Function to record the offset of every sample_interval-th line start after a range's first line
+// Returns the number of newlines in the range; offsets are relative to range_begin
+inline size_t collect_line_samples(const char* range_begin, const char* range_end, size_t sample_interval,
+                                   std::vector<uint64_t>& line_samples) {
+    size_t newline_count = 0;
+    auto record_newline = [&](const char* newline_position) {
+        if (++newline_count % sample_interval == 0) {
+            line_samples.push_back(static_cast<uint64_t>(newline_position + 1 - range_begin));
+        }
+    };
+
+    // You find sixteen newlines with one compare and visit only the set bits of its mask
+    const char* position = range_begin;
+#if TEXT_SEARCH_HAS_SSE2
+    const __m128i newline_bytes = _mm_set1_epi8('\n');
+    for (; range_end - position >= 16; position += 16) {
+        __m128i byte_block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(position));
+        unsigned newline_mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(byte_block, newline_bytes)));
+        for (; newline_mask != 0; newline_mask &= newline_mask - 1) {
+            record_newline(position + lowest_set_bit(newline_mask));
+        }
+    }
+#endif
+    for (; position < range_end; ++position) {
+        if (*position == '\n') {
+            record_newline(position);
+        }
+    }
+    return newline_count;
+}
+
+// Start offsets of every 64th line of a file, kept in a sidecar so lines can be reached by number without a scan
+// The table covers the file up to its last newline when built; lines appended later are found by walking from its end
+class line_offset_table {
+public:
+    // You move a table but never copy it, since its samples point into the image it owns
+    line_offset_table() = default;
+    line_offset_table(const line_offset_table&) = delete;
+    line_offset_table& operator=(const line_offset_table&) = delete;
+    line_offset_table(line_offset_table&&) = default;
+    line_offset_table& operator=(line_offset_table&&) = default;
+
+    // You record the line starts of mapped content in one pass over its newlines
+    void build(const file_identity& identity, std::string_view content) {
+        size_t covered_size = content.size();
+        while (covered_size > 0 && content[covered_size - 1] != '\n') {
+            covered_size--;
+        }
+        std::vector<uint64_t> line_samples(1, 0);
+        size_t newline_count = collect_line_samples(content.data(), content.data() + covered_size,
+                                                    LINE_SAMPLE_INTERVAL, line_samples);
+
+        line_table_header built_header;
+        std::memset(&built_header, 0, sizeof(built_header));
+        built_header.table_magic = LINE_TABLE_MAGIC;
+        built_header.table_version = LINE_TABLE_VERSION;
+        built_header.header_size = sizeof(line_table_header);
+        built_header.sample_interval = LINE_SAMPLE_INTERVAL;
+        built_header.device_id = identity.device_id;
+        built_header.inode_number = identity.inode_number;
+        built_header.built_file_size = identity.file_size;
+        built_header.built_modified_nanoseconds = identity.modified_nanoseconds;
+        built_header.covered_size = covered_size;
+        built_header.covered_fingerprint = fingerprint_content_prefix(content, covered_size);
+        built_header.covered_line_count = newline_count;
+        built_header.sample_count = line_samples.size();
+        built_header.image_size = sizeof(line_table_header) + line_samples.size() * sizeof(uint64_t);
+
+        *this = line_offset_table();
+        owned_image.assign(static_cast<size_t>(built_header.image_size / 8), 0);
+        char* image_begin = reinterpret_cast<char*>(owned_image.data());
+        std::memcpy(image_begin + sizeof(line_table_header), line_samples.data(),
+                    line_samples.size() * sizeof(uint64_t));
+        built_header.content_checksum = checksum_index_bytes(image_begin + sizeof(line_table_header),
+                                                             built_header.image_size - sizeof(line_table_header));
+        built_header.header_checksum = checksum_table_header(built_header);
+        std::memcpy(image_begin, &built_header, sizeof(built_header));
+
+        std::string error_message;
+        image_data = image_begin;
+        image_size = static_cast<size_t>(built_header.image_size);
+        attach_image(error_message);
+    }
+
+    // You map a file and record its line starts, for a table that is about to be saved beside it
+    bool build(const std::string& file_path, std::string& error_message) {
+        input_file_handle input_file;
+        mapped_file_region mapped_file;
+        if (!input_file.open(file_path) || !mapped_file.map(input_file)) {
+            error_message = "Cannot map file '" + file_path + "'";
+            return false;
+        }
+        build(input_file.identity(), mapped_file.content());
+        return true;
+    }
+
+    // You write the table image exactly as it will later be mapped
+    bool save(const std::string& table_path, std::string& error_message) const {
+        if (!host_is_little_endian()) {
+            error_message = "Line tables can only be written on little-endian machines";
+            return false;
+        }
+        if (!write_image_file(table_path, image_data, image_size)) {
+            error_message = "Cannot write line table '" + table_path + "'";
+            return false;
+        }
+        return true;
+    }
+
+    // You map a saved table and check it whole, since it holds eight bytes for every 64 lines of its file
+    bool load(const std::string& table_path, std::string& error_message) {
+        *this = line_offset_table();
+        if (!host_is_little_endian()) {
+            error_message = "Line tables can only be read on little-endian machines";
+            return false;
+        }
+        if (!read_image_file(table_path, image_mapping, owned_image, image_data, image_size)) {
+            error_message = "Cannot open line table '" + table_path + "'";
+            return false;
+        }
+        if (!attach_image(error_message)) {
+            error_message = "Line table '" + table_path + "' " + error_message;
+            *this = line_offset_table();
+            return false;
+        }
+        return true;
+    }
+
+    // You accept the same file either untouched since the build or grown by an append, as block filters do
+    bool describes(const file_identity& identity, std::string_view content) const {
+        if (image_header == nullptr || identity.inode_number == 0 || identity.device_id != image_header->device_id ||
+            identity.inode_number != image_header->inode_number || content.size() < image_header->covered_size) {
+            return false;
+        }
+        bool unchanged = identity.modified_nanoseconds == image_header->built_modified_nanoseconds &&
+                         identity.file_size == image_header->built_file_size;
+        bool appended = identity.modified_nanoseconds != image_header->built_modified_nanoseconds &&
+                        identity.file_size > image_header->built_file_size;
+        return (unchanged || appended) &&
+               fingerprint_content_prefix(content, static_cast<size_t>(image_header->covered_size)) ==
+                   image_header->covered_fingerprint;
+    }
+
+    // You find where a line starts from the nearest recorded start, walking at most 63 lines of the file
+    // Lines appended since the build are walked from the end of the table; returns false past the last line
+    bool line_start(std::string_view content, size_t line_number, size_t& line_offset) const {
+        if (image_header == nullptr || line_number == 0) {
+            return false;
+        }
+        size_t sample_index = std::min((line_number - 1) / LINE_SAMPLE_INTERVAL, sample_count() - 1);
+        size_t skipped_lines = line_number - 1 - sample_index * LINE_SAMPLE_INTERVAL;
+        const char* content_end = content.data() + content.size();
+        const char* line_begin = content.data() + line_samples[sample_index];
+        for (; skipped_lines > 0; skipped_lines--) {
+            const char* line_end = find_line_end(line_begin, content_end);
+            if (line_end == content_end) {
+                return false;
+            }
+            line_begin = line_end + 1;
+        }
+        if (line_begin == content_end) {
+            return false;
+        }
+        line_offset = static_cast<size_t>(line_begin - content.data());
+        return true;
+    }
+
+    // You number the line holding a byte offset by a binary search of the recorded starts
+    // A caller stepping forward through a file passes the last line start it numbered, and counting resumes from
+    // there whenever it is nearer than the recorded start, so lines appended since the build are walked only once
+    size_t line_number_at(std::string_view content, size_t byte_offset, size_t known_offset = 0,
+                          size_t known_line_number = 1) const {
+        byte_offset = std::min(byte_offset, content.size());
+        const uint64_t* later_sample = std::upper_bound(line_samples, line_samples + sample_count(), byte_offset);
+        size_t sample_index = static_cast<size_t>(later_sample - line_samples) - 1;
+        size_t count_offset = static_cast<size_t>(line_samples[sample_index]);
+        size_t line_number = sample_index * LINE_SAMPLE_INTERVAL + 1;
+        if (known_offset >= count_offset && known_offset <= byte_offset) {
+            count_offset = known_offset;
+            line_number = known_line_number;
+        }
+        return line_number + count_newlines(content.data() + count_offset, content.data() + byte_offset);
+    }
+
+    size_t covered_bytes() const { return image_header ? static_cast<size_t>(image_header->covered_size) : 0; }
+    size_t covered_lines() const { return image_header ? static_cast<size_t>(image_header->covered_line_count) : 0; }
+    size_t sample_count() const { return image_header ? static_cast<size_t>(image_header->sample_count) : 0; }
+    size_t image_bytes() const { return image_size; }
+
+private:
+    // You checksum a header as stored, with its own checksum field taken as zero
+    static uint64_t checksum_table_header(const line_table_header& table_header) {
+        line_table_header zeroed_header = table_header;
+        zeroed_header.header_checksum = 0;
+        return checksum_index_bytes(reinterpret_cast<const char*>(&zeroed_header), sizeof(zeroed_header));
+    }
+
+    // You check the header, the checksum and the order of every recorded start, then point the samples into the image
+    bool attach_image(std::string& error_message) {
+        if (image_size < sizeof(line_table_header)) {
+            error_message = "is too short to be a line table";
+            return false;
+        }
+        const line_table_header* candidate_header = reinterpret_cast<const line_table_header*>(image_data);
+        if (candidate_header->table_magic != LINE_TABLE_MAGIC) {
+            error_message = "is not a line table";
+            return false;
+        }
+        if (candidate_header->table_version != LINE_TABLE_VERSION ||
+            candidate_header->sample_interval != LINE_SAMPLE_INTERVAL) {
+            error_message = "has unsupported version " + std::to_string(candidate_header->table_version);
+            return false;
+        }
+        if (candidate_header->header_size != sizeof(line_table_header) ||
+            checksum_table_header(*candidate_header) != candidate_header->header_checksum) {
+            error_message = "has a damaged header";
+            return false;
+        }
+        if (candidate_header->image_size != image_size ||
+            candidate_header->sample_count != candidate_header->covered_line_count / LINE_SAMPLE_INTERVAL + 1 ||
+            candidate_header->sample_count != (image_size - sizeof(line_table_header)) / sizeof(uint64_t) ||
+            (image_size - sizeof(line_table_header)) % sizeof(uint64_t) != 0 ||
+            checksum_index_bytes(image_data + sizeof(line_table_header), image_size - sizeof(line_table_header)) !=
+                candidate_header->content_checksum) {
+            error_message = "is truncated or does not match its checksum";
+            return false;
+        }
+
+        const uint64_t* candidate_samples = reinterpret_cast<const uint64_t*>(image_data + sizeof(line_table_header));
+        for (size_t sample_index = 0; sample_index < candidate_header->sample_count; sample_index++) {
+            if (candidate_samples[sample_index] > candidate_header->covered_size ||
+                (sample_index == 0 ? candidate_samples[0] != 0
+                                   : candidate_samples[sample_index] <= candidate_samples[sample_index - 1])) {
+                error_message = "has line starts out of order";
+                return false;
+            }
+        }
+
+        image_header = candidate_header;
+        line_samples = candidate_samples;
+        return true;
+    }
+
+    // You keep the image alive through the mapping of a loaded table or the words of a built one
+    std::shared_ptr<const mapped_file_region> image_mapping;
+    std::vector<uint64_t> owned_image;
+    const char* image_data = nullptr;
+    size_t image_size = 0;
+
+    const line_table_header* image_header = nullptr;
+    const uint64_t* line_samples = nullptr;
+};
+
+// Function to find a line of a file by number, returning it as a match so it displays with its context
+// The line table beside the file is used when it still describes it; otherwise one is built in memory in a single
+// pass and dropped afterwards, since only --build-lines writes sidecars
+// Returns false only when the file cannot be read; a line past the end leaves the match set empty
+inline bool lookup_numbered_line(const std::string& file_path, size_t line_number, search_match_set& match_set,
+                                 std::string& error_message, bool* table_built = nullptr) {
+    input_file_handle input_file;
+    std::shared_ptr<mapped_file_region> mapped_file = std::make_shared<mapped_file_region>();
+    if (!input_file.open(file_path) || !mapped_file->map(input_file)) {
+        error_message = "Cannot map file '" + file_path + "'";
+        return false;
+    }
+    std::string_view content = mapped_file->content();
+
+    // You rebuild a table that no longer describes the file or has fallen far behind an appending log
+    std::string table_path = file_path + LINE_TABLE_SUFFIX;
+    line_offset_table line_table;
+    std::string table_error;
+    bool table_usable = line_table.load(table_path, table_error) &&
+                        line_table.describes(input_file.identity(), content) &&
+                        content.size() - line_table.covered_bytes() <= LINE_TABLE_REBUILD_BYTES;
+    if (!table_usable) {
+        line_table.build(input_file.identity(), content);
+    }
+    if (table_built != nullptr) {
+        *table_built = !table_usable;
+    }
+
+    match_set = search_match_set();
+    size_t line_offset = 0;
+    if (line_table.line_start(content, line_number, line_offset)) {
+        match_set.match_records.push_back(match_record{line_number, line_offset, 0, 0});
+    }
+    match_set.attach_mapped_content(std::move(mapped_file));
+    return true;
+}
+
+// Function to scan a line-aligned range with the matcher's find alone, numbering each matching line through a table
+// No line is split or counted between matches; each number comes from a binary search and a short newline count
+template <typename LineMatcher>
+void scan_numbered_range(std::string_view content, const char* range_begin, const char* range_end,
+                         const line_offset_table& line_table, const LineMatcher& line_matcher,
+                         std::vector<match_record>& match_records) {
+    const char* content_begin = content.data();
+    size_t known_offset = 0;
+    size_t known_line_number = 1;
+    const char* scan_cursor = range_begin;
+    while (scan_cursor < range_end) {
+        const char* match_position = line_matcher.find(scan_cursor, range_end);
+        if (match_position == nullptr) {
+            break;
+        }
+        const char* line_begin = find_line_begin(scan_cursor, match_position);
+        const char* line_end = find_line_end(match_position, range_end);
+        size_t line_offset = static_cast<size_t>(line_begin - content_begin);
+        known_line_number = line_table.line_number_at(content, line_offset, known_offset, known_line_number);
+        known_offset = line_offset;
+        match_records.push_back(make_match_record(content_begin, known_line_number, line_begin, line_end, line_matcher));
+        if (line_end == range_end) {
+            break;
+        }
+        scan_cursor = line_end + 1;
+    }
+}
+
+// Function to search mapped content numbered by a line table, splitting large files across cores
+// Chunks need no newline counts of their own, so their records are joined without renumbering
+template <typename LineMatcher>
+std::vector<match_record> search_numbered_content(std::string_view content, const line_offset_table& line_table,
+                                                  const LineMatcher& line_matcher) {
+    std::vector<match_record> match_records;
+    if (search_thread_count() <= 1 || content.size() < PARALLEL_SCAN_MIN_SIZE) {
+        scan_numbered_range(content, content.data(), content.data() + content.size(), line_table, line_matcher,
+                            match_records);
+        return match_records;
+    }
+
+    std::vector<chunk_scan_result> chunk_results = split_content_into_chunks(content);
+    size_t worker_count = std::min(search_thread_count(), chunk_results.size());
+    std::vector<LineMatcher> worker_matchers(worker_count, line_matcher);
+    run_parallel_tasks(chunk_results.size(), worker_count, [&](size_t worker_index, size_t chunk_index) {
+        chunk_scan_result& chunk_result = chunk_results[chunk_index];
+        scan_numbered_range(content, chunk_result.chunk_begin, chunk_result.chunk_end, line_table,
+                            worker_matchers[worker_index], chunk_result.match_records);
+    });
+    for (chunk_scan_result& chunk_result : chunk_results) {
+        match_records.insert(match_records.end(), chunk_result.match_records.begin(), chunk_result.match_records.end());
+    }
+    return match_records;
+}
+
+// Function to search a file through the line table beside it, mapping each match offset to its line number
+// Returns false without searching when the file is not a regular file or no saved table describes it; the
+// ordinary scan is used then, and whenever statistics are wanted, since they need every line split anyway
+inline bool search_numbered_file(const std::string& file_path, input_file_handle& input_file,
+                                 const compiled_query& query, search_match_set& match_set) {
+    if (!input_file.is_regular_file()) {
+        return false;
+    }
+    line_offset_table line_table;
+    std::string error_message;
+    if (!line_table.load(file_path + LINE_TABLE_SUFFIX, error_message)) {
+        return false;
+    }
+    std::shared_ptr<mapped_file_region> mapped_file = std::make_shared<mapped_file_region>();
+    if (!mapped_file->map(input_file) || !line_table.describes(input_file.identity(), mapped_file->content())) {
+        return false;
+    }
+
+    match_set = search_match_set();
+    match_set.match_records = visit_query_matcher(query, [&](const auto& line_matcher) {
+        return search_numbered_content(mapped_file->content(), line_table, line_matcher);
+    });
+    match_set.attach_mapped_content(std::move(mapped_file));
+    return true;
+}
+
+// Function to search for text within a specific file with enhanced results
+// Returns compact match records; nothing is formatted until the caller displays them
+// A block filter sidecar beside the file lets the search read only the blocks that may match, and a line table
+// numbers matches without splitting the file into lines
+inline search_match_set search_file_content(const std::string& file_path,
+                                     const std::string& search_term,
+                                     const context_window_options& context_window) {
+    compiled_query query;
+    std::string error_message;
+    input_file_handle input_file;
+    if (!prepare_search_query(search_term, query, error_message) || !input_file.open(file_path)) {
+        return search_match_set();
+    }
+    search_match_set match_set;
+    if (!search_filtered_file(file_path, input_file, query, match_set) &&
+        !search_numbered_file(file_path, input_file, query, match_set)) {
+        match_set = search_opened_file(input_file, query, context_window);
+    }
+    return match_set;
+}
+
+// Function to search for text with at most one line of context on each side
+inline search_match_set search_file_content(const std::string& file_path, 
+                                           const std::string& search_term,
+                                           bool show_context = false) {
+    context_window_options context_window;
+    context_window.lines_before = show_context ? 1 : 0;
+    context_window.lines_after = show_context ? 1 : 0;
+    return search_file_content(file_path, search_term, context_window);
+}
+
+// Embeddable search engine that compiles a query once and searches files, buffers and directory trees with it
+// It never writes to the console; each thread needs its own copy because matchers cache state while scanning
+class search_engine {
+public:
+    // You compile a literal term, "@file" pattern list, "re:" regular expression or "~k:" fuzzy term
+    bool compile(const std::string& query_text, std::string& error_message) {
+        compiled_query new_query;
+        if (!prepare_search_query(query_text, new_query, error_message)) {
+            return false;
+        }
+        active_query = std::move(new_query);
+        return true;
+    }
+
+    const compiled_query& query() const { return active_query; }
+
+    void set_context_window(const context_window_options& context_window) { search_context = context_window; }
+    const context_window_options& context_window() const { return search_context; }
+
+    // You search a file the caller already opened, gathering statistics in the same pass when asked
+    search_match_set search_opened_file(input_file_handle& input_file,
+                                        file_content_statistics* file_statistics = nullptr) const {
+        return ::search_opened_file(input_file, active_query, search_context, file_statistics);
+    }
+
+    // You search a file that is already mapped, for example one held warm by a mapped_file_cache
+    search_match_set search_mapped_file(std::shared_ptr<const mapped_file_region> mapped_file,
+                                        file_content_statistics* file_statistics = nullptr) const {
+        return ::search_mapped_file(std::move(mapped_file), active_query, file_statistics);
+    }
+
+    // You open and search a file by path, reporting an error instead of matches if it cannot be read
+    // A block filter sidecar beside the file is used when it still describes it, and a line table when no
+    // statistics are wanted
+    bool search_file(const std::string& file_path, search_match_set& match_set, std::string& error_message,
+                     file_content_statistics* file_statistics = nullptr) const {
+        input_file_handle input_file;
+        if (!input_file.open(file_path)) {
+            error_message = "Cannot access file '" + file_path + "'";
+            return false;
+        }
+        if (!search_filtered_file(file_path, input_file, active_query, match_set, file_statistics) &&
+            (file_statistics != nullptr || !search_numbered_file(file_path, input_file, active_query, match_set))) {
+            match_set = search_opened_file(input_file, file_statistics);
+        }
+        return true;
+    }
+
+    // You search a caller-owned buffer in place and hand every match to the visitor in line order
+    // The visitor receives (const match_record&, std::string_view line_text); returns the match count
+    template <typename MatchVisitor>
+    size_t search_buffer(std::string_view content, MatchVisitor&& on_match) const {
+        return visit_query_matcher(active_query, [&](const auto& line_matcher) {
+            const char* content_begin = content.data();
+            size_t match_count = 0;
+            scan_mapped_range(content_begin, content_begin + content.size(), 1, line_matcher, nullptr,
+                              [&](size_t line_number, const char* line_begin, const char* line_end) {
+                on_match(make_match_record(content_begin, line_number, line_begin, line_end, line_matcher),
+                         std::string_view(line_begin, static_cast<size_t>(line_end - line_begin)));
+                match_count++;
+            });
+            return match_count;
+        });
+    }
+
+    // You replay the records of an earlier search together with their line text
+    template <typename MatchVisitor>
+    void visit_matches(const search_match_set& match_set, MatchVisitor&& on_match) const {
+        for (const match_record& record : match_set.match_records) {
+            on_match(record, match_set.line_text(record));
+        }
+    }
+
+    // You name the terms or edit distance behind a matching line, or return an empty string
+    std::string match_labels(std::string_view line_text) const {
+        return visit_query_matcher(active_query, [&](const auto& line_matcher) {
+            return line_matcher.describe_line_matches(line_text.data(), line_text.data() + line_text.size());
+        });
+    }
+
+    // You search the files of a trigram index, scanning only the blocks that can hold a match
+    index_search_summary search_index(const trigram_index& index,
+                                      const std::function<void(directory_file_result&)>& on_file_result) const {
+        return index.search(active_query, query_index_plan(active_query), search_context, on_file_result);
+    }
+
+    // You search every text file below a directory; the callback receives each file in path order
+    // Workers search with their own copies of the query, so the callback may call match_labels
+    // Line, word and character counts come from the same scan when gather_statistics is set
+    directory_search_summary search_directory(const std::string& directory_path,
+                                              reorder_buffer<directory_file_result>::result_emitter on_file_result,
+                                              bool gather_statistics = false) const {
+        return search_directory_tree(directory_path, active_query, search_context, std::move(on_file_result),
+                                     gather_statistics);
+    }
+
+private:
+    compiled_query active_query;
+    context_window_options search_context;
+};
+
+#endif // TEXT_SEARCH_ENGINE_H
\ No newline at end of file